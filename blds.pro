@@ -50,5 +50,24 @@ win32 {
 }
 
 # Input
-HEADERS += include/client.h include/data-frame.h include/server.h
-SOURCES += src/client.cc src/main.cc src/server.cc
+HEADERS += include/client.h include/data-frame.h include/server.h \
+	include/multicast-publisher.h include/frame-codec.h \
+	include/sample-kernels.h include/stream-monitor.h \
+	include/session.h include/recording-reader.h include/chunk-cache.h \
+	include/mapped-recording.h include/recording-catalog.h \
+	include/envelope-pyramid.h include/time-index.h
+SOURCES += src/client.cc src/main.cc src/server.cc \
+	src/multicast-publisher.cc src/frame-codec.cc \
+	src/sample-kernels.cc src/stream-monitor.cc \
+	src/session.cc src/recording-reader.cc src/chunk-cache.cc \
+	src/mapped-recording.cc src/recording-catalog.cc \
+	src/envelope-pyramid.cc src/time-index.cc
+
+unix {
+	HEADERS += include/shared-memory-ring.h
+	SOURCES += src/shared-memory-ring.cc
+}
+
+linux {
+	LIBS += -lrt
+}
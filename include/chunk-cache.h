@@ -0,0 +1,122 @@
+/*! \file chunk-cache.h
+ *
+ * Least-recently-used cache of chunks of data read from recordings.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef BLDS_CHUNK_CACHE_H
+#define BLDS_CHUNK_CACHE_H
+
+#include "data-frame.h"
+
+#include <QtCore>
+
+#include <list>
+
+/*! \class ChunkCache
+ * The ChunkCache class keeps chunks of data read from recordings, so that
+ * requests of any client for the same samples of the same file are served
+ * from memory.
+ *
+ * Chunks are kept as data frames, keyed by the path of the file and the
+ * range of samples. Copies of a frame share its samples, and any payloads
+ * converted to other types or layouts, so a chunk sent to several clients
+ * is read, and converted, once. The cache holds at most a budget of bytes
+ * of samples and their conversions, evicting the least recently used
+ * chunks beyond it. Chunks are converted after they are inserted, so
+ * their sizes are counted again whenever another chunk is inserted.
+ *
+ * Recordings do not change once written, so chunks only become invalid
+ * when a file is replaced, see remove().
+ *
+ * The cache is not thread-safe, and is used from a single thread.
+ */
+class ChunkCache {
+
+	public:
+
+		/*! Construct a cache.
+		 *
+		 * \param budget The maximum number of bytes of samples kept. Zero
+		 * 	disables the cache.
+		 */
+		ChunkCache(qint64 budget);
+
+		/*! Copying is not allowed. */
+		ChunkCache(const ChunkCache&) = delete;
+		ChunkCache& operator=(const ChunkCache&) = delete;
+
+		/*! Look up a chunk, marking it as most recently used.
+		 *
+		 * Returns true and sets frame if the chunk is cached. This counts
+		 * as a hit or a miss.
+		 */
+		bool find(const QString& file, quint64 start, quint64 stop, DataFrame *frame);
+
+		/*! Return true if a chunk is cached, without counting or using it. */
+		bool contains(const QString& file, quint64 start, quint64 stop) const;
+
+		/*! Insert a chunk, evicting others as needed to stay within the budget,
+		 * including conversions made since the last insertion.
+		 *
+		 * Chunks larger than the whole budget are not kept.
+		 */
+		void insert(const QString& file, quint64 start, quint64 stop,
+				const DataFrame& frame);
+
+		/*! Remove all chunks of a file, e.g., when it is replaced. */
+		void remove(const QString& file);
+
+		/*! Return the counters of the cache, e.g., for the HTTP server. */
+		QVariantMap status() const;
+
+	private:
+
+		struct Key {
+			QString file;
+			quint64 start;
+			quint64 stop;
+
+			bool operator==(const Key& other) const
+			{
+				return (start == other.start) && (stop == other.stop) &&
+					(file == other.file);
+			}
+		};
+
+		friend uint qHash(const Key& key, uint seed)
+		{
+			return qHash(key.file, seed) ^ qHash(key.start, seed) ^
+				(qHash(key.stop, seed) << 1);
+		}
+
+		struct Entry {
+			Key key;
+			DataFrame frame;
+			qint64 bytes;
+		};
+
+		/* Count the bytes of all chunks again, with their conversions. */
+		void recount();
+
+		/* Remove the least recently used chunks until the cache holds at
+		 * most the given number of bytes.
+		 */
+		void evict(qint64 bytes);
+
+		qint64 m_budget;
+		qint64 m_bytes;
+
+		/* Chunks, most recently used first, and their index by key. */
+		std::list<Entry> m_entries;
+		QHash<Key, std::list<Entry>::iterator> m_index;
+
+		quint64 m_hits;
+		quint64 m_misses;
+		quint64 m_insertions;
+		quint64 m_evictions;
+};
+
+#endif
+
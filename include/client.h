@@ -9,21 +9,107 @@
 #define BLDS_CLIENT_H
 
 #include "data-frame.h"
+#include "envelope-pyramid.h"
+#include "frame-codec.h"
+#include "recording-catalog.h"
 
 #include <QtCore>
 #include <QtNetwork>
 
+#include <memory> // std::shared_ptr
+
+class Session;
+
 /*! \class Client
  * The Client class represents a remote client of the BLDS.
  *
  * This class implements the communcation protocol, both receiving and sending,
  * between the server and client.
+ *
+ * Outgoing messages are split into two priorities. Control messages (replies
+ * to requests and errors) are written to the socket immediately. Data frames
+ * are bulk traffic: they are handed to the socket only while it has less than
+ * a limit of bytes waiting to be written (by default `DefaultMaxSocketBulkBytes`,
+ * see setSocketProfile()), and are otherwise queued in the
+ * Client. Control replies thus overtake any data frames still in the queue,
+ * and wait behind at most roughly one frame plus that limit. Because of this,
+ * clients must not assume that a reply follows data frames sent in response
+ * to earlier requests.
+ *
+ * Whenever nothing is waiting in the socket, data frames are written with
+ * a single scatter-gather call directly from the message header and the
+ * frame's samples, without any intermediate copy. For large frames on TCP
+ * sockets, the kernel's zero-copy transmission (MSG_ZEROCOPY) may be used
+ * as well, see setZeroCopyThreshold().
+ *
+ * Raw exports of recordings, see sendRawExport(), are sent from the file
+ * straight to the socket with `sendfile()`, in their place among the data
+ * frames. Any other messages written during the transfer wait until it
+ * is done.
  */
 class Client : public QObject {
 	Q_OBJECT
 
+	/*! Maximum number of bytes waiting in the socket before data frames
+	 * are queued in the Client, behind any control messages.
+	 */
+	const qint64 DefaultMaxSocketBulkBytes = 1 << 20;
+
+	/*! Bytes waiting in the socket before queueing for latency clients. */
+	const qint64 LatencyMaxSocketBulkBytes = 64 << 10;
+
+	/*! Bytes waiting in the socket before queueing for throughput clients. */
+	const qint64 ThroughputMaxSocketBulkBytes = 8 << 20;
+
+	/*! Kernel send buffer size for latency clients. */
+	const int LatencySendBufferSize = 64 << 10;
+
+	/*! Kernel send and receive buffer size for throughput clients. */
+	const int ThroughputSocketBufferSize = 4 << 20;
+
+	/*! Maximum time live frames are held for coalescing for throughput
+	 * clients, in milliseconds.
+	 */
+	const quint32 ThroughputMaxLatency = 100;
+
+	/*! Maximum number of data frames of a client encoded at once. Later
+	 * frames wait in the encode queue until earlier ones are written.
+	 */
+	const int MaxConcurrentEncodes = 4;
+
+	/*! Minimum time between messages with the progress of an export,
+	 * in milliseconds.
+	 */
+	const qint64 ExportProgressInterval = 1000;
+
 	public:
 
+		/*! Profiles for tuning the client's socket.
+		 *
+		 * Clients with opposite needs may request the profile which best
+		 * suits them.
+		 */
+		enum class SocketProfile {
+			/*! Nagle's algorithm as when the client connected, frames
+			 * sent as read. Kernel buffer sizes set by another profile
+			 * are kept, as the system's automatic tuning of them cannot
+			 * be restored.
+			 */
+			Default,
+
+			/*! Disable Nagle's algorithm, keep small kernel and user-space
+			 * buffers, and send every frame immediately. This suits
+			 * closed-loop clients.
+			 */
+			Latency,
+
+			/*! Large kernel and user-space buffers, and live frames from
+			 * several reads of the source coalesced into one, for up to
+			 * `ThroughputMaxLatency`. This suits bulk and archival clients.
+			 */
+			Throughput
+		};
+
 		/*! Simple structure used internally to manage pending
 		 * requests for data.
 		 */
@@ -33,8 +119,38 @@ class Client : public QObject {
 
 			/*! Time of the stop of a chunk of data requested. */
 			float stop;
+
+			/*! Index of the first sample of the chunk requested. */
+			quint64 startSample;
+
+			/*! Index one past the last sample of the chunk requested. */
+			quint64 stopSample;
+
+			/*! True if the client addressed this request by sample index,
+			 * in which case the reply carries sample indices as well.
+			 */
+			bool sampleIndexed;
+
+			/*! Identifier chosen by the client, used to cancel the request,
+			 * or zero if none.
+			 */
+			quint32 id;
+
+			/*! Time after which the request is dropped if it is still pending,
+			 * in milliseconds on the monotonic clock, or zero if never.
+			 * See deadlineAfter().
+			 */
+			qint64 deadline;
+
+			/*! True if the request is part of an export, see startExport(). */
+			bool exported;
 		};
 
+		/*! Return the deadline of a request which expires after the given
+		 * timeout in milliseconds, or zero if the timeout is zero.
+		 */
+		static qint64 deadlineAfter(quint32 timeout);
+
 		/*! Construct a Client.
 		 * 
 		 * \param socket The TCP socket with which to communicate with the client.
@@ -42,6 +158,16 @@ class Client : public QObject {
 		 */
 		Client(QTcpSocket* socket, QObject* parent = nullptr);
 
+		/*! Construct a Client connected through a local socket.
+		 *
+		 * \param socket The local (Unix domain or named pipe) socket with
+		 * 	which to communicate with the client.
+		 * \param parent The parent QObject.
+		 *
+		 * Local clients use exactly the same protocol as remote ones.
+		 */
+		Client(QLocalSocket* socket, QObject* parent = nullptr);
+
 		/*! Destroy a client. */
 		~Client();
 
@@ -50,13 +176,154 @@ class Client : public QObject {
 		Client(Client&&) = delete;
 		Client& operator=(const Client&) = delete;
 
-		/*! Return the remote IP address and port number. */
+		/*! Return the remote IP address and port number, or a description
+		 * of the local socket for local clients.
+		 */
 		inline QString address() const
 		{
-			return (m_socket->peerAddress().toString() + ":" +
-					QString::number(m_socket->peerPort()));
+			return m_address;
 		}
 
+		/*! Return the number of bytes of data frames queued for this client
+		 * which have not yet been handed to the socket, including frames
+		 * waiting to be encoded, counted before encoding.
+		 */
+		qint64 queuedBulkBytes() const;
+
+		/*! Set the minimum size of a frame sent using zero-copy transmission.
+		 *
+		 * \param bytes Frames whose samples are at least this large are sent
+		 * 	with MSG_ZEROCOPY, in which case the kernel transmits directly from
+		 * 	the frame's memory and the frame is held until the kernel signals
+		 * 	completion. Zero disables zero-copy transmission.
+		 *
+		 * This is only supported for TCP clients on Linux, and is ignored
+		 * otherwise.
+		 */
+		void setZeroCopyThreshold(qint64 bytes);
+
+		/*! Return the current socket profile. */
+		SocketProfile socketProfile() const;
+
+		/*! Set the socket profile.
+		 *
+		 * This sets the socket options of TCP clients, the amount of data
+		 * buffered in the socket before queueing, and the maximum latency
+		 * of live frames.
+		 */
+		void setSocketProfile(SocketProfile profile);
+
+		/*! Return the maximum time live frames are held for coalescing,
+		 * in milliseconds.
+		 */
+		quint32 maxLatency() const;
+
+		/*! Set the maximum time live frames are held for coalescing.
+		 *
+		 * \param ms Consecutive live frames are merged into a single frame,
+		 * 	until holding the next would delay the first beyond this many
+		 * 	milliseconds. A timer guarantees that no frame is held longer.
+		 * 	Zero sends every frame as it is read from the source.
+		 */
+		void setMaxLatency(quint32 ms);
+
+		/*! Send the client a frame of live data.
+		 *
+		 * Unlike sendDataFrame(), this may hold the frame to coalesce it
+		 * with following live frames, up to the maximum latency.
+		 *
+		 * \param frame The data frame to be sent.
+		 */
+		void sendLiveDataFrame(const DataFrame& frame);
+
+		/*! Send any live frames held for coalescing immediately. */
+		void flushLiveData();
+
+		/*! Return the encoding used for data frames sent to this client. */
+		framecodec::Encoding encoding() const;
+
+		/*! Set the encoding used for data frames sent to this client.
+		 *
+		 * Frames in any encoding other than framecodec::Encoding::Raw are
+		 * encoded on a pool of worker threads, and sent as `data-encoded`
+		 * messages in the same order as they were sent.
+		 */
+		void setEncoding(framecodec::Encoding encoding);
+
+		/*! Return the type of the samples sent to this client. */
+		DataFrame::SampleType sampleType() const;
+
+		/*! Set the type of the samples sent to this client.
+		 *
+		 * Clients receiving any type other than DataFrame::SampleType::Int16
+		 * are sent all frames as `data-typed` messages, whose header carries
+		 * the sample type, see DataFrame::serializeTypedHeaderInto().
+		 */
+		void setSampleType(DataFrame::SampleType type);
+
+		/*! Return the layout of the samples sent to this client. */
+		DataFrame::SampleLayout sampleLayout() const;
+
+		/*! Set the layout of the samples sent to this client.
+		 *
+		 * As with setSampleType(), clients receiving any layout other than
+		 * DataFrame::SampleLayout::ChannelMajor are sent all frames as
+		 * `data-typed` messages.
+		 */
+		void setSampleLayout(DataFrame::SampleLayout layout);
+
+		/*! Return the number of data frames sent to this client.
+		 *
+		 * Frames are numbered from 1 in the order they are sent, and
+		 * `data-typed` messages carry this number, so that clients may detect
+		 * dropped or reordered frames. See also setFrameSequence().
+		 */
+		quint64 framesSent() const;
+
+		/*! Return true if `data` and `data-samples` messages carry the
+		 * sequence number of their frame.
+		 */
+		bool sendsFrameSequence() const;
+
+		/*! Set whether `data` and `data-samples` messages carry the sequence
+		 * number of their frame, as a uint64_t following the frame header.
+		 *
+		 * Clients with a session are always sent the sequence numbers, which
+		 * they need to resume it. Others must enable them, as the layout of
+		 * these messages is otherwise unchanged from older versions.
+		 */
+		void setFrameSequence(bool enabled);
+
+		/*! Return the session of this client, or null if it has none. */
+		std::shared_ptr<Session> session() const;
+
+		/*! Open a session for this client.
+		 *
+		 * The session numbers and keeps all data frames sent to the client
+		 * from now on, continuing from the number already sent. All data
+		 * messages carry these numbers from now on, see setFrameSequence().
+		 */
+		void openSession(std::shared_ptr<Session> session);
+
+		/*! Resume a session from which another connection was detached.
+		 *
+		 * This restores the options and requests saved in the session, and
+		 * sends every frame in its history after the given one.
+		 *
+		 * \param session The session to resume.
+		 * \param lastSequence The sequence number of the last frame the
+		 * 	client received.
+		 */
+		void resumeSession(std::shared_ptr<Session> session, quint64 lastSequence);
+
+		/*! Detach this client from its session, saving its options and
+		 * requests in the session, e.g., when the client disconnects.
+		 *
+		 * \param inFlight Requests already taken from the client but not
+		 * 	yet sent, e.g., being read, which are saved with the others.
+		 */
+		void detachSession(const QList<DataRequest>& inFlight = {});
+
 		/*! Return whether the client has requested all data.
 		 *
 		 * Clients may, before a recording begins, request that the server send
@@ -74,8 +341,10 @@ class Client : public QObject {
 
 		/*! Add a pending request for data.
 		 *
-		 * \param start The start time of the chunk of data requested.
-		 * \param stop The stop time of the chunk of data requested.
+		 * \param request The chunk of data requested. The sample indices
+		 * 	of the request must be valid, whether or not the client addressed
+		 * 	it by time or by sample.
+		 *
 		 * No checks are performed that the data hasn't already been sent, 
 		 * nor are attempts made to coalesce data into fewer chunks or 
 		 * de-duplicate frames sent to the client.
@@ -83,7 +352,7 @@ class Client : public QObject {
 		 * Pending requests for data are sent as soon as the data becomes
 		 * available from the managed data source.
 		 */
-		void addPendingDataRequest(float start, float stop);
+		void addPendingDataRequest(const DataRequest& request);
 
 		/*! Return the number of pending data requests. */
 		int countPendingRequests() const;
@@ -95,11 +364,130 @@ class Client : public QObject {
 		 */
 		DataRequest nextPendingRequest();
 
-		/*! Return the number of servicable requests, based on the time.
+		/*! Return the number of servicable requests, based on the available data.
+		 *
+		 * \param nsamples Requests that end at or before this sample are
+		 * 	considered servicable.
+		 */
+		int numServicableRequests(quint64 nsamples) const;
+
+		/*! Cancel pending requests for data, and return the number cancelled.
+		 *
+		 * \param id If not zero, requests with this identifier are cancelled.
+		 * \param start If the identifier is zero, requests overlapping the
+		 * 	samples [start, stop) are cancelled.
+		 * \param stop The index one past the last sample of the range.
+		 */
+		int cancelPendingRequests(quint32 id, quint64 start, quint64 stop);
+
+		/*! Queue a request whose data is available, to be sent as a
+		 * stream of consecutive frames rather than as a single one.
+		 *
+		 * The Server sends the next frame of the stream on each
+		 * streamReady() signal.
+		 */
+		void addStreamedRequest(const DataRequest& request);
+
+		/*! Return true if any streamed requests remain to be sent. */
+		bool hasStreamedRequests() const;
+
+		/*! Return the number of streamed requests remaining, not
+		 * including exports.
+		 */
+		int countStreamedRequests() const;
+
+		/*! Take the next piece of the first streamed request.
+		 *
+		 * \param maxSamples The maximum number of samples in the piece.
+		 *
+		 * This should NOT be called unless hasStreamedRequests() is true.
+		 */
+		DataRequest takeStreamedPiece(quint64 maxSamples);
+
+		/*! Drop the rest of the streamed request to which the given
+		 * piece belongs, e.g., after its data could not be read.
+		 */
+		void dropStreamedRequest(const DataRequest& piece);
+
+		/*! Drop all streamed requests. */
+		void clearStreamedRequests();
+
+		/*! Return true if data frames sent now would be handed to the
+		 * socket immediately, rather than queued in the Client.
+		 */
+		bool readyForBulk() const;
+
+		/*! Emit streamReady() from the event loop, if any streamed requests
+		 * remain and it is not already scheduled.
+		 */
+		void scheduleStream();
+
+		/*! Return true if the client is exporting a recording. */
+		bool isExporting() const;
+
+		/*! Start exporting a recording to the client.
+		 *
+		 * \param id Identifier of the export chosen by the client, with
+		 * 	which it may be cancelled as any request.
+		 * \param start The index of the first sample exported.
+		 * \param stop The index one past the last sample exported.
+		 * \param firstChannel The index of the first channel exported.
+		 * \param nchannels The number of channels exported.
 		 *
-		 * \param time Requests that end before this time are considered servicable.
+		 * The samples are queued as a streamed request, whose frames are
+		 * passed to sendExportedFrame() as they are read. Progress is sent
+		 * as `export-progress` messages, after the frames they count.
 		 */
-		int numServicableRequests(float time) const;
+		void startExport(quint32 id, quint64 start, quint64 stop,
+				quint32 firstChannel, quint32 nchannels);
+
+		/*! Send the client the next frame of its export, keeping only the
+		 * exported channels. Frames not following the last one sent, e.g.,
+		 * of a cancelled export, are dropped.
+		 */
+		void sendExportedFrame(const DataFrame& frame);
+
+		/*! Stop the current export, e.g., when its data cannot be read. */
+		void abortExport();
+
+		/*! Return true if files may be sent to this client with
+		 * sendRawExport(), i.e., if its native socket may be written directly.
+		 */
+		bool canSendFiles() const;
+
+		/*! Return the largest number of bytes of samples sent in one
+		 * raw export, so that the message size fits its 32-bit field.
+		 */
+		static quint64 maxRawExportBytes();
+
+		/*! Send the client samples of a recording straight from its file,
+		 * as an `export-raw` message.
+		 *
+		 * \param start The index of the first sample sent.
+		 * \param stop The index one past the last sample sent.
+		 * \param nchannels The number of channels of the recording.
+		 * \param layout The layout of the samples in the file.
+		 * \param file The recording, open for reading.
+		 * \param regions The offsets and sizes of the regions of the file
+		 * 	holding the samples, in the order they are sent.
+		 *
+		 * The message is sent after any data frames already queued, and
+		 * carries a header synthesized from the arguments:
+		 * 	- success (bool, true)
+		 * 	- start sample (uint64_t)
+		 * 	- stop sample (uint64_t)
+		 * 	- number of samples (uint32_t)
+		 * 	- number of channels (uint32_t)
+		 * 	- sample layout (uint32_t, a value of DataFrame::SampleLayout)
+		 * 	- samples (array of int16_t)
+		 *
+		 * The samples are copied from the file to the socket by the kernel.
+		 * This must only be called if canSendFiles() is true, and the total
+		 * size of the regions is at most maxRawExportBytes().
+		 */
+		void sendRawExport(quint64 start, quint64 stop, quint32 nchannels,
+				DataFrame::SampleLayout layout, std::shared_ptr<QFile> file,
+				const QList<QPair<qint64, qint64>>& regions);
 
 	public slots:
 
@@ -176,6 +564,123 @@ class Client : public QObject {
 		 */
 		void sendAllDataResponse(bool success, const QByteArray& msg = "");
 
+		/*! Send the Client a response to a request to open a session.
+		 *
+		 * \param success True if the request succeeded, else false.
+		 * \param msg The token of the session, or an error message.
+		 */
+		void sendOpenSessionResponse(bool success, const QByteArray& msg);
+
+		/*! Send the Client a response to a request to resume a session.
+		 *
+		 * \param success True if the request succeeded, else false.
+		 * \param msg An error message if the request failed, or a note of
+		 * 	any frames which could not be replayed.
+		 */
+		void sendResumeSessionResponse(bool success, const QByteArray& msg = "");
+
+		/*! Send the Client a response to a request to set one of its own parameters.
+		 *
+		 * \param param The name of the parameter that was requested.
+		 * \param success True if the request succeeded, else false.
+		 * \param msg If the request failed, this contains an error message.
+		 */
+		void sendClientSetResponse(const QByteArray& param, bool success,
+				const QByteArray& msg = "");
+
+		/*! Send the Client a response to a request to cancel pending requests.
+		 *
+		 * \param success True if the request succeeded, else false.
+		 * \param count The number of requests cancelled.
+		 * \param msg If the request failed, this contains an error message.
+		 */
+		void sendCancelDataResponse(bool success, quint32 count,
+				const QByteArray& msg = "");
+
+		/*! Send the Client a response to a request to open a recording.
+		 *
+		 * \param success True if the request succeeded, else false.
+		 * \param sampleRate The sample rate of the recording.
+		 * \param nsamples The number of samples in the recording.
+		 * \param nchannels The number of channels in the recording.
+		 * \param msg If the request failed, this contains an error message.
+		 */
+		void sendOpenRecordingResponse(bool success, double sampleRate,
+				quint64 nsamples, quint32 nchannels, const QByteArray& msg = "");
+
+		/*! Send the Client a response to a request to close its recording.
+		 *
+		 * \param success True if the request succeeded, else false.
+		 * \param msg If the request failed, this contains an error message.
+		 */
+		void sendCloseRecordingResponse(bool success, const QByteArray& msg = "");
+
+		/*! Send the Client the recordings in the save directory.
+		 *
+		 * Each recording is sent as its path relative to the save directory,
+		 * the size of its file, the times the file was created and last
+		 * modified, whether its metadata has been read and, if so, its sample
+		 * rate, number of samples and channels, and configuration hash.
+		 *
+		 * \param recordings The recordings in the catalog.
+		 */
+		void sendRecordingsResponse(const QList<RecordingCatalog::Entry>& recordings);
+
+		/*! Send the Client the envelope of a stretch of a recording.
+		 *
+		 * The reply carries the identifier of the request, the range of
+		 * samples covered, the number of samples of each bin, the number of
+		 * bins and channels, the gain and offset of the samples, and then
+		 * for each bin the minima of the channels followed by their maxima.
+		 * It is sent in order with any frames being sent.
+		 *
+		 * \param id The identifier of the request.
+		 * \param envelope The envelope.
+		 * \param gain The gain of the samples.
+		 * \param offset The offset of the samples.
+		 */
+		void sendEnvelopeResponse(quint32 id, const EnvelopePyramid::Envelope& envelope,
+				float gain, float offset);
+
+		/*! Send the Client a failed response to a request for an envelope.
+		 *
+		 * \param id The identifier of the request.
+		 * \param msg The error message.
+		 */
+		void sendEnvelopeFailure(quint32 id, const QByteArray& msg);
+
+		/*! Send the Client the samples corresponding to a time on the wall
+		 * clock.
+		 *
+		 * \param success True if the time was found, else false.
+		 * \param id The identifier of the request.
+		 * \param start The sample received at the last indexed time before.
+		 * \param stop The sample received at the first indexed time after.
+		 * \param sample The sample interpolated between them.
+		 * \param msg If the request failed, this contains an error message.
+		 */
+		void sendTimeToSampleResponse(bool success, quint32 id, quint64 start,
+				quint64 stop, quint64 sample, const QByteArray& msg = "");
+
+		/*! Send the Client a response to a request to export a recording.
+		 *
+		 * \param success True if the export started, else false.
+		 * \param id The identifier of the export.
+		 * \param start The index of the first sample exported.
+		 * \param stop The index one past the last sample exported.
+		 * \param nchannels The number of channels exported.
+		 * \param msg If the request failed, this contains an error message.
+		 */
+		void sendExportResponse(bool success, quint32 id, quint64 start,
+				quint64 stop, quint32 nchannels, const QByteArray& msg = "");
+
+		/*! Send the Client a failed response to a request to export a
+		 * recording raw. Successful exports are sent with sendRawExport().
+		 *
+		 * \param msg The error message.
+		 */
+		void sendExportRawFailure(const QByteArray& msg);
+
 		/*! Send the client an error message.
 		 * 
 		 * \param msg The error message to be sent.
@@ -183,11 +688,24 @@ class Client : public QObject {
 		void sendErrorMessage(const QByteArray& msg);
 
 		/*! Send the client the given frame of data.
+		 *
+		 * This sends a `data` message, or a `data-typed` message if the client
+		 * has requested another sample type.
 		 *
 		 * \param frame The data from to be sent.
 		 */
 		void sendDataFrame(const DataFrame& frame);
 
+		/*! Send the client the given frame of data, with sample indices.
+		 *
+		 * This sends a `data-samples` message, in which the frame header
+		 * carries the exact 64-bit start and stop sample indices, rather
+		 * than the start and stop times in seconds.
+		 *
+		 * \param frame The data frame to be sent.
+		 */
+		void sendSampleIndexedDataFrame(const DataFrame& frame);
+
 	signals:
 
 		/*! Emitted when the client disconnects.
@@ -264,8 +782,44 @@ class Client : public QObject {
 		 * \param client The client which received the message.
 		 * \param start The start time of the data chunk to receive.
 		 * \param stop The stop time of the data chunk to receive.
+		 * \param id Identifier of the request chosen by the client, or zero.
+		 * \param timeout Time after which the request is dropped if the data
+		 * 	is not yet available, in milliseconds, or zero if never.
+		 *
+		 * The identifier and timeout are optional, and follow the start
+		 * and stop in the message as two uint32_t values.
+		 */
+		void dataRequest(Client *client, float start, float stop,
+				quint32 id, quint32 timeout);
+
+		/*! Emitted when the client requests a chunk of data by sample index.
+		 *
+		 * \param client The client which received the message.
+		 * \param start The index of the first sample to receive.
+		 * \param stop The index one past the last sample to receive.
+		 * \param id Identifier of the request chosen by the client, or zero.
+		 * \param timeout Time after which the request is dropped, or zero.
+		 */
+		void sampleDataRequest(Client *client, quint64 start, quint64 stop,
+				quint32 id, quint32 timeout);
+
+		/*! Emitted when the client cancels pending requests for data.
+		 *
+		 * \param client The client which received the message.
+		 * \param id If not zero, the identifier of the requests to cancel.
+		 * \param start If the identifier is zero, requests overlapping the
+		 * 	samples [start, stop) are cancelled.
+		 * \param stop The index one past the last sample of the range.
 		 */
-		void dataRequest(Client *client, float start, float stop);
+		void cancelDataRequest(Client *client, quint32 id, quint64 start, quint64 stop);
+
+		/*! Emitted when the client is ready for the next frame of a
+		 * streamed request, i.e., when the previous one has been handed to
+		 * the socket.
+		 *
+		 * \param client The client which is ready.
+		 */
+		void streamReady(Client *client);
 
 		/*! Emitted when the client requests all available data from managed source.
 		 *
@@ -275,7 +829,162 @@ class Client : public QObject {
 		 */
 		void allDataRequest(Client *client, bool requested);
 
+		/*! Emitted when the client requests to set one of its own parameters.
+		 *
+		 * These parameters control how the server communicates with this
+		 * client alone, e.g., its "socket-profile".
+		 *
+		 * \param client The client which received the message.
+		 * \param param The name of the parameter to be set.
+		 * \param data The value of the parameter, suitably encoded.
+		 */
+		void setClientParamMessage(Client *client, const QByteArray& param,
+				const QVariant& data);
+
+		/*! Emitted when the client requests a session, with which it may
+		 * resume its subscription after reconnecting.
+		 *
+		 * \param client The client which received the message.
+		 */
+		void openSessionMessage(Client *client);
+
+		/*! Emitted when the client requests to resume a session.
+		 *
+		 * \param client The client which received the message.
+		 * \param token The token of the session.
+		 * \param lastSequence The sequence number of the last frame the
+		 * 	client received.
+		 */
+		void resumeSessionMessage(Client *client, const QByteArray& token,
+				quint64 lastSequence);
+
+		/*! Emitted when the client requests to open a finished recording.
+		 *
+		 * While a recording is open, the client's requests for data are
+		 * read from it rather than from the current recording.
+		 *
+		 * \param client The client which received the message.
+		 * \param path The path of the recording, relative to the save directory.
+		 */
+		void openRecordingMessage(Client *client, const QString& path);
+
+		/*! Emitted when the client requests to close its open recording.
+		 *
+		 * \param client The client which received the message.
+		 */
+		void closeRecordingMessage(Client *client);
+
+		/*! Emitted when the client requests the list of recordings in
+		 * the save directory.
+		 *
+		 * \param client The client which received the message.
+		 */
+		void getRecordingsMessage(Client *client);
+
+		/*! Emitted when the client requests the minimum and maximum
+		 * envelope of a stretch of a recording.
+		 *
+		 * \param client The client which received the message.
+		 * \param start The index of the first sample of the stretch.
+		 * \param stop The index one past the last sample of the stretch,
+		 * 	or zero for all available samples.
+		 * \param width The number of bins wanted, e.g., the width of the
+		 * 	view in pixels.
+		 * \param firstChannel The index of the first channel.
+		 * \param nchannels The number of channels, or zero for all channels
+		 * 	from the first.
+		 * \param id Identifier of the request chosen by the client.
+		 */
+		void getEnvelopeMessage(Client *client, quint64 start, quint64 stop,
+				quint32 width, quint32 firstChannel, quint32 nchannels, quint32 id);
+
+		/*! Emitted when the client requests the samples of a recording
+		 * corresponding to a time on the wall clock.
+		 *
+		 * \param client The client which received the message.
+		 * \param time Microseconds since the epoch, in UTC.
+		 * \param id Identifier of the request chosen by the client.
+		 */
+		void timeToSampleMessage(Client *client, qint64 time, quint32 id);
+
+		/*! Emitted when the client requests a recording exported as a
+		 * stream of frames.
+		 *
+		 * \param client The client which received the message.
+		 * \param start The index of the first sample to export.
+		 * \param stop The index one past the last sample to export, or
+		 * 	zero for all available samples.
+		 * \param firstChannel The index of the first channel to export.
+		 * \param nchannels The number of channels to export, or zero for
+		 * 	all channels from the first.
+		 * \param id Identifier of the export chosen by the client.
+		 */
+		void exportMessage(Client *client, quint64 start, quint64 stop,
+				quint32 firstChannel, quint32 nchannels, quint32 id);
+
+		/*! Emitted when the client requests samples of its open recording
+		 * sent raw, straight from the file.
+		 *
+		 * \param client The client which received the message.
+		 * \param start The index of the first sample to receive.
+		 * \param stop The index one past the last sample to receive.
+		 */
+		void exportRawMessage(Client *client, quint64 start, quint64 stop);
+
 	private:
+		/* Regions of a file sent after the header of a bulk message. */
+		struct FileTransfer {
+			std::shared_ptr<QFile> file;
+			QList<QPair<qint64, qint64>> regions;
+		};
+
+		/* A data message waiting to be written. The header includes the
+		 * size of the message, its type, and the frame header, and is
+		 * followed on the wire by the payload. The payload is the samples
+		 * of the frame, possibly converted, and the frame is held so that
+		 * they remain valid. Raw exports are followed by regions of a file
+		 * instead.
+		 */
+		struct BulkMessage {
+			QByteArray header;
+			DataFrame frame;
+			QByteArray payload;
+			std::shared_ptr<FileTransfer> transfer;
+		};
+
+		/* A data message waiting to be encoded, or waiting behind others
+		 * being encoded. Messages with the raw encoding are written as they
+		 * are, and the watcher of others is null until encoding starts.
+		 */
+		struct EncodingMessage {
+			framecodec::Encoding encoding;
+			QFutureWatcher<QByteArray> *watcher;
+			QByteArray header;
+			DataFrame frame;
+			DataFrame::SampleType type;
+			DataFrame::SampleLayout layout;
+		};
+
+		/* An export of a recording, see startExport(). Next is the index
+		 * of the next sample to send.
+		 */
+		struct Export {
+			quint32 id;
+			quint64 start;
+			quint64 stop;
+			quint64 next;
+			quint32 firstChannel;
+			quint32 nchannels;
+		};
+
+		/* Construct a Client from any socket-like device.
+		 *
+		 * The descriptor is the native socket, or -1 if it may not be
+		 * written directly.
+		 */
+		Client(QIODevice* socket, const QString& address, 
+				qintptr descriptor, QObject* parent);
+
 		/* Handle new data received on the socket. */
 		void handleReadyRead();
 		
@@ -289,7 +998,99 @@ class Client : public QObject {
 		void handleServerGetMessage(quint32 size);
 		void handleSourceGetMessage(quint32 size);
 		void handleDataRequestMessage(quint32 size);
+		void handleSampleDataRequestMessage(quint32 size);
 		void handleAllDataRequestMessage(quint32 size);
+		void handleCancelDataRequestMessage(quint32 size);
+		void handleClientSetMessage(quint32 size);
+		void handleResumeSessionMessage(quint32 size);
+		void handleOpenRecordingMessage(quint32 size);
+		void handleExportMessage(quint32 size);
+		void handleGetEnvelopeMessage(quint32 size);
+		void handleTimeToSampleMessage(quint32 size);
+		void handleExportRawMessage(quint32 size);
+
+		/* Write a control message, prefixed with its size, to the socket
+		 * immediately.
+		 */
+		void writeControl(const QByteArray& msg);
+
+		/* Return true if frames must be sent as data-typed messages. */
+		bool sendsTypedFrames() const;
+
+		/* Number a data frame about to be sent, recording it in the
+		 * session if there is one.
+		 */
+		quint64 nextFrameSequence(const DataFrame& frame, bool sampleIndexed);
+
+		/* Drop pending requests whose deadline has passed, and schedule
+		 * the next expiry.
+		 */
+		void expirePendingRequests();
+
+		/* Send a numbered frame, in the format the client requested. */
+		void sendFrame(const DataFrame& frame, bool sampleIndexed, quint64 sequence);
+
+		/* Send a frame as a data-typed message, with samples of the
+		 * client's type and layout.
+		 */
+		void sendTypedDataFrame(const DataFrame& frame, quint64 sequence);
+
+		/* Write a message in order with data messages, after any frames
+		 * already sent, rather than as a control message.
+		 */
+		void writeOrdered(const QByteArray& msg);
+
+		/* Send the progress of the current export. */
+		void sendExportProgress();
+
+		/* Write a data message, encoding it first if required. */
+		void writeFrame(const QByteArray& header, const DataFrame& frame,
+				DataFrame::SampleType type = DataFrame::SampleType::Int16,
+				DataFrame::SampleLayout layout = DataFrame::SampleLayout::ChannelMajor);
+
+		/* Write any frames at the front of the queue which have finished
+		 * encoding.
+		 */
+		void drainEncodeQueue();
+
+		/* Start encoding the frames at the front of the queue, up to
+		 * MaxConcurrentEncodes at once.
+		 */
+		void startEncoding();
+
+		/* Write a data message to the socket, or queue it if the socket
+		 * already has enough bulk data waiting.
+		 *
+		 * \param header The message type and frame header.
+		 * \param frame The frame whose samples follow the header.
+		 * \param type The type to which the samples are converted.
+		 * \param layout The layout in which the samples are sent.
+		 */
+		void writeBulk(const QByteArray& header, const DataFrame& frame,
+				DataFrame::SampleType type = DataFrame::SampleType::Int16,
+				DataFrame::SampleLayout layout = DataFrame::SampleLayout::ChannelMajor);
+
+		/* Write a data message to the socket now. */
+		void transmitBulk(const BulkMessage& msg);
+
+		/* Write as much of a data message as possible directly to the
+		 * native socket with one scatter-gather call, and return the number
+		 * of bytes written.
+		 */
+		qint64 writeDirect(const BulkMessage& msg);
+
+		/* Release frames for which the kernel has completed zero-copy
+		 * transmission.
+		 */
+		void reapZeroCopyCompletions();
+
+		/* Write as much of the current raw export as the socket takes,
+		 * and finish it once all is written.
+		 */
+		void continueTransfer();
+
+		/* Move queued data messages to the socket as it drains. */
+		void handleBytesWritten();
 
 		/* Encode the data of a server parameter as a byte array.
 		 *
@@ -299,15 +1100,123 @@ class Client : public QObject {
 		QByteArray encodeServerGetResponseData(const QByteArray& param, 
 				const QVariant& data);
 
-		/* The local communcation endpoint. */
-		QTcpSocket* m_socket;
+		/* The local communcation endpoint, either a QTcpSocket or QLocalSocket. */
+		QIODevice* m_socket;
+
+		/* Description of the remote endpoint. */
+		QString m_address;
+
+		/* Native socket descriptor, or -1 if it may not be written directly. */
+		qintptr m_descriptor;
 
 		/* Data stream for helping to serialize/deserialize data on the socket. */
 		QDataStream m_stream;
 
+		/* Data messages waiting to be handed to the socket. */
+		QQueue<BulkMessage> m_bulkQueue;
+
+		/* Total size of all messages in the bulk queue. */
+		qint64 m_bulkQueueBytes;
+
+		/* Total size of all messages in the encode queue, before encoding. */
+		qint64 m_encodeQueueBytes;
+
+		/* Minimum size of frames sent with zero-copy transmission,
+		 * or zero if disabled.
+		 */
+		qint64 m_zeroCopyThreshold;
+
+		/* Counter of zero-copy sends, matching the kernel's own. */
+		quint32 m_zeroCopyCounter;
+
+		/* Messages sent with zero-copy transmission, held until the
+		 * kernel has finished with their memory.
+		 */
+		QList<QPair<quint32, BulkMessage>> m_zeroCopyPending;
+
+		/* Timer reaping zero-copy completions, running only while
+		 * messages are pending.
+		 */
+		QTimer m_zeroCopyTimer;
+
+		/* Raw export being written to the socket, or null. Its header is
+		 * removed as it is written, and its regions as they are sent.
+		 */
+		std::shared_ptr<BulkMessage> m_transfer;
+
+		/* Notifier of the socket becoming writable during a raw export. */
+		QSocketNotifier *m_transferNotifier;
+
+		/* Control messages written during a raw export. */
+		QList<QByteArray> m_deferredControl;
+
+		/* Current socket profile. */
+		SocketProfile m_socketProfile;
+
+		/* TCP_NODELAY of the socket when the client connected, or
+		 * invalid for other sockets.
+		 */
+		QVariant m_defaultLowDelay;
+
+		/* Bytes waiting in the socket before data frames are queued. */
+		qint64 m_maxSocketBulkBytes;
+
+		/* Maximum time live frames are held for coalescing, in milliseconds. */
+		quint32 m_maxLatency;
+
+		/* Live frames held for coalescing. */
+		QList<DataFrame> m_liveFrames;
+
+		/* Time since the first held live frame arrived. */
+		QElapsedTimer m_liveFramesAge;
+
+		/* Timer flushing held live frames at the maximum latency. */
+		QTimer m_flushTimer;
+
+		/* Timer dropping pending requests at the earliest deadline. */
+		QTimer m_expiryTimer;
+
+		/* Encoding of data frames sent to the client. */
+		framecodec::Encoding m_encoding;
+
+		/* Data messages being encoded, in the order they were sent. */
+		QQueue<EncodingMessage> m_encodeQueue;
+
+		/* Type of the samples sent to the client. */
+		DataFrame::SampleType m_sampleType;
+
+		/* Layout of the samples sent to the client. */
+		DataFrame::SampleLayout m_sampleLayout;
+
+		/* Sequence number of the last data frame sent to the client,
+		 * if it has no session.
+		 */
+		quint64 m_frameSequence;
+
+		/* Whether untyped data messages carry sequence numbers. */
+		bool m_frameSequenceEnabled;
+
+		/* Session numbering and keeping the frames sent, or null. */
+		std::shared_ptr<Session> m_session;
+
 		/* List of all pending requests for data. */
 		QList<DataRequest> m_pendingRequests;
 
+		/* Requests being sent as streams of frames, in order. The first
+		 * is advanced as each of its pieces is sent.
+		 */
+		QQueue<DataRequest> m_streamedRequests;
+
+		/* True if a streamReady() signal is scheduled. */
+		bool m_streamScheduled;
+
+		/* The current export, valid while exporting. */
+		Export m_export;
+		bool m_exporting;
+
+		/* Time since progress of the export was last sent. */
+		QElapsedTimer m_exportProgressAge;
+
 		/* True if the client wants to receive all data from a recording. */
 		bool m_requestedAllData;
 };
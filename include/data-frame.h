@@ -9,15 +9,29 @@
 #ifndef BLDS_DATA_FRAME_H
 #define BLDS_DATA_FRAME_H
 
+#include "sample-kernels.h"
+
 #include <armadillo>
 
 #include <QtCore>
 
+#include <memory> // std::shared_ptr
+
 /*! \class DataFrame
  * The DataFrame class represents a chunk of data from a data source. It 
  * includes the time in the data stream of the start and stop of the source,
- * as floating point values. This is primarily used to send data to
- * remote clients by the BLDS.
+ * as floating point values, and the exact sample indices of the same, as
+ * 64-bit integers. This is primarily used to send data to remote clients
+ * by the BLDS.
+ *
+ * The samples of a frame are never modified after it is constructed, and
+ * are shared between copies of the frame. Copying a frame is thus cheap,
+ * which allows frames to be queued for or held by many clients at once.
+ *
+ * Frames also carry the gain and offset which convert their samples to
+ * physical units. Samples converted to another type or layout with
+ * convertedPayload() are cached with the shared samples, so that each
+ * conversion is done once per frame, no matter how many clients request it.
  */
 class DataFrame {
 
@@ -29,8 +43,40 @@ class DataFrame {
 		/*! Type alias for a chunk of data. */
 		using Samples = arma::Mat<DataType>;
 
+		/*! Types in which samples may be sent to clients. */
+		enum class SampleType : quint32 {
+			/*! Raw samples from the source (int16_t). */
+			Int16 = 0,
+
+			/*! Samples in physical units, i.e., `raw * gain + offset`,
+			 * which is microvolts for the array sources (float).
+			 */
+			Float32 = 1
+		};
+
+		/*! Orders in which samples may be sent to clients. */
+		enum class SampleLayout : quint32 {
+			/*! All samples of the first channel, then all samples of the
+			 * second, and so on. This is the order in which samples are stored.
+			 */
+			ChannelMajor = 0,
+
+			/*! The first sample of every channel, then the second sample of
+			 * every channel, and so on, i.e., interleaved.
+			 */
+			TimeMajor = 1
+		};
+
 		/*! Construct an empty frame. */
-		DataFrame() { }
+		DataFrame() :
+			m_start(0.),
+			m_stop(0.),
+			m_startSample(0),
+			m_stopSample(0),
+			m_gain(1.),
+			m_offset(0.)
+		{
+		}
 
 		/*! Destroy a frame. */
 		~DataFrame() { }
@@ -43,7 +89,34 @@ class DataFrame {
 		DataFrame(float start, float stop, const Samples& data) :
 			m_start(start),
 			m_stop(stop),
-			m_data(data)
+			m_startSample(0),
+			m_stopSample(0),
+			m_gain(1.),
+			m_offset(0.),
+			m_data(std::make_shared<Samples>(data)),
+			m_conversions(std::make_shared<Conversions>())
+		{
+		}
+
+		/*! Construct a frame with exact sample indices.
+		 * \param start The start time of this chunk of data.
+		 * \param stop The stop time of this chunk of data.
+		 * \param startSample The index of the first sample in this chunk.
+		 * \param stopSample The index one past the last sample in this chunk.
+		 * \param samples The actual samples, of shape (nsamples, nchannels).
+		 *
+		 * This overload moves from the samples.
+		 */
+		DataFrame(float start, float stop, quint64 startSample,
+				quint64 stopSample, Samples&& samples) :
+			m_start(start),
+			m_stop(stop),
+			m_startSample(startSample),
+			m_stopSample(stopSample),
+			m_gain(1.),
+			m_offset(0.),
+			m_data(takeSamples(samples)),
+			m_conversions(std::make_shared<Conversions>())
 		{
 		}
 
@@ -57,9 +130,14 @@ class DataFrame {
 		 */
 		DataFrame(float start, float stop, Samples&& samples) :
 			m_start(start),
-			m_stop(stop)
+			m_stop(stop),
+			m_startSample(0),
+			m_stopSample(0),
+			m_gain(1.),
+			m_offset(0.),
+			m_data(takeSamples(samples)),
+			m_conversions(std::make_shared<Conversions>())
 		{
-			m_data.swap(samples);
 		}
 
 		/*! Copy-assign a data frame. */
@@ -69,11 +147,16 @@ class DataFrame {
 			return *this;
 		}
 
-		/*! Copy construct a data frame. */
+		/*! Copy construct a data frame, sharing its samples. */
 		DataFrame(const DataFrame& other) :
 			m_start(other.m_start),
 			m_stop(other.m_stop),
-			m_data(other.m_data)
+			m_startSample(other.m_startSample),
+			m_stopSample(other.m_stopSample),
+			m_gain(other.m_gain),
+			m_offset(other.m_offset),
+			m_data(other.m_data),
+			m_conversions(other.m_conversions)
 		{
 		}
 
@@ -90,7 +173,12 @@ class DataFrame {
 			using std::swap;
 			swap(first.m_start, second.m_start);
 			swap(first.m_stop, second.m_stop);
-			first.m_data.swap(second.m_data);
+			swap(first.m_startSample, second.m_startSample);
+			swap(first.m_stopSample, second.m_stopSample);
+			swap(first.m_gain, second.m_gain);
+			swap(first.m_offset, second.m_offset);
+			swap(first.m_data, second.m_data);
+			swap(first.m_conversions, second.m_conversions);
 		}
 
 		/*! Return the start time of this frame. */
@@ -105,29 +193,205 @@ class DataFrame {
 			return m_stop;
 		}
 
+		/*! Return the index of the first sample of this frame. */
+		quint64 startSample() const
+		{
+			return m_startSample;
+		}
+
+		/*! Return the index one past the last sample of this frame. */
+		quint64 stopSample() const
+		{
+			return m_stopSample;
+		}
+
+		/*! Return the gain converting samples to physical units. */
+		float gain() const
+		{
+			return m_gain;
+		}
+
+		/*! Return the offset converting samples to physical units. */
+		float offset() const
+		{
+			return m_offset;
+		}
+
+		/*! Set the gain and offset converting samples to physical units.
+		 *
+		 * This must be called before the frame is shared, as copies of
+		 * the frame do not see the change.
+		 */
+		void setScale(float gain, float offset)
+		{
+			m_gain = gain;
+			m_offset = offset;
+		}
+
+		/*! Set the start and stop time of the frame, e.g., when a copy
+		 * is reused in reply to another request for the same samples.
+		 */
+		void setTimes(float start, float stop)
+		{
+			m_start = start;
+			m_stop = stop;
+		}
+
 		/*! Return the actual data of this frame. */
 		const Samples& data() const
 		{
-			return m_data;
+			static const Samples empty;
+			return m_data ? *m_data : empty;
 		}
 	
 		/*! Return the number of channels of data in this frame. */
 		quint32 nchannels() const
 		{
-			return m_data.n_cols;
+			return data().n_cols;
 		}
 
 		/*! Return the number of samples of data in this frame. */
 		quint32 nsamples() const
 		{
-			return m_data.n_rows;
+			return data().n_rows;
+		}
+
+		/*! Return the size of the samples of this frame, in bytes. */
+		quint32 payloadBytesize() const
+		{
+			return sizeof(DataType) * data().n_elem;
+		}
+
+		/*! Return a pointer to the samples of this frame, as they are
+		 * serialized.
+		 */
+		const char *payload() const
+		{
+			return reinterpret_cast<const char*>(data().memptr());
+		}
+
+		/*! Return the size of the samples of this frame when converted
+		 * to the given type, in bytes.
+		 */
+		quint32 payloadBytesize(SampleType type) const
+		{
+			return (type == SampleType::Float32) ?
+				sizeof(float) * data().n_elem : payloadBytesize();
+		}
+
+		/*! Return the samples of this frame converted to the given type
+		 * and layout.
+		 *
+		 * Each conversion is computed on the first call for its type and
+		 * layout, and the result shared by all copies of this frame. This may
+		 * be called from any thread. For channel-major SampleType::Int16, the
+		 * raw samples are returned without copying, and remain valid only
+		 * while this frame or one of its copies exists.
+		 */
+		QByteArray convertedPayload(SampleType type, 
+				SampleLayout layout = SampleLayout::ChannelMajor) const
+		{
+			if ((type == SampleType::Int16) && 
+					(layout == SampleLayout::ChannelMajor)) {
+				return QByteArray::fromRawData(payload(), payloadBytesize());
+			}
+			if (!m_conversions) {
+				return convert(type, layout);
+			}
+			QMutexLocker lock(&m_conversions->mutex);
+			auto key = (static_cast<quint32>(layout) << 16) | static_cast<quint32>(type);
+			auto found = m_conversions->payloads.constFind(key);
+			if (found != m_conversions->payloads.constEnd()) {
+				return found.value();
+			}
+			auto converted = convert(type, layout);
+			m_conversions->payloads.insert(key, converted);
+			return converted;
+		}
+
+		/*! Return the total size of the converted samples shared by copies
+		 * of this frame, see convertedPayload(), in bytes.
+		 */
+		qint64 convertedBytesize() const
+		{
+			if (!m_conversions) {
+				return 0;
+			}
+			QMutexLocker lock(&m_conversions->mutex);
+			qint64 bytes = 0;
+			for (const auto& converted : m_conversions->payloads) {
+				bytes += converted.size();
+			}
+			return bytes;
+		}
+
+		/*! Concatenate consecutive frames into a single frame.
+		 *
+		 * \param frames The frames to concatenate, in order. These must
+		 * 	all have the same number of channels.
+		 *
+		 * The result starts at the start of the first frame and stops at
+		 * the stop of the last. No checks are performed that the frames are
+		 * contiguous.
+		 */
+		static DataFrame concatenate(const QList<DataFrame>& frames)
+		{
+			if (frames.size() == 1) {
+				return frames.first();
+			}
+			quint32 nsamples = 0;
+			for (const auto& frame : frames) {
+				nsamples += frame.nsamples();
+			}
+			auto nchannels = frames.first().nchannels();
+			Samples data(nsamples, nchannels);
+			quint32 row = 0;
+			for (const auto& frame : frames) {
+				for (quint32 channel = 0; channel < nchannels; channel++) {
+					std::memcpy(data.colptr(channel) + row, 
+							frame.data().colptr(channel),
+							frame.nsamples() * sizeof(DataType));
+				}
+				row += frame.nsamples();
+			}
+			const auto& first = frames.first();
+			const auto& last = frames.last();
+			DataFrame frame(first.start(), last.stop(), first.startSample(),
+					last.stopSample(), std::move(data));
+			frame.setScale(first.gain(), first.offset());
+			return frame;
+		}
+
+		/*! Return a frame with a range of the channels of this frame.
+		 *
+		 * \param first The index of the first channel kept.
+		 * \param count The number of channels kept. These must all be
+		 * 	channels of this frame.
+		 *
+		 * The samples are copied, unless all channels are kept.
+		 */
+		DataFrame channels(quint32 first, quint32 count) const
+		{
+			if ((first == 0) && (count == nchannels())) {
+				return *this;
+			}
+			Samples data = this->data().cols(first, first + count - 1);
+			DataFrame frame(m_start, m_stop, m_startSample, m_stopSample,
+					std::move(data));
+			frame.setScale(m_gain, m_offset);
+			return frame;
+		}
+
+		/*! Return the size of the header of this frame when serialized. */
+		static quint32 headerBytesize()
+		{
+			return 2 * sizeof(float) + 2 * sizeof(quint32);
 		}
 
 		/*! Return the size of this frame when serialized. */
 		quint32 bytesize() const 
 		{
-			return (2 * sizeof(float) + 2 * sizeof(quint32) +
-					sizeof(DataType) * m_data.n_elem);
+			return headerBytesize() + payloadBytesize();
 		}
 
 		/*! Serialize this frame to an array of bytes.
@@ -142,8 +406,7 @@ class DataFrame {
 		QByteArray serialize() const
 		{
 			QByteArray ba;
-			ba.resize(2 * sizeof(m_start) + 2 * sizeof(quint32) * 
-					m_data.n_elem * sizeof(DataType));
+			ba.resize(bytesize());
 			serializeInto(ba.data());
 			return ba;
 		}
@@ -156,6 +419,16 @@ class DataFrame {
 		 * size into which the frame is serialized.
 		 */
 		void serializeInto(char *buffer) const
+		{
+			serializeHeaderInto(buffer);
+			std::memcpy(buffer + headerBytesize(), payload(), payloadBytesize());
+		}
+
+		/*! Serialize only the header of this frame into a buffer.
+		 * The buffer must be at least `headerBytesize()` bytes. The samples
+		 * themselves, returned by `payload()`, follow the header on the wire.
+		 */
+		void serializeHeaderInto(char *buffer) const
 		{
 			std::memcpy(buffer, &m_start, sizeof(m_start));
 			std::memcpy(buffer + sizeof(m_start), &m_stop, sizeof(m_stop));
@@ -164,8 +437,97 @@ class DataFrame {
 			auto nchan = nchannels();
 			std::memcpy(buffer + 2 * sizeof(m_start) + sizeof(nchan), 
 					&nchan, sizeof(nchan));
-			std::memcpy(buffer + 2 * sizeof(m_start) + 2 * sizeof(nsamp),
-					m_data.memptr(), m_data.n_elem * sizeof(DataType));
+		}
+
+		/*! Return the size of the header of this frame when serialized
+		 * with sample indices.
+		 */
+		static quint32 sampleIndexedHeaderBytesize()
+		{
+			return 2 * sizeof(quint64) + 2 * sizeof(quint32);
+		}
+
+		/*! Return the size of this frame when serialized with sample indices. */
+		quint32 sampleIndexedBytesize() const
+		{
+			return sampleIndexedHeaderBytesize() + payloadBytesize();
+		}
+
+		/*! Serialize directly into a buffer, using sample indices.
+		 * This is identical to `serializeInto()`, except that the start
+		 * and stop of the frame are written as exact 64-bit sample indices,
+		 * rather than as times in seconds:
+		 * 	- start sample (uint64_t)
+		 * 	- stop sample (uint64_t)
+		 * 	- number of samples (uint32_t)
+		 * 	- number of channels (uint32_t)
+		 * 	- actual data (array of int16_t)
+		 *
+		 * The buffer must be at least `sampleIndexedBytesize()` bytes.
+		 */
+		void serializeSampleIndexedInto(char *buffer) const
+		{
+			serializeSampleIndexedHeaderInto(buffer);
+			std::memcpy(buffer + sampleIndexedHeaderBytesize(), 
+					payload(), payloadBytesize());
+		}
+
+		/*! Serialize only the sample-indexed header of this frame into a buffer.
+		 * The buffer must be at least `sampleIndexedHeaderBytesize()` bytes.
+		 */
+		void serializeSampleIndexedHeaderInto(char *buffer) const
+		{
+			std::memcpy(buffer, &m_startSample, sizeof(m_startSample));
+			std::memcpy(buffer + sizeof(m_startSample), &m_stopSample,
+					sizeof(m_stopSample));
+			auto nsamp = nsamples();
+			std::memcpy(buffer + 2 * sizeof(m_startSample), &nsamp, sizeof(nsamp));
+			auto nchan = nchannels();
+			std::memcpy(buffer + 2 * sizeof(m_startSample) + sizeof(nsamp),
+					&nchan, sizeof(nchan));
+		}
+
+		/*! Return the size of the header of this frame when serialized
+		 * with its sample type.
+		 */
+		static quint32 typedHeaderBytesize()
+		{
+			return 2 * sizeof(float) + 3 * sizeof(quint64) + 4 * sizeof(quint32);
+		}
+
+		/*! Serialize the header of this frame, as sent with samples of
+		 * the given type and layout, into a buffer.
+		 * This carries both the times and sample indices of the frame,
+		 * and the sequence number of the frame among those sent to a client:
+		 * 	- start time (float)
+		 * 	- stop time (float)
+		 * 	- sequence number (uint64_t)
+		 * 	- start sample (uint64_t)
+		 * 	- stop sample (uint64_t)
+		 * 	- number of samples (uint32_t)
+		 * 	- number of channels (uint32_t)
+		 * 	- sample type (uint32_t, a value of SampleType)
+		 * 	- sample layout (uint32_t, a value of SampleLayout)
+		 *
+		 * The samples, returned by `convertedPayload()`, follow the header on
+		 * the wire. The buffer must be at least `typedHeaderBytesize()` bytes.
+		 */
+		void serializeTypedHeaderInto(char *buffer, quint64 sequence,
+				SampleType type, SampleLayout layout) const
+		{
+			std::memcpy(buffer, &m_start, sizeof(m_start));
+			buffer += sizeof(m_start);
+			std::memcpy(buffer, &m_stop, sizeof(m_stop));
+			buffer += sizeof(m_stop);
+			std::memcpy(buffer, &sequence, sizeof(sequence));
+			buffer += sizeof(sequence);
+			std::memcpy(buffer, &m_startSample, sizeof(m_startSample));
+			buffer += sizeof(m_startSample);
+			std::memcpy(buffer, &m_stopSample, sizeof(m_stopSample));
+			buffer += sizeof(m_stopSample);
+			quint32 values[] = { nsamples(), nchannels(), 
+					static_cast<quint32>(type), static_cast<quint32>(layout) };
+			std::memcpy(buffer, values, sizeof(values));
 		}
 
 		/* Deserialize a DataFrame from an array of bytes. */
@@ -180,17 +542,67 @@ class DataFrame {
 					2 * sizeof(m_start), sizeof(nsamples));
 			std::memcpy(&nchannels, buffer.data() + 
 					2 * sizeof(m_start) + sizeof(nsamples), sizeof(nchannels));
-			frame.m_data.set_size(nsamples, nchannels);
-			std::memcpy(frame.m_data.memptr(), buffer.data() + 
+			auto data = std::make_shared<Samples>(nsamples, nchannels);
+			std::memcpy(data->memptr(), buffer.data() + 
 					2 * sizeof(m_start) + 2 * sizeof(nchannels),
-					sizeof(DataFrame::DataType) * frame.m_data.n_elem);
+					sizeof(DataFrame::DataType) * data->n_elem);
+			frame.m_data = data;
+			frame.m_conversions = std::make_shared<Conversions>();
 			return frame;
 		}
 
 	private:
+
+		/* Samples converted to other types, shared between copies. */
+		struct Conversions {
+			QMutex mutex;
+			QHash<quint32, QByteArray> payloads;
+		};
+
+		/* Convert the samples of this frame to the given type and layout.
+		 * Scaling applies to each sample alone, so samples are reordered
+		 * before they are scaled.
+		 */
+		QByteArray convert(SampleType type, SampleLayout layout) const
+		{
+			const auto& samples = data();
+			QByteArray reordered;
+			const DataType *source = samples.memptr();
+			if (layout == SampleLayout::TimeMajor) {
+				reordered.resize(payloadBytesize());
+				auto *transposed = reinterpret_cast<DataType*>(reordered.data());
+				samplekernels::transpose(samples.memptr(), transposed, 
+						samples.n_cols, samples.n_rows);
+				source = transposed;
+			}
+			if (type == SampleType::Int16) {
+				return reordered;
+			}
+
+			QByteArray converted;
+			converted.resize(payloadBytesize(type));
+			samplekernels::int16ToFloat(source,
+					reinterpret_cast<float*>(converted.data()),
+					samples.n_elem, m_gain, m_offset);
+			return converted;
+		}
+
+		/* Move samples into shared storage. */
+		static std::shared_ptr<const Samples> takeSamples(Samples& samples)
+		{
+			auto data = std::make_shared<Samples>();
+			data->swap(samples);
+			return data;
+		}
+
 		float m_start;
 		float m_stop;
-		Samples m_data;
+		quint64 m_startSample;
+		quint64 m_stopSample;
+		float m_gain;
+		float m_offset;
+		std::shared_ptr<const Samples> m_data;
+		std::shared_ptr<Conversions> m_conversions;
 };
 
 #endif
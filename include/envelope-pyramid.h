@@ -0,0 +1,182 @@
+/*! \file envelope-pyramid.h
+ *
+ * Class summarizing the samples of a recording as a pyramid of minimum
+ * and maximum envelopes, for views of long stretches of a recording.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef BLDS_ENVELOPE_PYRAMID_H
+#define BLDS_ENVELOPE_PYRAMID_H
+
+#include "data-frame.h"
+
+#include <QtCore>
+
+#include <memory> // std::unique_ptr
+
+/*! \class EnvelopePyramid
+ * The EnvelopePyramid class keeps the minimum and maximum of each channel
+ * over consecutive bins of samples, at several resolutions.
+ *
+ * Bins of the finest level span a fixed number of samples, and each
+ * coarser level merges LevelFactor bins of the one below. The pyramid is
+ * built while recording, as samples are appended, and stored in a sidecar
+ * file next to the recording, see sidecarPath(). A view of any stretch of
+ * the recording is then served from the coarsest level with at least one
+ * bin per pixel, reading a few bins rather than all samples.
+ *
+ * The sidecar starts with a header, followed by each level in turn, with
+ * room for all bins of a recording of a given capacity. Each bin holds the
+ * minima of all channels followed by their maxima, as int16 in the byte
+ * order of the machine. Only complete bins are stored.
+ */
+class EnvelopePyramid {
+
+	public:
+
+		/*! The number of bins of a level merged into one of the next. */
+		static const quint32 LevelFactor = 4;
+
+		/*! The maximum number of levels. */
+		static const int MaxLevels = 16;
+
+		/*! The maximum number of bins which may be requested. */
+		static const quint32 MaxWidth = 8192;
+
+		/*! The envelope of a stretch of the recording. */
+		struct Envelope {
+			/*! The index of the first sample of the first bin. */
+			quint64 start;
+
+			/*! The index one past the last sample of the last bin. */
+			quint64 stop;
+
+			/*! The number of samples of each bin. */
+			quint64 binSize;
+
+			/*! The number of bins. */
+			quint32 nbins;
+
+			/*! The number of channels. */
+			quint32 nchannels;
+
+			/*! The minima of the channels followed by their maxima, for
+			 * each bin in turn.
+			 */
+			QVector<qint16> data;
+		};
+
+		/*! Return the path of the sidecar of a recording. */
+		static QString sidecarPath(const QString& recording);
+
+		/*! Create the sidecar of a recording, to which samples are appended.
+		 *
+		 * \param path The path of the sidecar.
+		 * \param nchannels The number of channels of the recording.
+		 * \param binSize The number of samples of bins of the finest level.
+		 * \param capacity The maximum number of samples of the recording.
+		 * 	Samples beyond it are not summarized.
+		 *
+		 * Throws std::runtime_error if the file cannot be created.
+		 */
+		static std::unique_ptr<EnvelopePyramid> create(const QString& path,
+				quint32 nchannels, quint32 binSize, quint64 capacity);
+
+		/*! Open the sidecar of a finished recording, to read envelopes.
+		 *
+		 * Throws std::runtime_error if the file cannot be opened, or is not
+		 * a sidecar.
+		 */
+		static std::unique_ptr<EnvelopePyramid> open(const QString& path);
+
+		/*! Close the sidecar, writing the number of bins of each level. */
+		~EnvelopePyramid();
+
+		/*! Copying is not allowed. */
+		EnvelopePyramid(const EnvelopePyramid&) = delete;
+		EnvelopePyramid& operator=(const EnvelopePyramid&) = delete;
+
+		/*! Return the number of channels. */
+		quint32 nchannels() const;
+
+		/*! Return the number of levels. */
+		int nlevels() const;
+
+		/*! Return the number of samples summarized in complete bins. */
+		quint64 nsamples() const;
+
+		/*! Summarize samples following those already appended.
+		 *
+		 * \param samples The samples, of shape (nsamples, nchannels).
+		 *
+		 * Throws std::runtime_error if the sidecar cannot be written, and
+		 * std::logic_error if it is read-only or the samples do not have
+		 * the number of channels of the pyramid.
+		 */
+		void append(const DataFrame::Samples& samples);
+
+		/*! Write the number of bins of each level to the sidecar, so that
+		 * they can be read while it is still being written.
+		 */
+		void flush();
+
+		/*! Return the envelope of a stretch of the recording.
+		 *
+		 * \param start The index of the first sample of the stretch.
+		 * \param stop The index one past the last sample of the stretch.
+		 * \param width The number of bins wanted, e.g., the width of the
+		 * 	view in pixels.
+		 * \param firstChannel The index of the first channel returned.
+		 * \param nchannels The number of channels returned.
+		 *
+		 * The envelope comes from the coarsest level with at least width
+		 * bins over the stretch, or the finest if none has, and covers the
+		 * complete bins overlapping it, at most about LevelFactor times width,
+		 * and none if the samples have not been summarized yet. Throws
+		 * std::logic_error if the request is invalid, e.g., wider than
+		 * MaxWidth, and std::runtime_error if the sidecar cannot be read.
+		 */
+		Envelope envelope(quint64 start, quint64 stop, quint32 width,
+				quint32 firstChannel, quint32 nchannels);
+
+	private:
+
+		EnvelopePyramid(const QString& path, bool writable);
+
+		/* Compute the layout of the levels from the header fields. */
+		void layout();
+
+		/* Write the header, with the current number of bins of each level. */
+		void writeHeader();
+
+		/* Return the number of bytes of the header. */
+		qint64 headerSize() const;
+
+		/* Return the number of bytes of a bin. */
+		qint64 binBytes() const;
+
+		/* Store the pending bin of a level, and merge it into the next. */
+		void completeBin(int level);
+
+		QFile m_file;
+		bool m_writable;
+		quint32 m_nchannels;
+		quint32 m_binSize;
+		quint64 m_capacity;
+		int m_nlevels;
+
+		/* Offset in the file, room, and number of complete bins of each level. */
+		QVector<qint64> m_offsets;
+		QVector<quint64> m_capacities;
+		QVector<quint64> m_bins;
+
+		/* The bin of each level being accumulated, and the number of samples,
+		 * or bins of the level below, merged into it.
+		 */
+		QVector<QVector<qint16>> m_pending;
+		QVector<quint64> m_pendingCount;
+};
+
+#endif
+
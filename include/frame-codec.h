@@ -0,0 +1,103 @@
+/*! \file frame-codec.h
+ *
+ * Compressed encodings of the samples of data frames sent to clients.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef BLDS_FRAME_CODEC_H
+#define BLDS_FRAME_CODEC_H
+
+#include <QtCore>
+
+/*! The framecodec namespace contains the encodings which clients may
+ * negotiate for data frames, to reduce the bandwidth of the stream.
+ *
+ * Encoded frames are sent as `data-encoded` messages, with the body:
+ * 	- encoding (uint32_t, a value of Encoding)
+ * 	- size of the header (uint32_t)
+ * 	- header, i.e., the type line and frame header of the message which
+ * 	  would otherwise have been sent, e.g. "data\n" and the frame header
+ * 	- size of the decoded samples, in bytes (uint32_t)
+ * 	- encoded samples
+ *
+ * Decoding the samples and appending them to the header gives back the
+ * original message exactly. Samples which are not channel-major int16,
+ * e.g., the float or time-major samples of `data-typed` messages, cannot be
+ * delta-bitpacked, and are deflated instead. The encoding field always names
+ * the one actually used.
+ */
+namespace framecodec {
+
+/*! Available encodings of the samples of a frame. */
+enum class Encoding : quint32 {
+	/*! Samples are sent as is. */
+	Raw = 0,
+
+	/*! Samples are compressed with zlib at its fastest level, and stored
+	 * as produced by qCompress(): the decoded size as a big-endian
+	 * uint32_t followed by the zlib stream.
+	 */
+	Deflate = 1,
+
+	/*! Samples are delta-encoded and bit-packed, see encodeDeltaBitpack(). */
+	DeltaBitpack = 2
+};
+
+/*! Number of samples in each block of the delta-bitpack encoding. */
+const int DeltaBitpackBlockSize = 128;
+
+/*! Return the encoding with the given name, one of "raw", "deflate" or
+ * "delta-bitpack". Sets ok to false if the name is not known.
+ */
+Encoding fromName(const QByteArray& name, bool *ok);
+
+/*! Return the name of an encoding. */
+QByteArray name(Encoding encoding);
+
+/*! Encode the samples of a frame.
+ *
+ * \param encoding The encoding to use.
+ * \param samples The int16 samples of the frame, channel by channel.
+ * \param nsamples The number of samples per channel.
+ * \param nchannels The number of channels.
+ */
+QByteArray encode(Encoding encoding, const qint16 *samples,
+		quint32 nsamples, quint32 nchannels);
+
+/*! Encode samples of any type, as raw bytes.
+ *
+ * The delta-bitpack encoding only applies to int16 samples, so bytes are
+ * deflated instead, and the encoding is set to the one actually used.
+ */
+QByteArray encode(Encoding *encoding, const QByteArray& bytes);
+
+/*! Encode int16 samples with the delta-bitpack encoding.
+ *
+ * Each channel is encoded separately, in blocks of `DeltaBitpackBlockSize`
+ * samples, the last of which may be shorter. Each sample is replaced by its
+ * difference from the previous sample of the channel (the first sample of
+ * a channel by its difference from zero), computed modulo 2^16 and
+ * zigzag-encoded, so that small differences of either sign become small
+ * unsigned values. Each block is then:
+ * 	- the number of bits b needed for the largest value in the block (uint8_t)
+ * 	- the values, packed into b bits each, least-significant bit first, and
+ * 	  padded to a whole byte
+ *
+ * Slowly-varying signals such as neural recordings need far fewer than 16
+ * bits per sample, and a block of constant samples takes a single byte.
+ */
+QByteArray encodeDeltaBitpack(const qint16 *samples,
+		quint32 nsamples, quint32 nchannels);
+
+/*! Decode samples encoded with encodeDeltaBitpack().
+ *
+ * Returns false if the input is truncated.
+ */
+bool decodeDeltaBitpack(const QByteArray& encoded, qint16 *samples,
+		quint32 nsamples, quint32 nchannels);
+
+} // end framecodec namespace
+
+#endif
+
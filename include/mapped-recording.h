@@ -0,0 +1,104 @@
+/*! \file mapped-recording.h
+ *
+ * Class reading the samples of a finished recording through a memory
+ * mapping of the file.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef BLDS_MAPPED_RECORDING_H
+#define BLDS_MAPPED_RECORDING_H
+
+#include "data-frame.h"
+
+#include <QtCore>
+
+#include <memory> // std::shared_ptr
+
+/*! \class MappedRecording
+ * The MappedRecording class reads the samples of a finished recording
+ * directly from a read-only memory mapping of its file.
+ *
+ * Reading through the HDF5 library copies samples through its hyperslab
+ * machinery, under a lock shared by all threads. When the dataset of a
+ * recording is stored contiguously, as native 16-bit integers in either
+ * channel- or time-major order, its samples are at a single offset in the
+ * file, and are instead copied from the mapping into frames, in any number
+ * of threads at once, without calling into the library.
+ *
+ * Recordings written by the server are chunked, so that they can grow,
+ * and are read through the library as before. Only recordings stored
+ * contiguously, e.g., once repacked, can be mapped. The file must not be
+ * modified while it is mapped.
+ */
+class MappedRecording {
+
+	public:
+
+		/*! Map the samples of a recording, if they are stored contiguously.
+		 *
+		 * \param path The path of the recording.
+		 * \param nsamples The number of samples of the recording.
+		 * \param nchannels The number of channels of the recording.
+		 *
+		 * Returns nullptr if the layout of the dataset does not allow it
+		 * to be mapped, or the mapping fails, in which case the recording
+		 * should be read through the library. This calls into HDF5 to
+		 * inspect the layout, and so must be called with hdf5Mutex() held.
+		 */
+		static std::shared_ptr<MappedRecording> map(const QString& path,
+				quint64 nsamples, quint32 nchannels);
+
+		/*! Unmap the recording. */
+		~MappedRecording();
+
+		/*! Copying is not allowed. */
+		MappedRecording(const MappedRecording&) = delete;
+		MappedRecording& operator=(const MappedRecording&) = delete;
+
+		/*! Return the number of samples of the recording. */
+		quint64 nsamples() const;
+
+		/*! Return the number of channels of the recording. */
+		quint32 nchannels() const;
+
+		/*! Return the layout of the samples in the file. */
+		DataFrame::SampleLayout layout() const;
+
+		/*! Return the regions of the file holding samples of the recording,
+		 * as their offsets and sizes in bytes, in the order the samples are
+		 * laid out in the file.
+		 *
+		 * Samples of a time-major recording are in a single region, and
+		 * those of a channel-major recording in one region per channel,
+		 * unless they cover the whole recording. Throws std::logic_error if
+		 * the range is not within the recording.
+		 */
+		QList<QPair<qint64, qint64>> regions(quint64 start, quint64 stop) const;
+
+		/*! Read samples of the recording.
+		 *
+		 * \param start The index of the first sample to read.
+		 * \param stop The index one past the last sample to read.
+		 * \param data The samples read, of shape (nsamples, nchannels).
+		 *
+		 * This may be called from any thread, without hdf5Mutex(). Throws
+		 * std::logic_error if the range is not within the recording.
+		 */
+		void data(quint64 start, quint64 stop, DataFrame::Samples& data) const;
+
+	private:
+
+		MappedRecording(const QString& path, qint64 offset, quint64 nsamples,
+				quint32 nchannels, bool timeMajor);
+
+		QFile m_file;
+		qint64 m_offset;
+		const DataFrame::DataType *m_samples;
+		quint64 m_nsamples;
+		quint32 m_nchannels;
+		bool m_timeMajor;
+};
+
+#endif
+
@@ -0,0 +1,137 @@
+/*! \file multicast-publisher.h
+ *
+ * Class used to publish live data frames to a UDP multicast group.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef BLDS_MULTICAST_PUBLISHER_H
+#define BLDS_MULTICAST_PUBLISHER_H
+
+#include "data-frame.h"
+
+#include <QtCore>
+#include <QtNetwork>
+
+#include <atomic>
+
+/*! \class MulticastPublisher
+ * The MulticastPublisher class sends each live data frame once to a UDP
+ * multicast group, so that any number of passive viewers may receive the
+ * stream at a constant cost to the server. Delivery is unreliable: clients
+ * needing every sample should use the TCP protocol instead.
+ *
+ * Each frame is serialized with sample indices, as in the `data-samples`
+ * message, and split into fragments no larger than the configured datagram
+ * size. Every datagram starts with a 24-byte header:
+ * 	- magic number (uint32_t, "BLDM")
+ * 	- sequence number of the source chunk held by the frame, starting
+ * 	  from 1 for each recording (uint64_t)
+ * 	- index of this fragment (uint16_t)
+ * 	- number of fragments in the frame (uint16_t)
+ * 	- total size of the serialized frame (uint32_t)
+ * 	- offset of this fragment in the serialized frame (uint32_t)
+ *
+ * All values are little-endian. Receivers reassemble a frame once all of
+ * its fragments have arrived, and detect lost frames from gaps in the
+ * sequence numbers, including frames which could not be published.
+ *
+ * Frames are sent from a thread of the publisher, so that the bursts of
+ * datagrams of large frames never hold up the caller. The socket has a
+ * large send buffer, and fragments which the system cannot queue are sent
+ * again after a pause, rather than truncating the frame. Frames published
+ * while `MaxQueuedFrames` are waiting to be sent are dropped. Sent, failed
+ * and dropped frames are counted, see status().
+ */
+class MulticastPublisher {
+
+	public:
+
+		/*! Magic number at the start of each datagram. */
+		static const quint32 Magic = 0x4d444c42;
+
+		/*! Size of the header at the start of each datagram. */
+		static const int HeaderSize = 24;
+
+		/*! Size of the send buffer requested for the socket, in bytes. */
+		static const int SendBufferSize = 8 << 20;
+
+		/*! Maximum number of frames waiting to be sent. */
+		static const int MaxQueuedFrames = 8;
+
+		/*! Number of times a fragment is sent again before its frame fails. */
+		static const int MaxSendRetries = 50;
+
+		/*! Pause before a fragment is sent again, in microseconds. */
+		static const int SendRetryInterval = 200;
+
+		/*! Create a publisher.
+		 *
+		 * \param group The multicast group address.
+		 * \param port The port to which datagrams are sent.
+		 * \param ttl The time-to-live of datagrams, i.e., the number of hops
+		 * 	they may travel.
+		 * \param datagramSize The maximum size of each datagram, including
+		 * 	the header.
+		 * \param interfaceName The name of the network interface on which to
+		 * 	send, e.g. "lo" for loopback. If empty, the system default is used.
+		 *
+		 * Datagrams are always looped back to the local machine as well.
+		 * This throws a std::invalid_argument if the group or interface is
+		 * invalid, or the socket cannot be created.
+		 */
+		MulticastPublisher(const QHostAddress& group, quint16 port, int ttl,
+				int datagramSize, const QString& interfaceName = QString());
+
+		/*! Stop the sending thread, discarding frames not yet sent. */
+		~MulticastPublisher();
+
+		/*! Copying is not allowed. */
+		MulticastPublisher(const MulticastPublisher&) = delete;
+		MulticastPublisher(MulticastPublisher&&) = delete;
+		MulticastPublisher& operator=(const MulticastPublisher&) = delete;
+
+		/*! Return the multicast group and port, as "address:port". */
+		QString address() const;
+
+		/*! Queue a frame to be sent to the group.
+		 *
+		 * The frame is dropped if too many are waiting to be sent.
+		 *
+		 * \param frame The frame to publish.
+		 * \param sequence The sequence number of the source chunk held
+		 * 	by the frame, see StreamMonitor::addChunk().
+		 */
+		void publish(const DataFrame& frame, quint64 sequence);
+
+		/*! Return the counters of the publisher, e.g., for the HTTP server. */
+		QVariantMap status() const;
+
+	private:
+
+		/* Send a frame, in the sending thread. Returns false if the frame
+		 * needs more fragments than can be described in the datagram
+		 * header, or a fragment could not be sent.
+		 */
+		bool send(const DataFrame& frame, quint64 sequence);
+
+		QThread m_thread;
+
+		/* Owned by the sending thread, and deleted when it finishes. */
+		QUdpSocket *m_socket;
+
+		QHostAddress m_group;
+		quint16 m_port;
+		int m_datagramSize;
+		QByteArray m_frameBuffer;
+		QByteArray m_datagram;
+
+		std::atomic<int> m_queued;
+		std::atomic<quint64> m_sent;
+		std::atomic<quint64> m_failed;
+		std::atomic<quint64> m_dropped;
+		std::atomic<quint64> m_retries;
+};
+
+#endif
+
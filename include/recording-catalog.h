@@ -0,0 +1,142 @@
+/*! \file recording-catalog.h
+ *
+ * Class keeping an index of the recordings in the save directory and
+ * their metadata.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef BLDS_RECORDING_CATALOG_H
+#define BLDS_RECORDING_CATALOG_H
+
+#include <QtCore>
+#include <QtConcurrent>
+
+/*! \class RecordingCatalog
+ * The RecordingCatalog class keeps an index of all recordings under a
+ * directory, and their metadata, so that they can be listed without
+ * opening every file.
+ *
+ * The directory and its subdirectories are watched for changes. When one
+ * changes, only its listing is read again, and only files which are new,
+ * or whose size or modification time changed, are opened to read their
+ * metadata. Files are opened one at a time, in a background thread, and are
+ * listed without their metadata until then.
+ *
+ * The current recording is not indexed while it is written, as it is
+ * incomplete, and is indexed once it is finished, see setActiveFile().
+ */
+class RecordingCatalog : public QObject {
+	Q_OBJECT
+
+	public:
+
+		/*! A recording in the catalog. */
+		struct Entry {
+			/*! The path of the recording, relative to the directory. */
+			QString name;
+
+			/*! The size of the file, in bytes. */
+			qint64 size;
+
+			/*! The time the file was created. */
+			QDateTime created;
+
+			/*! The time the file was last modified. */
+			QDateTime modified;
+
+			/*! True if the metadata below has been read. */
+			bool indexed;
+
+			/*! If the metadata could not be read, an error message. */
+			QString error;
+
+			/*! The sample rate of the recording. */
+			double sampleRate;
+
+			/*! The number of samples of the recording. */
+			quint64 nsamples;
+
+			/*! The number of channels of the recording. */
+			quint32 nchannels;
+
+			/*! Hash of the array configuration stored with the recording,
+			 * as hexadecimal, or empty if it has none.
+			 */
+			QByteArray configurationHash;
+		};
+
+		/*! Construct an empty catalog. */
+		RecordingCatalog(QObject *parent = nullptr);
+
+		/*! Destroy the catalog, waiting for any file being read. */
+		~RecordingCatalog();
+
+		/*! Set the directory of the recordings, and index it, replacing
+		 * the recordings of any previous directory.
+		 */
+		void setDirectory(const QString& directory);
+
+		/*! Set the path of the recording being written, which is not indexed
+		 * until it is finished. Clearing the path indexes the file again.
+		 */
+		void setActiveFile(const QString& path);
+
+		/*! Set whether reading metadata is suspended.
+		 *
+		 * This is needed while anything else calls into HDF5 without holding
+		 * hdf5Mutex(), see RecordingReader::setSynchronous(). Suspending
+		 * waits for the file being read, if any.
+		 */
+		void setSuspended(bool suspended);
+
+		/*! Return the recordings in the catalog, ordered by their path. */
+		QList<Entry> entries() const;
+
+		/*! Return the number of recordings whose metadata is yet to be read. */
+		int pending() const;
+
+	private:
+
+		/* Metadata read from a file in the background. */
+		struct Metadata {
+			QString error;
+			double sampleRate;
+			quint64 nsamples;
+			quint32 nchannels;
+			QByteArray configurationHash;
+		};
+
+		/* Read the metadata of a file, under hdf5Mutex(). */
+		static Metadata read(QString path);
+
+		/* Read the listing of a directory again, and those of any new
+		 * subdirectories, queueing new or changed files.
+		 */
+		void scan(const QString& directory);
+
+		/* Start reading the next queued file, if none is being read. */
+		void readNext();
+
+		/* Handle the metadata read from a file, of the given size and
+		 * modification time when it was read.
+		 */
+		void finish(const QString& name, const QString& path, qint64 size,
+				const QDateTime& modified, const Metadata& metadata);
+
+		QFileSystemWatcher m_watcher;
+		QThreadPool m_pool;
+		QDir m_directory;
+		QString m_activeFile;
+		bool m_suspended;
+
+		/* Recordings, keyed by their path relative to the directory. */
+		QMap<QString, Entry> m_entries;
+
+		/* Recordings whose metadata is to be read, and the one being read. */
+		QQueue<QString> m_queue;
+		QFutureWatcher<Metadata> *m_reading;
+};
+
+#endif
+
@@ -0,0 +1,341 @@
+/*! \file recording-reader.h
+ *
+ * Class reading data from recordings on behalf of clients, in a pool
+ * of worker threads.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef BLDS_RECORDING_READER_H
+#define BLDS_RECORDING_READER_H
+
+#include "chunk-cache.h"
+#include "client.h"
+#include "data-frame.h"
+#include "mapped-recording.h"
+
+#include "libdatafile/include/datafile.h"
+
+#include <QtCore>
+#include <QtConcurrent>
+
+#include <memory> // std::shared_ptr
+
+/*! Return the mutex serializing all calls into the HDF5 library.
+ *
+ * The HDF5 library keeps global state which is not thread-safe, even
+ * between unrelated files. Any thread calling into the library, including
+ * to create or destroy a file object, must hold this mutex.
+ */
+QMutex& hdf5Mutex();
+
+/*! \class LiveWriteLocker
+ * The LiveWriteLocker class holds hdf5Mutex() while samples are written
+ * to the current recording, giving the live writer priority over reads.
+ * The RecordingReader takes the lock for one bounded slab of a chunk at a
+ * time, and does not start another slab while a writer is waiting, so
+ * that the writer waits for at most one slab rather than several full
+ * reads. The time taken to acquire the lock is reported by
+ * RecordingReader::status().
+ *
+ * This must not be used while hdf5Mutex() is already held.
+ */
+class LiveWriteLocker {
+
+	public:
+
+		/*! Lock hdf5Mutex(), ahead of any reads waiting for it. */
+		LiveWriteLocker();
+
+		/*! Unlock hdf5Mutex(), and let waiting reads continue. */
+		~LiveWriteLocker();
+
+		/*! Copying is not allowed. */
+		LiveWriteLocker(const LiveWriteLocker&) = delete;
+		LiveWriteLocker& operator=(const LiveWriteLocker&) = delete;
+};
+
+/*! \class RecordingReader
+ * The RecordingReader class reads requested chunks of data from recordings,
+ * either the current recording or finished ones which clients open
+ * read-only to query them while live acquisition continues.
+ *
+ * Reads run in a pool of worker threads, so that reading from disk does
+ * not hold up the main thread, and the results are emitted as signals in
+ * the thread in which the reader lives. Requests of each client are handled
+ * one at a time, in the order they are made, and requests of different
+ * clients concurrently. Calls into HDF5 itself are serialized by
+ * hdf5Mutex(), so concurrent reads overlap everything except the library
+ * calls themselves. Chunks are read through the library in slabs of at
+ * most `MaxSlabBytes`, so that writes of live data, see LiveWriteLocker,
+ * are not held up by long reads.
+ *
+ * Chunks read are kept in a ChunkCache shared by all clients, so that
+ * clients requesting the same samples of the same file, e.g., several
+ * viewers of the same trial, are served from memory.
+ *
+ * Clients scanning a recording request consecutive windows of the same
+ * length. Once two such requests follow each other, the reader reads
+ * ahead the next windows into the cache in the background, so that the
+ * client's next requests are served from memory while further reads are
+ * in progress.
+ *
+ * Recordings opened by clients whose samples are stored contiguously are
+ * mapped into memory, see MappedRecording, and read from the mapping
+ * without the HDF5 library or its lock. Others are read through the library.
+ *
+ * The reader never writes to the recordings it opens.
+ */
+class RecordingReader : public QObject {
+	Q_OBJECT
+
+	public:
+
+		/*! Maximum number of bytes read through the library while
+		 * holding hdf5Mutex() once.
+		 */
+		static const quint64 MaxSlabBytes = 1 << 20;
+
+		/*! Metadata of an open recording. */
+		struct Info {
+			QString path;
+			double sampleRate;
+			quint64 nsamples;
+			quint32 nchannels;
+			float gain;
+			float offset;
+		};
+
+		/*! Construct a reader, with no open recordings.
+		 *
+		 * \param nthreads The number of threads reading concurrently.
+		 * \param prefetchDepth The number of windows read ahead of a
+		 * 	client reading sequentially. Zero disables reading ahead.
+		 * \param cacheSize The maximum number of bytes of samples kept in
+		 * 	the cache. Zero disables the cache, and thus reading ahead.
+		 */
+		RecordingReader(int nthreads, int prefetchDepth, qint64 cacheSize,
+				QObject *parent = nullptr);
+
+		/*! Destroy the reader, waiting for any reads and closing all
+		 * open recordings.
+		 */
+		~RecordingReader();
+
+		/*! Set the current recording, from which clients without an open
+		 * recording read, and the gain and offset of its samples.
+		 *
+		 * Reads already requested continue from the previous file. Any
+		 * chunks cached from a previous file at the same path are dropped.
+		 */
+		void setLiveFile(std::shared_ptr<datafile::DataFile> file,
+				const QString& path = QString(), float gain = 1., float offset = 0.);
+
+		/*! Set whether requests are handled synchronously, in the calling
+		 * thread, rather than in the pool.
+		 *
+		 * This is needed while anything else calls into HDF5 in the
+		 * calling thread without holding hdf5Mutex(), e.g., a source
+		 * replaying a file. Enabling it waits for all reads in the pool.
+		 */
+		void setSynchronous(bool synchronous);
+
+		/*! Open a recording for a client, replacing any it already has
+		 * open. The result is emitted as opened().
+		 *
+		 * \param client The client for which the recording is opened.
+		 * \param path The absolute path of the recording.
+		 */
+		void open(Client *client, const QString& path);
+
+		/*! Close the recording opened for a client, if any. */
+		void close(Client *client);
+
+		/*! Return the mapping of the recording opened for a client, or
+		 * null if it has none or the recording could not be mapped.
+		 */
+		std::shared_ptr<const MappedRecording> mapping(Client *client) const;
+
+		/*! Close any recording opened for a client, and discard all of its
+		 * requests, e.g., when it disconnects. No signals are emitted for
+		 * the client afterwards.
+		 */
+		void removeClient(Client *client);
+
+		/*! Return the requests of a client which are queued or being read,
+		 * and have not been emitted yet. Reads ahead and exports are not
+		 * included.
+		 */
+		QList<Client::DataRequest> requests(Client *client) const;
+
+		/*! Read a chunk of data for a client, from its open recording if it
+		 * has one, and otherwise from the current recording.
+		 *
+		 * The frame is emitted as dataRead(), or readFailed() is emitted
+		 * if the data could not be read.
+		 */
+		void read(Client *client, const Client::DataRequest& request);
+
+		/*! Return the counters of the reader, e.g., for the HTTP server.
+		 *
+		 * Latencies are measured from the request to its completion, read
+		 * times and throughput over the time spent in the pool, including
+		 * reading ahead. The time the live writer waited for hdf5Mutex()
+		 * is included as well, see LiveWriteLocker.
+		 */
+		QVariantMap status() const;
+
+		/*! Return the counters of the cache of chunks. */
+		QVariantMap cacheStatus() const;
+
+	signals:
+
+		/*! Emitted when a recording has been opened for a client.
+		 *
+		 * \param client The client for which the recording was opened.
+		 * \param success True if the recording was opened.
+		 * \param msg If the recording could not be opened, an error message.
+		 * \param info The metadata of the recording, if it was opened.
+		 */
+		void opened(Client *client, bool success, const QString& msg,
+				const RecordingReader::Info& info);
+
+		/*! Emitted when a chunk of data has been read for a client. */
+		void dataRead(Client *client, const Client::DataRequest& request,
+				const DataFrame& frame);
+
+		/*! Emitted when a chunk of data could not be read for a client. */
+		void readFailed(Client *client, const Client::DataRequest& request,
+				const QString& msg);
+
+	private:
+
+		/* The work of a request, run in the pool. The file is owned
+		 * by the Job for which the task runs. Samples are read from the
+		 * mapping of the file, if any, rather than the file itself.
+		 */
+		struct Task {
+			bool open;
+			QString path;
+			datafile::DataFile *file;
+			std::shared_ptr<const MappedRecording> mapping;
+			Client::DataRequest request;
+			float gain;
+			float offset;
+		};
+
+		/* The outcome of a task. A file opened by the task is owned by
+		 * the result, until it is taken by the reader.
+		 */
+		struct Result {
+			datafile::DataFile *file;
+			std::shared_ptr<const MappedRecording> mapping;
+			Info info;
+			DataFrame frame;
+			QString error;
+			qint64 readTime;
+		};
+
+		/* A request waiting for, or running in, the pool. The file is held
+		 * so that it remains valid while being read, and identified in the
+		 * cache by its path. Jobs reading ahead are not requested by the
+		 * client, and their results are cached rather than emitted.
+		 */
+		struct Job {
+			Task task;
+			std::shared_ptr<datafile::DataFile> file;
+			QString filePath;
+			bool prefetch;
+			QElapsedTimer requested;
+		};
+
+		/* The last request of a client, to detect sequential reads. */
+		struct Access {
+			QString filePath;
+			quint64 nextSample;
+			quint64 length;
+		};
+
+		/* A job running in the pool. */
+		struct Running {
+			QFutureWatcher<Result> *watcher;
+			Job job;
+		};
+
+		/* An open recording, its mapping if it is stored contiguously,
+		 * and its metadata.
+		 */
+		struct Recording {
+			std::shared_ptr<datafile::DataFile> file;
+			std::shared_ptr<const MappedRecording> mapping;
+			Info info;
+		};
+
+		/* Run a task. */
+		static Result execute(Task task);
+
+		/* Queue a job for a client, starting it if the client has none running. */
+		void submit(Client *client, Job job);
+
+		/* Start the next queued job of a client, if any and none is running. */
+		void startNext(Client *client);
+
+		/* Handle a finished job, and start the client's next once control
+		 * returns to the event loop.
+		 */
+		void finish(Client *client, Job job, Result result);
+
+		/* Queue jobs reading ahead of a sequential request, or drop those
+		 * queued if the request is not sequential.
+		 */
+		void readAhead(Client *client, const Job& job);
+
+		/* Release a file held by the reader. The last reference, if this
+		 * is it, is dropped under the HDF5 lock, in the pool unless reads
+		 * are synchronous, so that this thread never waits for a read.
+		 * All references to files are held in this thread.
+		 */
+		void release(std::shared_ptr<datafile::DataFile>& file);
+
+		/* Return true if a chunk is cached, queued or being read. */
+		bool pending(Client *client, const QString& filePath,
+				quint64 start, quint64 stop) const;
+
+		QThreadPool m_pool;
+		bool m_synchronous;
+		int m_prefetchDepth;
+		ChunkCache m_cache;
+
+		std::shared_ptr<datafile::DataFile> m_liveFile;
+		QString m_livePath;
+		float m_liveGain;
+		float m_liveOffset;
+
+		/* Recordings opened by each client. */
+		QHash<Client*, Recording> m_recordings;
+
+		/* Jobs of each client waiting to start, and running. */
+		QHash<Client*, QQueue<Job>> m_queued;
+		QHash<Client*, Running> m_running;
+
+		/* Clients whose running job is to be discarded. */
+		QSet<Client*> m_discarded;
+
+		/* Sequential access of each client. */
+		QHash<Client*, Access> m_access;
+
+		int m_queuedJobs;
+		int m_maxQueuedJobs;
+		quint64 m_reads;
+		quint64 m_failedReads;
+		quint64 m_bytesRead;
+		qint64 m_totalLatency;
+		qint64 m_maxLatency;
+		qint64 m_totalReadTime;
+		quint64 m_executed;
+		quint64 m_prefetches;
+		quint64 m_mappedReads;
+};
+
+#endif
+
@@ -0,0 +1,66 @@
+/*! \file sample-kernels.h
+ *
+ * Vectorized kernels used to convert the samples of data frames
+ * into the forms requested by clients.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef BLDS_SAMPLE_KERNELS_H
+#define BLDS_SAMPLE_KERNELS_H
+
+#include <QtCore>
+
+#include <cstddef> // size_t
+
+/*! The samplekernels namespace contains the conversions applied to
+ * samples on their way to clients. Each kernel uses SSE2 on x86, and
+ * where noted NEON on ARM, with a scalar fallback elsewhere, and gives
+ * identical results on every path.
+ */
+namespace samplekernels {
+
+/*! Convert int16 samples to float, applying a gain and offset.
+ *
+ * \param in The samples to convert.
+ * \param out Buffer receiving the converted samples, of at least n values.
+ * \param n The number of samples.
+ * \param gain Factor by which each sample is multiplied.
+ * \param offset Value added to each sample after the gain is applied.
+ *
+ * Each output is computed as `in[i] * gain + offset`, in single precision.
+ */
+void int16ToFloat(const qint16 *in, float *out, size_t n,
+		float gain, float offset);
+
+/*! Transpose a matrix of int16 samples.
+ *
+ * \param in The matrix to transpose, with `rows` rows of `cols` values each.
+ * \param out Buffer receiving the transpose, with `cols` rows of `rows`
+ * 	values each. This must not overlap the input.
+ * \param rows The number of rows of the input.
+ * \param cols The number of columns of the input.
+ *
+ * The matrix is transposed in tiles small enough to stay in the L1 cache,
+ * each made of 8x8 blocks transposed in registers. A frame's samples, which
+ * are stored channel by channel, are transposed into time-major order with
+ * `rows` equal to the number of channels and `cols` to the number of samples.
+ */
+void transpose(const qint16 *in, qint16 *out, size_t rows, size_t cols);
+
+/*! Update the minimum and maximum of a run of int16 samples.
+ *
+ * \param in The samples.
+ * \param n The number of samples.
+ * \param min The minimum, lowered to that of the samples if less.
+ * \param max The maximum, raised to that of the samples if greater.
+ *
+ * The minimum and maximum are accumulated, so that a run split across
+ * several calls gives the same result as a single call.
+ */
+void minMax(const qint16 *in, size_t n, qint16 *min, qint16 *max);
+
+} // end samplekernels namespace
+
+#endif
+
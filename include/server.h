@@ -11,6 +11,7 @@
 
 #include "client.h"
 #include "data-frame.h"
+#include "envelope-pyramid.h"
 
 #include "libdata-source/include/data-source.h"
 #include "libdatafile/include/datafile.h"
@@ -22,7 +23,18 @@
 #include <QtCore>
 #include <QtNetwork>
 
-#include <memory>	// std::unique_ptr
+#include "multicast-publisher.h"
+#include "recording-catalog.h"
+#include "recording-reader.h"
+#include "session.h"
+#include "stream-monitor.h"
+#include "time-index.h"
+
+#ifdef Q_OS_UNIX
+#include "shared-memory-ring.h"
+#endif
+
+#include <memory>	// std::unique_ptr, std::shared_ptr
 
 /*! \class Server
  *
@@ -72,6 +84,75 @@ class Server : public QObject {
 
 	/*! Maximum sized chunks to accept requests, in seconds. */
 	const double MaximumDataRequestChunkSize = 10.0;
+
+	/*! Default maximum length of each frame sent in reply to a request
+	 * for data, in seconds. Longer requests are streamed as several frames.
+	 */
+	const double DefaultStreamFrameSize = 10.0;
+
+	/*! Maximum latency clients may request for coalesced live frames, in ms. */
+	const quint32 MaximumClientLatency = 10000;
+
+	/*! Default name of the shared-memory object to which frames are published. */
+	const QString DefaultSharedMemoryName = "/blds";
+
+	/*! Default size of the shared-memory ring, in MiB. Zero disables it. */
+	const quint32 DefaultSharedMemorySize = 0;
+
+	/*! Default minimum frame size, in bytes, sent using zero-copy
+	 * transmission. Zero disables it.
+	 */
+	const qint64 DefaultZeroCopyThreshold = 0;
+
+	/*! Default port to which multicast datagrams are sent. */
+	const quint16 DefaultMulticastPort = 12346;
+
+	/*! Default time-to-live of multicast datagrams. */
+	const int DefaultMulticastTtl = 1;
+
+	/*! Default maximum size of multicast datagrams, which fits in an
+	 * Ethernet frame without fragmentation.
+	 */
+	const int DefaultMulticastDatagramSize = 1472;
+
+	/*! Default time for which the session of a disconnected client
+	 * is kept, in seconds.
+	 */
+	const quint32 DefaultSessionTimeout = 60;
+
+	/*! Default maximum size of the history of frames kept by each
+	 * session, in MiB.
+	 */
+	const quint32 DefaultSessionHistorySize = 64;
+
+	/*! Default maximum number of requests for data per client which have
+	 * not been sent yet, whether waiting for data, being read or streamed.
+	 */
+	const int DefaultMaxPendingRequests = 64;
+
+	/*! Default number of threads reading requested data from recordings. */
+	const int DefaultReadThreads = 4;
+
+	/*! Default number of chunks read ahead for clients reading sequentially. */
+	const int DefaultPrefetchDepth = 2;
+
+	/*! Default size of the cache of chunks read from recordings, in MiB. */
+	const int DefaultCacheSize = 256;
+
+	/*! Default number of samples of the finest bins of the envelope
+	 * summarizing each recording. Zero disables the envelope.
+	 */
+	const quint32 DefaultEnvelopeBinSize = 256;
+
+	/*! Default interval between pairs of the time index of each recording,
+	 * in milliseconds. Zero disables the index.
+	 */
+	const quint32 DefaultTimeIndexInterval = 1000;
+
+	/*! Time to wait for an instance already listening on the local
+	 * socket to accept a connection, in milliseconds.
+	 */
+	const int LocalSocketProbeTimeout = 100;
 	
 	public:
 
@@ -147,9 +228,11 @@ class Server : public QObject {
 		/*! Handle an HTTP request for the source's or server's status.
 		 *
 		 * The Server exposes a simple HTTP interface, mostly intended for
-		 * debugging or small queries. Two paths are supported:
+		 * debugging or small queries. Three paths are supported:
 		 * 	- /status - Returns the status of the Server itself
 		 * 	- /source - Returns the status of the managed data source
+		 * 	- /stream - Returns the sequence and gap counters of the current
+		 * 	  or last stream, and the number of frames sent to each client
 		 */
 		void handleHttpRequest(Tufao::HttpServerRequest& request,
 				Tufao::HttpServerResponse& response);
@@ -157,6 +240,9 @@ class Server : public QObject {
 		/*! Handler called when new clients connect. */
 		void handleNewClient();
 
+		/*! Handler called when new clients connect on the local socket. */
+		void handleNewLocalClient();
+
 		/*! Handle the disconnection of a remote client. */
 		void handleClientDisconnection(Client *client);
 
@@ -215,16 +301,53 @@ class Server : public QObject {
 		/*! Handle a request for a chunk of data from the client.
 		 * \param start The start time of the chunk to retrieve.
 		 * \param stop The stop time of the chunk to retrieve.
+		 * \param id Identifier of the request, with which it may be cancelled.
+		 * \param timeout Time after which the request is dropped if it is
+		 * 	still pending, in milliseconds, or zero if never.
 		 *
 		 * If the request cannot be serviced immediately, the server will 
 		 * queue the request and send the relevant chunk of data to the client
-		 * when it becomes available. 
+		 * when it becomes available. Each client may have at most
+		 * `max-pending-requests` requests queued. A request still queued at
+		 * its deadline is dropped, and an error message is sent.
 		 *
 		 * If the request will *never* be available, e.g. the client requests
 		 * data past the end of the recording, the request will not be serviced
 		 * and an error message will be returned.
 		 */
-		void handleClientDataRequest(Client *client, float start, float stop);
+		void handleClientDataRequest(Client *client, float start, float stop,
+				quint32 id, quint32 timeout);
+
+		/*! Handle a request for a chunk of data from the client, by sample index.
+		 * \param start The index of the first sample of the chunk to retrieve.
+		 * \param stop The index one past the last sample of the chunk.
+		 *
+		 * This is identical to handleClientDataRequest(), except that the
+		 * chunk is addressed by exact 64-bit sample indices, and the reply
+		 * frame carries the same. No conversion through time in seconds, and
+		 * thus no rounding, takes place.
+		 */
+		void handleClientSampleDataRequest(Client *client, quint64 start, quint64 stop,
+				quint32 id, quint32 timeout);
+
+		/*! Handle a request from the client to cancel pending requests
+		 * for data, either by their identifier or by a range of samples.
+		 *
+		 * The client is sent the number of requests cancelled.
+		 */
+		void handleClientCancelDataRequest(Client *client, quint32 id,
+				quint64 start, quint64 stop);
+
+		/*! Handle a client being ready for the next frame of a streamed
+		 * request for data.
+		 *
+		 * The next piece of the client's first streamed request is read
+		 * from the recording file and sent. Pieces are only read once the
+		 * previous one has been handed to the socket, so that memory use
+		 * is bounded regardless of the size of the request, while the
+		 * kernel sends the previous piece as the next is read.
+		 */
+		void handleClientStreamReady(Client *client);
 
 		/*! Handle a request from the client to get all available data.
 		 *
@@ -239,6 +362,158 @@ class Server : public QObject {
 		 */
 		void handleClientAllDataRequest(Client *client, bool request);
 
+		/*! Handle a request from the client to set one of its own parameters.
+		 *
+		 * These parameters only affect communication with the requesting
+		 * client, and may be set at any time. Supported parameters are:
+		 * 	- socket-profile - One of "default", "latency" or "throughput".
+		 * 	- max-latency - Maximum time, in milliseconds, for which live frames
+		 * 	  are held and merged into one, as a uint32_t. Zero disables this.
+		 * 	- encoding - Encoding of data frames, one of "raw", "deflate" or
+		 * 	  "delta-bitpack". See framecodec::Encoding.
+		 * 	- sample-type - Type of the samples of data frames, "int16" for the
+		 * 	  raw samples or "float32" for samples converted to physical units
+		 * 	  with the source's gain and offset (adc-range).
+		 * 	- sample-layout - Order of the samples of data frames, "channel-major"
+		 * 	  (each channel in turn) or "time-major" (interleaved).
+		 * 	- frame-sequence - Whether `data` and `data-samples` headers end
+		 * 	  with the frame's sequence number, as a bool. See
+		 * 	  Client::setFrameSequence().
+		 *
+		 * \param client The client emitting the request.
+		 * \param param The name of the parameter to set.
+		 * \param data The value of the parameter, encoded as a variant.
+		 */
+		void handleClientSetClientParamMessage(Client *client,
+				const QByteArray& param, const QVariant& data);
+
+		/*! Handle a request from a client to open a session.
+		 *
+		 * The client is sent the token of a new session, or of the one it
+		 * already has. See Session for details.
+		 *
+		 * \param client The client emitting the request.
+		 */
+		void handleClientOpenSessionMessage(Client *client);
+
+		/*! Handle a request from a client to resume a session.
+		 *
+		 * The session must exist, and must not be in use by another
+		 * connection. The client is sent all frames it missed which are
+		 * still in the session's history, and its saved options and requests
+		 * are restored.
+		 *
+		 * \param client The client emitting the request.
+		 * \param token The token of the session.
+		 * \param lastSequence The sequence number of the last frame the
+		 * 	client received.
+		 */
+		void handleClientResumeSessionMessage(Client *client,
+				const QByteArray& token, quint64 lastSequence);
+
+		/*! Handle a request from the client to open a finished recording.
+		 *
+		 * The recording must be in the save directory, and may not be the
+		 * current recording. It is opened read-only by the RecordingReader, and
+		 * the client's requests for data are then read from it, while any
+		 * recording continues as usual. Any pending requests of the client
+		 * are cancelled.
+		 *
+		 * \param client The client emitting the request.
+		 * \param path The path of the recording, relative to the save directory.
+		 */
+		void handleClientOpenRecordingMessage(Client *client, const QString& path);
+
+		/*! Handle a request from the client to close its open recording,
+		 * after which its requests for data are again read from the
+		 * current recording. Any pending requests of the client are cancelled.
+		 */
+		void handleClientCloseRecordingMessage(Client *client);
+
+		/*! Handle a request from the client for the recordings in the save
+		 * directory, and their metadata, served from the catalog.
+		 */
+		void handleClientGetRecordingsMessage(Client *client);
+
+		/*! Handle a request from the client to export a recording, or a
+		 * range of its samples and channels, as a stream of frames.
+		 *
+		 * The recording is the client's open recording if it has one, and
+		 * otherwise the samples of the current recording available now.
+		 * Frames of `stream-frame-size` are sent back to back, as fast as
+		 * the client takes them, and read ahead while it does.
+		 *
+		 * \param client The client emitting the request.
+		 * \param start The index of the first sample to export.
+		 * \param stop The index one past the last sample to export, or zero
+		 * 	for all available samples.
+		 * \param firstChannel The index of the first channel to export.
+		 * \param nchannels The number of channels to export, or zero for all
+		 * 	channels from the first.
+		 * \param id Identifier of the export chosen by the client.
+		 */
+		void handleClientExportMessage(Client *client, quint64 start, quint64 stop,
+				quint32 firstChannel, quint32 nchannels, quint32 id);
+
+		/*! Handle a request from the client for the envelope of a stretch
+		 * of a recording.
+		 *
+		 * The envelope is read from the sidecar of the client's open
+		 * recording if it has one, and otherwise from that being built for
+		 * the current recording.
+		 *
+		 * \param client The client emitting the request.
+		 * \param start The index of the first sample of the stretch.
+		 * \param stop The index one past the last sample of the stretch, or
+		 * 	zero for all summarized samples.
+		 * \param width The number of bins wanted, e.g., the width of the view
+		 * 	in pixels.
+		 * \param firstChannel The index of the first channel.
+		 * \param nchannels The number of channels, or zero for all channels
+		 * 	from the first.
+		 * \param id Identifier of the request chosen by the client.
+		 */
+		void handleClientGetEnvelopeMessage(Client *client, quint64 start, quint64 stop,
+				quint32 width, quint32 firstChannel, quint32 nchannels, quint32 id);
+
+		/*! Handle a request from the client for the samples corresponding
+		 * to a time on the wall clock.
+		 *
+		 * The time is looked up in the time index of the client's open
+		 * recording if it has one, and otherwise in that of the current
+		 * recording.
+		 *
+		 * \param client The client emitting the request.
+		 * \param time Microseconds since the epoch, in UTC.
+		 * \param id Identifier of the request chosen by the client.
+		 */
+		void handleClientTimeToSampleMessage(Client *client, qint64 time, quint32 id);
+
+		/*! Handle a request from the client to export samples of its open
+		 * recording raw, sent by the kernel straight from the file.
+		 *
+		 * This requires the samples to be stored contiguously, see
+		 * MappedRecording, and the samples are sent in the layout of the
+		 * file. Others must be requested as data.
+		 *
+		 * \param client The client emitting the request.
+		 * \param start The index of the first sample to export.
+		 * \param stop The index one past the last sample to export.
+		 */
+		void handleClientExportRawMessage(Client *client, quint64 start, quint64 stop);
+
+		/*! Handle a recording having been opened for a client by the RecordingReader. */
+		void handleRecordingOpened(Client *client, bool success,
+				const QString& msg, const RecordingReader::Info& info);
+
+		/*! Handle data having been read for a client by the RecordingReader. */
+		void handleRecordingDataRead(Client *client,
+				const Client::DataRequest& request, const DataFrame& frame);
+
+		/*! Handle data that could not be read for a client by the RecordingReader. */
+		void handleRecordingReadFailed(Client *client,
+				const Client::DataRequest& request, const QString& msg);
+
 		/*! Handle a client messaging error.
 		 * 
 		 * \param client The client to which the error message should be sent.
@@ -323,9 +598,27 @@ class Server : public QObject {
 		/* Initialize the main server */
 		void initServer();
 
+		/* Initialize the local socket server, if enabled. */
+		void initLocalServer();
+
+		/* Start managing a newly-connected client. */
+		void addClient(Client *client);
+
 		/* Initialize the HTTP status server. */
 		void initStatusServer();
 
+		/* Initialize the shared-memory ring, if enabled. */
+		void initSharedMemory();
+
+		/* Initialize publication to a multicast group, if enabled. */
+		void initMulticast();
+
+		/* Start the pool of threads reading requested data from recordings. */
+		void initRecordingReader();
+
+		/* Start indexing the recordings in the save directory. */
+		void initRecordingCatalog();
+
 		/* Connect the signals and slots for communication with a new client. */
 		void connectClientSignals(Client *client);
 
@@ -349,14 +642,82 @@ class Server : public QObject {
 		void serveSourceStatus(Tufao::HttpServerRequest& request, 
 				Tufao::HttpServerResponse& response);
 
-		/* Send data to any clients as it arrives. */
-		void sendDataToClients(datasource::Samples& samples);
+		/* Serve the counters of the data stream to HTTP clients. */
+		void serveStreamStatus(Tufao::HttpServerRequest& request, 
+				Tufao::HttpServerResponse& response);
+
+		/* Serve the counters of reads of requested data to HTTP clients. */
+		void serveReadStatus(Tufao::HttpServerRequest& request, 
+				Tufao::HttpServerResponse& response);
+
+		/* Serve the counters of the cache of chunks read to HTTP clients. */
+		void serveCacheStatus(Tufao::HttpServerRequest& request, 
+				Tufao::HttpServerResponse& response);
+
+		/* Serve the recordings in the save directory to HTTP clients. */
+		void serveRecordings(Tufao::HttpServerRequest& request, 
+				Tufao::HttpServerResponse& response);
+
+		/* Send data to any clients as it arrives, and publish it
+		 * to the shared-memory ring and multicast group. The sequence
+		 * is that of the chunk from the source.
+		 */
+		void sendDataToClients(datasource::Samples& samples, quint64 sequence);
+
+		/* Set the gain and offset of a frame from those of the source. */
+		void setFrameScale(DataFrame& frame) const;
+
+		/* Send any live frames held by clients for coalescing, e.g.,
+		 * when a recording ends.
+		 */
+		void flushLiveData();
+
+		/* Stop monitoring the data stream, and report any gaps. */
+		void stopStreamMonitor();
 
 		/* Service any pending requests for data that have now
 		 * become available.
 		 */
 		void servicePendingDataRequests();
 
+		/* Return the number of requests for data of a client which have
+		 * not been sent yet, whether waiting for the data, queued to be
+		 * read, or streamed.
+		 */
+		int countQueuedRequests(Client *client) const;
+
+		/* Return true if the client may queue another request for data,
+		 * and send it an error otherwise.
+		 */
+		bool acceptRequest(Client *client);
+
+		/* Send a verified request for data immediately if it is available,
+		 * or queue it with the client otherwise.
+		 */
+		void handleVerifiedDataRequest(Client *client, 
+				const Client::DataRequest& request);
+
+		/* Read the requested chunk from the recording and send it. */
+		void sendRequestedData(Client *client, const Client::DataRequest& request);
+
+		/* Read the requested chunk from the recording opened by the client,
+		 * and send it.
+		 */
+		void readOpenRecording(Client *client, const Client::DataRequest& request);
+
+		/* Close the current recording file. */
+		void closeFile();
+
+		/* Summarize new samples of the current recording in its envelope,
+		 * creating it with the first samples.
+		 */
+		void updateEnvelope(const datasource::Samples& samples);
+
+		/* Note the arrival of new samples of the current recording, adding
+		 * a pair to its time index if the interval has passed.
+		 */
+		void updateTimeIndex();
+
 		/* Check if the the server has collected enough data to 
 		 * satisfy the requested length of the recording.
 		 */
@@ -365,7 +726,12 @@ class Server : public QObject {
 		/* Return true if the given request is considered valid,
 		 * and false otherwise.
 		 */
-		bool verifyChunkRequest(double start, double stop);
+		bool verifyChunkRequest(double start, double stop, double sampleRate);
+
+		/* Return true if the given request, in samples, is considered
+		 * valid, and false otherwise.
+		 */
+		bool verifySampleChunkRequest(quint64 start, quint64 stop, double sampleRate);
 
 		/* Thread in which the source object lives. */
 		QThread *sourceThread;
@@ -373,12 +739,28 @@ class Server : public QObject {
 		/* The source object itself. */
 		QPointer<datasource::BaseSource> source;
 
+		/* True if the source replays a file, see setSynchronous(). */
+		bool sourceReplaysFile;
+
 		/* Main server. */
 		QTcpServer *server;
 
 		/* Server port. */
 		quint16 port;
 
+		/* Server for clients on the same machine, using a local socket.
+		 * This is null if disabled.
+		 */
+		QLocalServer *localServer;
+
+		/* Name of the local socket. If empty, no local server is created. */
+		QString localSocketName;
+
+		/* Minimum size of frames sent to TCP clients with zero-copy
+		 * transmission, or zero if disabled.
+		 */
+		qint64 zeroCopyThreshold;
+
 		/* HTTP status server. */
 		Tufao::HttpServer statusServer;
 
@@ -388,9 +770,14 @@ class Server : public QObject {
 		/* Maximum number of connections. */
 		int maxConnections;
 
-		/* Maximum size of a data chunk to accept a request for, in seconds. */
+		/* Maximum size of a data chunk to accept a request for, in seconds.
+		 * Zero means there is no limit.
+		 */
 		double maxRequestChunkSize;
 
+		/* Maximum length of each frame sent in reply to a request, in seconds. */
+		double streamFrameSize;
+
 		/* List of connected remote clients. */
 		QList<Client*> clients;
 
@@ -404,7 +791,7 @@ class Server : public QObject {
 		QDateTime startTime;
 
 		/* File to which data is to be saved. */
-		std::unique_ptr<datafile::DataFile> file;
+		std::shared_ptr<datafile::DataFile> file;
 
 		/* Directory in which data will be saved. */
 		QString saveDirectory;
@@ -421,6 +808,101 @@ class Server : public QObject {
 
 		/* Interval between reads from the data source. */
 		quint32 readInterval;
+
+		/* Name of the shared-memory object to which frames are published. */
+		QString sharedMemoryName;
+
+		/* Size of the shared-memory ring, in MiB. */
+		quint32 sharedMemorySize;
+
+		/* Multicast group to which live frames are published. If empty,
+		 * frames are not published.
+		 */
+		QString multicastGroup;
+
+		/* Port to which multicast datagrams are sent. */
+		quint16 multicastPort;
+
+		/* Time-to-live of multicast datagrams. */
+		int multicastTtl;
+
+		/* Maximum size of multicast datagrams. */
+		int multicastDatagramSize;
+
+		/* Network interface on which to send multicast datagrams. */
+		QString multicastInterface;
+
+		/* Publisher of live frames to the multicast group. This is
+		 * null if disabled.
+		 */
+		std::unique_ptr<MulticastPublisher> multicast;
+
+		/* Sequence numbers and gap detection for chunks from the source. */
+		StreamMonitor streamMonitor;
+
+		/* Sessions of clients, by token. */
+		QHash<QByteArray, std::shared_ptr<Session>> sessions;
+
+		/* Time for which the session of a disconnected client is kept,
+		 * in seconds.
+		 */
+		quint32 sessionTimeout;
+
+		/* Maximum size of the history of frames kept by each session, in MiB. */
+		quint32 sessionHistorySize;
+
+		/* Maximum number of pending requests for data per client. */
+		int maxPendingRequests;
+
+		/* Number of threads reading requested data from recordings. */
+		int readThreads;
+
+		/* Number of chunks read ahead for clients reading sequentially. */
+		int prefetchDepth;
+
+		/* Size of the cache of chunks read from recordings, in MiB. */
+		int cacheSize;
+
+		/* Number of samples of the finest bins of envelopes, or zero. */
+		quint32 envelopeBinSize;
+
+		/* Envelope of the current recording, and the path of its sidecar
+		 * until it is created with the first samples.
+		 */
+		std::unique_ptr<EnvelopePyramid> envelope;
+		QString envelopePath;
+
+		/* Interval between pairs of the time index, in milliseconds, or zero. */
+		quint32 timeIndexInterval;
+
+		/* Time index of the current recording, the time at which its next
+		 * pair is due, and the last arrival of samples, added when the
+		 * recording is closed so that the index covers all its samples.
+		 */
+		std::unique_ptr<TimeIndex> timeIndex;
+		qint64 nextTimeIndexEntry;
+		TimeIndex::Entry lastArrival;
+
+		/* Reader of requested data, from the current recording or those
+		 * opened by clients.
+		 */
+		RecordingReader *recordingReader;
+
+		/* Index of the recordings in the save directory. */
+		RecordingCatalog *recordingCatalog;
+
+		/* Recordings opened by clients. */
+		QHash<Client*, RecordingReader::Info> openRecordings;
+
+		/* Clients with a piece of a streamed request being read. */
+		QSet<Client*> streamReadsInFlight;
+
+#ifdef Q_OS_UNIX
+		/* Ring buffer in shared memory, from which local clients may
+		 * read data frames without copying. This is null if disabled.
+		 */
+		std::unique_ptr<SharedMemoryRing> sharedMemory;
+#endif
 };
 
 #endif
@@ -0,0 +1,116 @@
+/*! \file session.h
+ *
+ * Class used to let clients resume their subscriptions after
+ * reconnecting to the BLDS.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef BLDS_SESSION_H
+#define BLDS_SESSION_H
+
+#include "client.h"
+#include "data-frame.h"
+#include "frame-codec.h"
+
+#include <QtCore>
+
+/*! \class Session
+ * The Session class holds the state a client needs to resume its
+ * subscription after its connection drops.
+ *
+ * A client opens a session and receives a token. From then on, every data
+ * frame sent to the client is numbered by the session, and kept in a
+ * history of recent frames, bounded in size. When the client disconnects,
+ * the Server keeps the session for a timeout, saves the client's options
+ * and pending requests in it, and continues to record live frames into its
+ * history. A client reconnecting with the token and the sequence number of
+ * the last frame it received is sent every later frame still in the history,
+ * and continues where it left off.
+ *
+ * Frames in the history share their samples with those sent to other
+ * clients, so keeping them is cheap unless they are held for long.
+ */
+class Session {
+
+	public:
+
+		/*! A frame sent to the client, as kept in the history. */
+		struct Frame {
+			/*! Sequence number of the frame. */
+			quint64 sequence;
+
+			/*! The frame itself. */
+			DataFrame frame;
+
+			/*! True if the frame was sent with sample indices. */
+			bool sampleIndexed;
+		};
+
+		/*! Options and requests of a client, saved while it is disconnected. */
+		struct Subscription {
+			bool requestedAllData;
+			QList<Client::DataRequest> pendingRequests;
+			DataFrame::SampleType sampleType;
+			DataFrame::SampleLayout sampleLayout;
+			framecodec::Encoding encoding;
+			quint32 maxLatency;
+		};
+
+		/*! Create a session.
+		 *
+		 * \param token The token by which the client resumes the session.
+		 * \param sequence The sequence number of the last frame already
+		 * 	sent to the client.
+		 * \param maxHistoryBytes The maximum size of the samples of frames
+		 * 	kept in the history.
+		 */
+		Session(const QByteArray& token, quint64 sequence, qint64 maxHistoryBytes);
+
+		/*! Return the token of this session. */
+		QByteArray token() const;
+
+		/*! Return the sequence number of the last frame recorded. */
+		quint64 lastSequence() const;
+
+		/*! Return the sequence number of the oldest frame in the history,
+		 * or one past the last frame recorded if the history is empty.
+		 */
+		quint64 firstAvailableSequence() const;
+
+		/*! Number a frame sent to the client, keep it in the history, and
+		 * return its sequence number.
+		 */
+		quint64 record(const DataFrame& frame, bool sampleIndexed);
+
+		/*! Return all frames in the history after the given sequence number. */
+		QList<Frame> framesAfter(quint64 sequence) const;
+
+		/*! Return true if a client is currently connected to this session. */
+		bool attached() const;
+
+		/*! Mark the session as connected to a client. */
+		void attach();
+
+		/*! Mark the session as disconnected, saving the client's subscription. */
+		void detach(const Subscription& subscription);
+
+		/*! Return the time since the session was detached, in milliseconds. */
+		qint64 detachedFor() const;
+
+		/*! Return the subscription saved when the session was detached. */
+		const Subscription& subscription() const;
+
+	private:
+		QByteArray m_token;
+		quint64 m_sequence;
+		qint64 m_maxHistoryBytes;
+		QQueue<Frame> m_history;
+		qint64 m_historyBytes;
+		bool m_attached;
+		QElapsedTimer m_detached;
+		Subscription m_subscription;
+};
+
+#endif
+
@@ -0,0 +1,199 @@
+/*! \file shared-memory-ring.h
+ *
+ * Ring buffer in POSIX shared memory, used to publish data frames
+ * to clients running on the same machine as the BLDS.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef BLDS_SHARED_MEMORY_RING_H
+#define BLDS_SHARED_MEMORY_RING_H
+
+#include "data-frame.h"
+
+#include <QtCore>
+
+#include <atomic>
+
+/*! \class SharedMemoryRing
+ * The SharedMemoryRing class publishes data frames into a ring buffer
+ * in a named POSIX shared-memory object, which any number of local
+ * processes may map read-only and read from without copying.
+ *
+ * The object starts with a 64-byte header:
+ * 	- magic number (uint32_t, "BLDS")
+ * 	- layout version (uint32_t)
+ * 	- capacity of the data region in bytes (uint64_t)
+ * 	- sample rate of the current recording (double)
+ * 	- head: offset one past the last complete record (atomic uint64_t)
+ * 	- tail: offset below which records may be overwritten (atomic uint64_t)
+ * 	- sequence: number of frames published (atomic uint64_t)
+ *
+ * The data region follows immediately. Offsets in the header are absolute
+ * byte counts since the ring was created, the position in the data region
+ * is the offset modulo the capacity. Each record is aligned to 16 bytes,
+ * and starts with a 16-byte header:
+ * 	- sequence number of the frame, starting from 1 (uint64_t)
+ * 	- record type, 1 for a frame or 2 for padding to the end of the ring (uint32_t)
+ * 	- size of the payload (uint32_t)
+ *
+ * The payload of a frame record is the frame serialized with sample
+ * indices, as in the `data-samples` message.
+ *
+ * Synchronization follows a sequence lock. The writer advances the tail
+ * before overwriting any bytes and advances the head after a record is
+ * complete. A reader may use a record in place, and afterwards checks
+ * that the tail has not passed the start of the record. If it has, the
+ * reader was overrun and must discard what it read.
+ */
+class SharedMemoryRing {
+
+	public:
+
+		/*! Magic number at the start of the shared-memory object. */
+		static const quint32 Magic = 0x53444c42;
+
+		/*! Version of the memory layout. */
+		static const quint32 Version = 1;
+
+		/*! Type of a record holding a data frame. */
+		static const quint32 FrameRecord = 1;
+
+		/*! Type of a record which pads the ring to its end. */
+		static const quint32 PaddingRecord = 2;
+
+		/*! Layout of the header of the shared-memory object. */
+		struct Header {
+			quint32 magic;
+			quint32 version;
+			quint64 capacity;
+			double sampleRate;
+			std::atomic<quint64> head;
+			std::atomic<quint64> tail;
+			std::atomic<quint64> sequence;
+			char reserved[16];
+		};
+
+		/*! Layout of the header of each record. */
+		struct RecordHeader {
+			quint64 sequence;
+			quint32 type;
+			quint32 size;
+		};
+
+		/*! Create a ring in a new shared-memory object.
+		 *
+		 * \param name The name of the shared-memory object, e.g. "/blds".
+		 * \param capacity The size of the data region in bytes.
+		 *
+		 * The object is created readable and writable only by the user
+		 * running the server, and locked with flock() while the ring
+		 * exists. An existing object of the same name is replaced only if
+		 * it is not locked, i.e., it was left behind by an instance which
+		 * has exited. This throws a std::runtime_error if the object is in
+		 * use, or cannot be created or mapped.
+		 */
+		SharedMemoryRing(const QString& name, quint64 capacity);
+
+		/*! Destroy the ring, unmapping and unlinking the shared-memory object. */
+		~SharedMemoryRing();
+
+		/*! Copying is not allowed. */
+		SharedMemoryRing(const SharedMemoryRing&) = delete;
+		SharedMemoryRing(SharedMemoryRing&&) = delete;
+		SharedMemoryRing& operator=(const SharedMemoryRing&) = delete;
+
+		/*! Return the name of the shared-memory object. */
+		QString name() const;
+
+		/*! Return the capacity of the data region in bytes. */
+		quint64 capacity() const;
+
+		/*! Set the sample rate advertised to readers. */
+		void setSampleRate(double sampleRate);
+
+		/*! Publish a frame into the ring.
+		 *
+		 * Returns false if the frame is larger than the ring itself, in
+		 * which case nothing is written.
+		 */
+		bool publish(const DataFrame& frame);
+
+	private:
+
+		/* Advance the tail so that n bytes at the head may be overwritten. */
+		void reserve(quint64 head, quint64 n);
+
+		QByteArray m_name;
+		int m_fd;
+		size_t m_mappedSize;
+		Header *m_header;
+		char *m_data;
+};
+
+/*! \class SharedMemoryRingReader
+ * The SharedMemoryRingReader class attaches to a SharedMemoryRing from
+ * another process, and reads records from it in place.
+ *
+ * Use it as:
+ *
+ * 	while (auto *payload = reader.next(&size)) {
+ * 		// Use payload, without copying
+ * 		if (!reader.valid()) {
+ * 			// The payload was overwritten while in use, discard the results
+ * 		}
+ * 	}
+ *
+ * Readers start at the newest data. After an overrun, next() skips
+ * ahead to the newest data and overruns() is incremented.
+ */
+class SharedMemoryRingReader {
+
+	public:
+
+		/*! Attach to the named shared-memory ring.
+		 *
+		 * This throws a std::runtime_error if the object does not exist,
+		 * cannot be mapped, or is not a ring of a compatible version.
+		 */
+		SharedMemoryRingReader(const QString& name);
+
+		/*! Detach from the ring. */
+		~SharedMemoryRingReader();
+
+		/*! Copying is not allowed. */
+		SharedMemoryRingReader(const SharedMemoryRingReader&) = delete;
+		SharedMemoryRingReader(SharedMemoryRingReader&&) = delete;
+		SharedMemoryRingReader& operator=(const SharedMemoryRingReader&) = delete;
+
+		/*! Return a pointer to the payload of the next frame, or nullptr
+		 * if no new frame is available.
+		 *
+		 * \param size Set to the size of the payload in bytes.
+		 * \param sequence If not null, set to the sequence number of the frame.
+		 */
+		const char *next(quint32 *size, quint64 *sequence = nullptr);
+
+		/*! Return true if the payload last returned by next() was not
+		 * overwritten by the server before this call.
+		 */
+		bool valid() const;
+
+		/*! Return the sample rate advertised by the server. */
+		double sampleRate() const;
+
+		/*! Return the number of times the reader was overrun by the server. */
+		quint64 overruns() const;
+
+	private:
+		int m_fd;
+		size_t m_mappedSize;
+		const SharedMemoryRing::Header *m_header;
+		const char *m_data;
+		quint64 m_position;
+		quint64 m_current;
+		quint64 m_overruns;
+};
+
+#endif
+
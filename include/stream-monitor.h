@@ -0,0 +1,97 @@
+/*! \file stream-monitor.h
+ *
+ * Class used to number chunks of data from the source and detect
+ * gaps in the stream.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef BLDS_STREAM_MONITOR_H
+#define BLDS_STREAM_MONITOR_H
+
+#include <QtCore>
+
+/*! \class StreamMonitor
+ * The StreamMonitor class assigns sequence numbers to the chunks of data
+ * read from the source during a recording, and checks that they arrive at
+ * the rate the source promises.
+ *
+ * Each chunk should hold one read interval's worth of samples. Chunks of
+ * any other size, and chunks arriving more than one read interval late, are
+ * counted. The monitor also compares the samples received with the number
+ * expected from the time elapsed since the last chunk at which the source
+ * was on time, the anchor. The anchor moves with every such chunk, so drift
+ * between the local clock and the source's does not build up as lag.
+ *
+ * When the source falls behind the anchor by more than `GapThreshold` read
+ * intervals, a gap is suspected. Chunks delayed in this process, e.g., by a
+ * stall of the event loop, then arrive together and make up the lag. If the
+ * lag remains for another read interval, the samples are taken as dropped:
+ * a gap is counted, and the anchor moves past it, so that the next gap is
+ * detected as well.
+ */
+class StreamMonitor {
+
+	public:
+
+		/*! Number of read intervals the source may fall behind before
+		 * a gap is counted.
+		 */
+		static const int GapThreshold = 2;
+
+		/*! Create a monitor, with no stream running. */
+		StreamMonitor();
+
+		/*! Start monitoring a new stream, resetting all counters.
+		 *
+		 * \param sampleRate The sample rate of the source.
+		 * \param readInterval The interval between reads of the source,
+		 * 	in milliseconds.
+		 */
+		void start(double sampleRate, quint32 readInterval);
+
+		/*! Stop monitoring the current stream. Its counters are kept
+		 * until the next stream starts.
+		 */
+		void stop();
+
+		/*! Record the arrival of a chunk of data, and return its sequence
+		 * number. Sequence numbers start from 1 for each stream.
+		 *
+		 * \param nsamples The number of samples in the chunk.
+		 */
+		quint64 addChunk(quint64 nsamples);
+
+		/*! Return the number of gaps detected in the current stream. */
+		quint64 gaps() const;
+
+		/*! Return the counters of the current stream, as served over HTTP. */
+		QVariantMap status() const;
+
+	private:
+		double m_sampleRate;
+		quint32 m_readInterval;
+		quint64 m_expectedChunkSize;
+		QElapsedTimer m_elapsed;
+		qint64 m_lastChunkTime;
+		quint64 m_sequence;
+		quint64 m_samples;
+		quint64 m_irregularChunks;
+		quint64 m_lateChunks;
+		quint64 m_gaps;
+		quint64 m_droppedSamples;
+
+		/* Time of the anchor, and samples received by then. */
+		qint64 m_anchorTime;
+		quint64 m_anchorSamples;
+
+		/* Whether a gap is suspected, and since when. */
+		bool m_inGap;
+		qint64 m_gapTime;
+
+		qint64 m_lag;
+		qint64 m_maxLag;
+};
+
+#endif
+
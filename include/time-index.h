@@ -0,0 +1,137 @@
+/*! \file time-index.h
+ *
+ * Class keeping an index from the time of the host to the samples of
+ * a recording.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef BLDS_TIME_INDEX_H
+#define BLDS_TIME_INDEX_H
+
+#include <QtCore>
+
+#include <memory> // std::unique_ptr
+
+/*! \class TimeIndex
+ * The TimeIndex class keeps pairs of the time on the host's monotonic
+ * clock and the index of the sample received at that time, recorded
+ * periodically while recording, so that times on the wall clock can be
+ * mapped to samples of the recording.
+ *
+ * Times are kept relative to the creation of the index, at which the wall
+ * clock is read once. A time on the wall clock is mapped to the monotonic
+ * clock with that reading, and then to samples by a binary search of the
+ * pairs, interpolating between the two enclosing it. Times are therefore
+ * as accurate as the wall clock when the recording started, and the
+ * monotonic clock of the host since.
+ *
+ * The index is stored in a sidecar file next to the recording, see
+ * sidecarPath(), made of a header followed by the pairs, each a 64-bit
+ * time in nanoseconds and a 64-bit sample index, in the byte order of the
+ * machine. Sidecars of finished recordings are mapped into memory, so a
+ * lookup reads only the pairs visited by the search.
+ */
+class TimeIndex {
+
+	public:
+
+		/*! A pair of a time and a sample. */
+		struct Entry {
+			/*! Nanoseconds since the creation of the index. */
+			qint64 time;
+
+			/*! The number of samples received at that time. */
+			quint64 sample;
+		};
+
+		/*! The samples corresponding to a time. */
+		struct Samples {
+			/*! The sample received at the last indexed time before. */
+			quint64 start;
+
+			/*! The sample received at the first indexed time after. */
+			quint64 stop;
+
+			/*! The sample interpolated between them. */
+			quint64 sample;
+		};
+
+		/*! Return the path of the sidecar of a recording. */
+		static QString sidecarPath(const QString& recording);
+
+		/*! Create the sidecar of a recording, to which pairs are appended.
+		 *
+		 * The wall clock and monotonic clock are read now, and times of
+		 * pairs appended are measured from then, see elapsed().
+		 *
+		 * Throws std::runtime_error if the file cannot be created.
+		 */
+		static std::unique_ptr<TimeIndex> create(const QString& path);
+
+		/*! Open the sidecar of a finished recording, to look up times.
+		 *
+		 * Throws std::runtime_error if the file cannot be opened or mapped,
+		 * or is not a sidecar.
+		 */
+		static std::unique_ptr<TimeIndex> open(const QString& path);
+
+		/*! Close the sidecar. */
+		~TimeIndex();
+
+		/*! Copying is not allowed. */
+		TimeIndex(const TimeIndex&) = delete;
+		TimeIndex& operator=(const TimeIndex&) = delete;
+
+		/*! Return the time on the wall clock at which the index was created,
+		 * in microseconds since the epoch, in UTC.
+		 */
+		qint64 startTime() const;
+
+		/*! Return the number of pairs. */
+		quint64 size() const;
+
+		/*! Return the nanoseconds on the monotonic clock since the index
+		 * was created.
+		 */
+		qint64 elapsed() const;
+
+		/*! Append a pair, with the time measured by elapsed().
+		 *
+		 * Throws std::runtime_error if the sidecar cannot be written, and
+		 * std::logic_error if it is read-only, or the pair precedes the last.
+		 */
+		void append(qint64 time, quint64 sample);
+
+		/*! Return the samples corresponding to a time on the wall clock.
+		 *
+		 * \param time Microseconds since the epoch, in UTC.
+		 *
+		 * Before the first pair, the creation of the index, with no samples,
+		 * is taken as the pair before the time. Throws std::out_of_range if
+		 * the time is before the creation of the index or after its last pair.
+		 */
+		Samples lookup(qint64 time) const;
+
+	private:
+
+		TimeIndex(const QString& path, bool writable);
+
+		/* Return the pairs, from the mapping or those appended. */
+		const Entry *entries() const;
+
+		QFile m_file;
+		bool m_writable;
+		qint64 m_startTime;
+		QElapsedTimer m_clock;
+
+		/* Pairs of a sidecar opened for reading, mapped from the file. */
+		const Entry *m_mapped;
+		quint64 m_mappedSize;
+
+		/* Pairs appended while recording. */
+		QVector<Entry> m_appended;
+};
+
+#endif
+
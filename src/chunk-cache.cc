@@ -0,0 +1,108 @@
+/*! \file chunk-cache.cc
+ *
+ * Implementation of the cache of chunks of data read from recordings.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "chunk-cache.h"
+
+/* Return the bytes held by a chunk: its samples and their conversions. */
+static qint64 chunkBytes(const DataFrame& frame)
+{
+	return frame.payloadBytesize() + frame.convertedBytesize();
+}
+
+ChunkCache::ChunkCache(qint64 budget) :
+	m_budget(budget),
+	m_bytes(0),
+	m_hits(0),
+	m_misses(0),
+	m_insertions(0),
+	m_evictions(0)
+{
+}
+
+bool ChunkCache::find(const QString& file, quint64 start, quint64 stop,
+		DataFrame *frame)
+{
+	auto it = m_index.constFind({ file, start, stop });
+	if (it == m_index.constEnd()) {
+		m_misses++;
+		return false;
+	}
+	m_entries.splice(m_entries.begin(), m_entries, *it);
+	*frame = (*it)->frame;
+	m_hits++;
+	return true;
+}
+
+bool ChunkCache::contains(const QString& file, quint64 start, quint64 stop) const
+{
+	return m_index.contains({ file, start, stop });
+}
+
+void ChunkCache::insert(const QString& file, quint64 start, quint64 stop,
+		const DataFrame& frame)
+{
+	Key key { file, start, stop };
+	qint64 bytes = chunkBytes(frame);
+	if ((bytes > m_budget) || m_index.contains(key)) {
+		return;
+	}
+	recount();
+	evict(m_budget - bytes);
+	m_entries.push_front({ key, frame, bytes });
+	m_index.insert(key, m_entries.begin());
+	m_bytes += bytes;
+	m_insertions++;
+}
+
+void ChunkCache::remove(const QString& file)
+{
+	for (auto it = m_entries.begin(); it != m_entries.end(); ) {
+		if (it->key.file == file) {
+			m_bytes -= it->bytes;
+			m_index.remove(it->key);
+			it = m_entries.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
+void ChunkCache::recount()
+{
+	m_bytes = 0;
+	for (auto& entry : m_entries) {
+		entry.bytes = chunkBytes(entry.frame);
+		m_bytes += entry.bytes;
+	}
+}
+
+void ChunkCache::evict(qint64 bytes)
+{
+	while (!m_entries.empty() && (m_bytes > bytes)) {
+		const auto& entry = m_entries.back();
+		m_bytes -= entry.bytes;
+		m_index.remove(entry.key);
+		m_entries.pop_back();
+		m_evictions++;
+	}
+}
+
+QVariantMap ChunkCache::status() const
+{
+	auto lookups = m_hits + m_misses;
+	return QVariantMap {
+		{ "budget", m_budget },
+		{ "bytes", m_bytes },
+		{ "chunks", static_cast<quint64>(m_entries.size()) },
+		{ "hits", m_hits },
+		{ "misses", m_misses },
+		{ "hit-rate", lookups ? (static_cast<double>(m_hits) / lookups) : 0. },
+		{ "insertions", m_insertions },
+		{ "evictions", m_evictions }
+	};
+}
+
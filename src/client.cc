@@ -6,26 +6,179 @@
  */
 
 #include "client.h"
+#include "session.h"
 
 #include "libdata-source/include/configuration.h"
 #include "libdata-source/include/data-source.h" // for (de)serialization methods
 
-#include <cstring> // std::memcpy
-#include <algorithm> // std::count_if
+#include <QtConcurrent>
+
+#include <cstring> // std::memcpy, std::strerror
+#include <algorithm> // std::any_of, std::count_if, std::remove_if, std::min
+#include <iterator> // std::distance
+#include <limits>
+
+#ifdef Q_OS_UNIX
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+#ifdef Q_OS_LINUX
+#include <linux/errqueue.h>
+#include <sys/sendfile.h>
+#endif
+
+/* Zero-copy transmission requires Linux 4.14 or later. */
+#if defined(Q_OS_LINUX) && defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+#define BLDS_HAVE_ZEROCOPY
+#endif
+
+/* Interval at which pending zero-copy completions are checked,
+ * in milliseconds.
+ */
+static const int ZeroCopyReapInterval = 5;
+
+/* Type of raw export messages, which precedes their header. */
+static const QByteArray RawExportType { "export-raw\n" };
+
+/* Size of the header of a raw export message after its type. */
+static const quint32 RawExportHeaderSize = sizeof(bool) +
+		2 * sizeof(quint64) + 3 * sizeof(quint32);
+
+#ifdef Q_OS_UNIX
+/* Send part of a region of a file to a socket, returning the number of
+ * bytes sent, or -1 with errno set. The kernel copies the file straight
+ * to the socket on Linux, and the file is read into a buffer elsewhere.
+ */
+static ssize_t sendFileRegion(int socket, int file, qint64 offset, qint64 size)
+{
+#ifdef Q_OS_LINUX
+	off_t start = offset;
+	auto n = ::sendfile(socket, file, &start,
+			static_cast<size_t>(std::min<qint64>(size, 1 << 30)));
+#else
+	char buffer[64 << 10];
+	auto n = ::pread(file, buffer, std::min<qint64>(size, sizeof(buffer)), offset);
+	if (n > 0) {
+		int flags = MSG_DONTWAIT;
+#ifdef MSG_NOSIGNAL
+		flags |= MSG_NOSIGNAL;
+#endif
+		n = ::send(socket, buffer, n, flags);
+	}
+#endif
+	/* The file ending early is an error, as the size was promised. */
+	if (n == 0) {
+		errno = EIO;
+		return -1;
+	}
+	return n;
+}
+#endif
+
+/* Build a data-encoded message from the header and frame of a data message,
+ * whose samples are of the given type and layout. This runs on a worker thread.
+ */
+static QByteArray encodeDataMessage(framecodec::Encoding encoding,
+		const QByteArray& header, const DataFrame& frame, 
+		DataFrame::SampleType type, DataFrame::SampleLayout layout)
+{
+	QByteArray samples;
+	if ((type == DataFrame::SampleType::Int16) &&
+			(layout == DataFrame::SampleLayout::ChannelMajor)) {
+		samples = framecodec::encode(encoding, frame.data().memptr(),
+				frame.nsamples(), frame.nchannels());
+	} else {
+		samples = framecodec::encode(&encoding, 
+				frame.convertedPayload(type, layout));
+	}
+	QByteArray msg { "data-encoded\n" };
+	quint32 values[] = { static_cast<quint32>(encoding), 
+			static_cast<quint32>(header.size()) };
+	msg.append(reinterpret_cast<const char*>(values), sizeof(values));
+	msg.append(header);
+	quint32 decodedSize = frame.payloadBytesize(type);
+	msg.append(reinterpret_cast<const char*>(&decodedSize), sizeof(decodedSize));
+	msg.append(samples);
+	return msg;
+}
 
 Client::Client(QTcpSocket* sock, QObject* parent) :
+	Client(sock, sock->peerAddress().toString() + ":" +
+			QString::number(sock->peerPort()), sock->socketDescriptor(), parent)
+{
+	QObject::connect(sock, &QTcpSocket::disconnected,
+			this, [this]() -> void { emit disconnected(this); });
+}
+
+Client::Client(QLocalSocket* sock, QObject* parent) :
+	Client(sock, "local:" + QString::number(sock->socketDescriptor()),
+			sock->socketDescriptor(), parent)
+{
+	QObject::connect(sock, &QLocalSocket::disconnected,
+			this, [this]() -> void { emit disconnected(this); });
+}
+
+Client::Client(QIODevice* sock, const QString& address, 
+		qintptr descriptor, QObject* parent) :
 	QObject(parent),
 	m_socket(sock),
+	m_address(address),
+#ifdef Q_OS_UNIX
+	m_descriptor(descriptor),
+#else
+	m_descriptor(-1),
+#endif
 	m_stream(sock),
+	m_bulkQueueBytes(0),
+	m_encodeQueueBytes(0),
+	m_zeroCopyThreshold(0),
+	m_zeroCopyCounter(0),
+	m_transferNotifier(nullptr),
+	m_socketProfile(SocketProfile::Default),
+	m_maxSocketBulkBytes(DefaultMaxSocketBulkBytes),
+	m_maxLatency(0),
+	m_encoding(framecodec::Encoding::Raw),
+	m_sampleType(DataFrame::SampleType::Int16),
+	m_sampleLayout(DataFrame::SampleLayout::ChannelMajor),
+	m_frameSequence(0),
+	m_frameSequenceEnabled(false),
+	m_streamScheduled(false),
+	m_export { 0, 0, 0, 0, 0, 0 },
+	m_exporting(false),
 	m_requestedAllData(false)
 {
 	m_socket->setParent(this);
 	m_stream.setByteOrder(QDataStream::LittleEndian);
 	m_stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
-	QObject::connect(m_socket, &QTcpSocket::readyRead,
+	QObject::connect(m_socket, &QIODevice::readyRead,
 			this, &Client::handleReadyRead);
-	QObject::connect(m_socket, &QTcpSocket::disconnected,
-			this, [this]() -> void { emit disconnected(this); });
+	QObject::connect(m_socket, &QIODevice::bytesWritten,
+			this, &Client::handleBytesWritten);
+
+	/* Completions are queued on the socket's error queue, which raises
+	 * POLLERR rather than anything a socket notifier waits for. They are
+	 * reaped with each send, and by this timer while any are pending.
+	 */
+	m_zeroCopyTimer.setInterval(ZeroCopyReapInterval);
+	QObject::connect(&m_zeroCopyTimer, &QTimer::timeout,
+			this, &Client::reapZeroCopyCompletions);
+
+	/* Nagle's algorithm as connected, restored by the default profile. */
+	if (auto *tcp = qobject_cast<QTcpSocket*>(m_socket)) {
+		m_defaultLowDelay = tcp->socketOption(QAbstractSocket::LowDelayOption);
+	}
+	m_flushTimer.setSingleShot(true);
+	m_flushTimer.setTimerType(Qt::PreciseTimer);
+	QObject::connect(&m_flushTimer, &QTimer::timeout,
+			this, &Client::flushLiveData);
+	m_expiryTimer.setSingleShot(true);
+	m_expiryTimer.setTimerType(Qt::PreciseTimer);
+	QObject::connect(&m_expiryTimer, &QTimer::timeout,
+			this, &Client::expirePendingRequests);
 }
 
 Client::~Client()
@@ -84,8 +237,32 @@ void Client::handleMessage(quint32 size)
 		emit stopRecordingMessage(this);
 	} else if (type == "get-data") {
 		handleDataRequestMessage(size);
+	} else if (type == "get-data-samples") {
+		handleSampleDataRequestMessage(size);
 	} else if (type == "get-all-data") {
 		handleAllDataRequestMessage(size);
+	} else if (type == "cancel-data") {
+		handleCancelDataRequestMessage(size);
+	} else if (type == "set-client") {
+		handleClientSetMessage(size);
+	} else if (type == "open-session") {
+		emit openSessionMessage(this);
+	} else if (type == "resume-session") {
+		handleResumeSessionMessage(size);
+	} else if (type == "open-recording") {
+		handleOpenRecordingMessage(size);
+	} else if (type == "close-recording") {
+		emit closeRecordingMessage(this);
+	} else if (type == "get-recordings") {
+		emit getRecordingsMessage(this);
+	} else if (type == "get-envelope") {
+		handleGetEnvelopeMessage(size);
+	} else if (type == "time-to-sample") {
+		handleTimeToSampleMessage(size);
+	} else if (type == "export") {
+		handleExportMessage(size);
+	} else if (type == "export-raw") {
+		handleExportRawMessage(size);
 	} else {
 		emit messageError(this, "Unknown message type from client: " + type);
 	}
@@ -147,11 +324,34 @@ void Client::handleSourceGetMessage(quint32 size)
 	emit getSourceParamMessage(this, param);
 }
 
-void Client::handleDataRequestMessage(quint32 /* size */)
+void Client::handleDataRequestMessage(quint32 size)
 {
 	float start, stop;
+	quint32 id = 0, timeout = 0;
+	m_stream >> start >> stop;
+	if (size >= 2 * sizeof(start) + sizeof(id) + sizeof(timeout)) {
+		m_stream >> id >> timeout;
+	}
+	emit dataRequest(this, start, stop, id, timeout);
+}
+
+void Client::handleSampleDataRequestMessage(quint32 size)
+{
+	quint64 start, stop;
+	quint32 id = 0, timeout = 0;
 	m_stream >> start >> stop;
-	emit dataRequest(this, start, stop);
+	if (size >= 2 * sizeof(start) + sizeof(id) + sizeof(timeout)) {
+		m_stream >> id >> timeout;
+	}
+	emit sampleDataRequest(this, start, stop, id, timeout);
+}
+
+void Client::handleCancelDataRequestMessage(quint32 /* size */)
+{
+	quint32 id;
+	quint64 start, stop;
+	m_stream >> id >> start >> stop;
+	emit cancelDataRequest(this, id, start, stop);
 }
 
 void Client::handleAllDataRequestMessage(quint32 /* size */)
@@ -160,24 +360,95 @@ void Client::handleAllDataRequestMessage(quint32 /* size */)
 	emit allDataRequest(this, m_requestedAllData);
 }
 
+void Client::handleResumeSessionMessage(quint32 /* size */)
+{
+	auto token = m_socket->readLine();
+	token.chop(1);
+	quint64 lastSequence = 0;
+	m_stream >> lastSequence;
+	emit resumeSessionMessage(this, token, lastSequence);
+}
+
+void Client::handleOpenRecordingMessage(quint32 size)
+{
+	auto path = m_socket->read(size); // remainder of message
+	emit openRecordingMessage(this, QString::fromUtf8(path));
+}
+
+void Client::handleExportMessage(quint32 /* size */)
+{
+	quint64 start, stop;
+	quint32 firstChannel, nchannels, id;
+	m_stream >> start >> stop >> firstChannel >> nchannels >> id;
+	emit exportMessage(this, start, stop, firstChannel, nchannels, id);
+}
+
+void Client::handleGetEnvelopeMessage(quint32 /* size */)
+{
+	quint64 start, stop;
+	quint32 width, firstChannel, nchannels, id;
+	m_stream >> start >> stop >> width >> firstChannel >> nchannels >> id;
+	emit getEnvelopeMessage(this, start, stop, width, firstChannel, nchannels, id);
+}
+
+void Client::handleTimeToSampleMessage(quint32 /* size */)
+{
+	qint64 time;
+	quint32 id;
+	m_stream >> time >> id;
+	emit timeToSampleMessage(this, time, id);
+}
+
+void Client::handleExportRawMessage(quint32 /* size */)
+{
+	quint64 start, stop;
+	m_stream >> start >> stop;
+	emit exportRawMessage(this, start, stop);
+}
+
+void Client::handleClientSetMessage(quint32 size)
+{
+	auto param = m_socket->readLine();
+	size -= param.size();
+	param.chop(1);
+
+	QVariant value;
+	if (param == "socket-profile") {
+		value = m_socket->read(size); // name of the profile
+	} else if ( (param == "encoding") ||
+			(param == "sample-type") ||
+			(param == "sample-layout") ) {
+		value = m_socket->read(size); // name of the encoding, type or layout
+	} else if (param == "max-latency") {
+		quint32 val = 0;
+		m_socket->read(reinterpret_cast<char*>(&val), sizeof(val));
+		value = val;
+	} else if (param == "frame-sequence") {
+		bool val = false;
+		m_socket->read(reinterpret_cast<char*>(&val), sizeof(val));
+		value = val;
+	} else {
+		m_socket->read(size); // discard remainder of message
+		emit messageError(this, "Unknown client parameter: " + param);
+		return;
+	}
+	emit setClientParamMessage(this, param, value);
+}
+
 void Client::sendSourceCreateResponse(bool success, const QByteArray& msg)
 {
 	QByteArray buffer { "source-created\n" };
-	quint32 size = buffer.size() + sizeof(success) + msg.size();
-	m_stream << size;
-	m_stream.writeRawData(buffer.data(), buffer.size());
-	m_stream << success;
-	m_stream.writeRawData(msg.data(), msg.size());
+	buffer.append(reinterpret_cast<const char*>(&success), sizeof(success));
+	buffer.append(msg);
+	writeControl(buffer);
 }
 
 void Client::sendSourceDeleteResponse(bool success, const QByteArray& msg)
 {
 	QByteArray buffer { "source-deleted\n" };
-	quint32 size = buffer.size() + sizeof(success) + msg.size();
-	m_stream << size;
-	m_stream.writeRawData(buffer.data(), buffer.size());
-	m_stream << success;
-	m_stream.writeRawData(msg.data(), msg.size());
+	buffer.append(reinterpret_cast<const char*>(&success), sizeof(success));
+	buffer.append(msg);
+	writeControl(buffer);
 }
 
 void Client::sendServerSetResponse(const QByteArray& param, bool success, 
@@ -188,7 +459,7 @@ void Client::sendServerSetResponse(const QByteArray& param, bool success,
 	buffer.append(param);
 	buffer.append("\n");
 	buffer.append(msg);
-	m_stream << buffer;
+	writeControl(buffer);
 }
 
 void Client::sendServerGetResponse(const QByteArray& param, bool success, 
@@ -199,7 +470,7 @@ void Client::sendServerGetResponse(const QByteArray& param, bool success,
 	buffer.append(param);
 	buffer.append("\n");
 	buffer.append(encodeServerGetResponseData(param, data));
-	m_stream << buffer;
+	writeControl(buffer);
 }
 
 void Client::sendSourceSetResponse(const QByteArray& param, bool success,
@@ -210,7 +481,7 @@ void Client::sendSourceSetResponse(const QByteArray& param, bool success,
 	buffer.append(param);
 	buffer.append("\n");
 	buffer.append(msg);
-	m_stream << buffer;
+	writeControl(buffer);
 }
 
 void Client::sendSourceGetResponse(const QByteArray& param, bool success,
@@ -225,7 +496,7 @@ void Client::sendSourceGetResponse(const QByteArray& param, bool success,
 	} else {
 		buffer.append(data.toByteArray()); // error message
 	}
-	m_stream << buffer;
+	writeControl(buffer);
 }
 
 void Client::sendStartRecordingResponse(bool success, const QByteArray& msg)
@@ -233,7 +504,7 @@ void Client::sendStartRecordingResponse(bool success, const QByteArray& msg)
 	QByteArray buffer { "recording-started\n" };
 	buffer.append(reinterpret_cast<const char*>(&success), sizeof(success));
 	buffer.append(msg);
-	m_stream << buffer;
+	writeControl(buffer);
 }
 
 void Client::sendStopRecordingResponse(bool success, const QByteArray& msg)
@@ -241,17 +512,174 @@ void Client::sendStopRecordingResponse(bool success, const QByteArray& msg)
 	QByteArray buffer { "recording-stopped\n" };
 	buffer.append(reinterpret_cast<const char*>(&success), sizeof(success));
 	buffer.append(msg);
-	m_stream << buffer;
+	writeControl(buffer);
 }
 
 void Client::sendAllDataResponse(bool success, const QByteArray& msg)
 {
 	QByteArray buffer { "get-all-data\n" };
-	quint32 size = buffer.size() + sizeof(success) + msg.size();
-	m_stream << size;
-	m_stream.writeRawData(buffer.data(), buffer.size());
-	m_stream << success;
-	m_stream.writeRawData(msg.data(), msg.size());
+	buffer.append(reinterpret_cast<const char*>(&success), sizeof(success));
+	buffer.append(msg);
+	writeControl(buffer);
+}
+
+void Client::sendOpenSessionResponse(bool success, const QByteArray& msg)
+{
+	QByteArray buffer { "open-session\n" };
+	buffer.append(reinterpret_cast<const char*>(&success), sizeof(success));
+	buffer.append(msg);
+	writeControl(buffer);
+}
+
+void Client::sendResumeSessionResponse(bool success, const QByteArray& msg)
+{
+	QByteArray buffer { "resume-session\n" };
+	buffer.append(reinterpret_cast<const char*>(&success), sizeof(success));
+	buffer.append(msg);
+	writeControl(buffer);
+}
+
+void Client::sendOpenRecordingResponse(bool success, double sampleRate,
+		quint64 nsamples, quint32 nchannels, const QByteArray& msg)
+{
+	QByteArray buffer { "open-recording\n" };
+	buffer.append(reinterpret_cast<const char*>(&success), sizeof(success));
+	if (success) {
+		buffer.append(reinterpret_cast<const char*>(&sampleRate), sizeof(sampleRate));
+		buffer.append(reinterpret_cast<const char*>(&nsamples), sizeof(nsamples));
+		buffer.append(reinterpret_cast<const char*>(&nchannels), sizeof(nchannels));
+	} else {
+		buffer.append(msg);
+	}
+	writeControl(buffer);
+}
+
+void Client::sendCloseRecordingResponse(bool success, const QByteArray& msg)
+{
+	QByteArray buffer { "close-recording\n" };
+	buffer.append(reinterpret_cast<const char*>(&success), sizeof(success));
+	buffer.append(msg);
+	writeControl(buffer);
+}
+
+void Client::sendTimeToSampleResponse(bool success, quint32 id, quint64 start,
+		quint64 stop, quint64 sample, const QByteArray& msg)
+{
+	QByteArray buffer { "time-to-sample\n" };
+	buffer.append(reinterpret_cast<const char*>(&success), sizeof(success));
+	buffer.append(reinterpret_cast<const char*>(&id), sizeof(id));
+	if (success) {
+		buffer.append(reinterpret_cast<const char*>(&start), sizeof(start));
+		buffer.append(reinterpret_cast<const char*>(&stop), sizeof(stop));
+		buffer.append(reinterpret_cast<const char*>(&sample), sizeof(sample));
+	} else {
+		buffer.append(msg);
+	}
+	writeControl(buffer);
+}
+
+void Client::sendEnvelopeResponse(quint32 id,
+		const EnvelopePyramid::Envelope& envelope, float gain, float offset)
+{
+	QByteArray buffer { "get-envelope\n" };
+	bool success = true;
+	buffer.append(reinterpret_cast<const char*>(&success), sizeof(success));
+	buffer.append(reinterpret_cast<const char*>(&id), sizeof(id));
+	buffer.append(reinterpret_cast<const char*>(&envelope.start), sizeof(envelope.start));
+	buffer.append(reinterpret_cast<const char*>(&envelope.stop), sizeof(envelope.stop));
+	buffer.append(reinterpret_cast<const char*>(&envelope.binSize), sizeof(envelope.binSize));
+	buffer.append(reinterpret_cast<const char*>(&envelope.nbins), sizeof(envelope.nbins));
+	buffer.append(reinterpret_cast<const char*>(&envelope.nchannels),
+			sizeof(envelope.nchannels));
+	buffer.append(reinterpret_cast<const char*>(&gain), sizeof(gain));
+	buffer.append(reinterpret_cast<const char*>(&offset), sizeof(offset));
+	buffer.append(reinterpret_cast<const char*>(envelope.data.constData()),
+			envelope.data.size() * sizeof(qint16));
+	writeOrdered(buffer);
+}
+
+void Client::sendEnvelopeFailure(quint32 id, const QByteArray& msg)
+{
+	QByteArray buffer { "get-envelope\n" };
+	bool success = false;
+	buffer.append(reinterpret_cast<const char*>(&success), sizeof(success));
+	buffer.append(reinterpret_cast<const char*>(&id), sizeof(id));
+	buffer.append(msg);
+	writeControl(buffer);
+}
+
+void Client::sendRecordingsResponse(const QList<RecordingCatalog::Entry>& recordings)
+{
+	QByteArray buffer { "get-recordings\n" };
+	bool success = true;
+	buffer.append(reinterpret_cast<const char*>(&success), sizeof(success));
+	quint32 count = recordings.size();
+	buffer.append(reinterpret_cast<const char*>(&count), sizeof(count));
+	for (auto& recording : recordings) {
+		buffer.append(recording.name.toUtf8() + "\n");
+		buffer.append(reinterpret_cast<const char*>(&recording.size), sizeof(recording.size));
+		buffer.append(recording.created.toString(Qt::ISODate).toUtf8() + "\n");
+		buffer.append(recording.modified.toString(Qt::ISODate).toUtf8() + "\n");
+		buffer.append(reinterpret_cast<const char*>(&recording.indexed),
+				sizeof(recording.indexed));
+		buffer.append(reinterpret_cast<const char*>(&recording.sampleRate),
+				sizeof(recording.sampleRate));
+		buffer.append(reinterpret_cast<const char*>(&recording.nsamples),
+				sizeof(recording.nsamples));
+		buffer.append(reinterpret_cast<const char*>(&recording.nchannels),
+				sizeof(recording.nchannels));
+		buffer.append(recording.configurationHash + "\n");
+	}
+	writeControl(buffer);
+}
+
+void Client::sendExportResponse(bool success, quint32 id, quint64 start,
+		quint64 stop, quint32 nchannels, const QByteArray& msg)
+{
+	QByteArray buffer { "export\n" };
+	buffer.append(reinterpret_cast<const char*>(&success), sizeof(success));
+	if (success) {
+		buffer.append(reinterpret_cast<const char*>(&id), sizeof(id));
+		buffer.append(reinterpret_cast<const char*>(&start), sizeof(start));
+		buffer.append(reinterpret_cast<const char*>(&stop), sizeof(stop));
+		buffer.append(reinterpret_cast<const char*>(&nchannels), sizeof(nchannels));
+	} else {
+		buffer.append(msg);
+	}
+	writeControl(buffer);
+}
+
+void Client::sendExportRawFailure(const QByteArray& msg)
+{
+	QByteArray buffer { RawExportType };
+	bool success = false;
+	buffer.append(reinterpret_cast<const char*>(&success), sizeof(success));
+	buffer.append(msg);
+	writeControl(buffer);
+}
+
+void Client::sendCancelDataResponse(bool success, quint32 count,
+		const QByteArray& msg)
+{
+	QByteArray buffer { "cancel-data\n" };
+	buffer.append(reinterpret_cast<const char*>(&success), sizeof(success));
+	if (success) {
+		buffer.append(reinterpret_cast<const char*>(&count), sizeof(count));
+	} else {
+		buffer.append(msg);
+	}
+	writeControl(buffer);
+}
+
+void Client::sendClientSetResponse(const QByteArray& param, bool success,
+		const QByteArray& msg)
+{
+	QByteArray buffer { "set-client\n" };
+	buffer.append(reinterpret_cast<const char*>(&success), sizeof(success));
+	buffer.append(param);
+	buffer.append("\n");
+	buffer.append(msg);
+	writeControl(buffer);
 }
 
 QByteArray Client::encodeServerGetResponseData(const QByteArray& param, 
@@ -262,6 +690,8 @@ QByteArray Client::encodeServerGetResponseData(const QByteArray& param,
 			(param == "save-directory") || 
 			(param == "source-type") ||
 			(param == "source-location") ||
+			(param == "shared-memory-name") ||
+			(param == "multicast-address") ||
 			(param == "start-time") ) {
 		buffer = data.toByteArray(); // string type
 	} else if ( (param == "recording-length") ||
@@ -287,24 +717,537 @@ QByteArray Client::encodeServerGetResponseData(const QByteArray& param,
 
 void Client::sendDataFrame(const DataFrame& frame)
 {
-	QByteArray msg { "data\n" };
-	auto msgSize = msg.size();
-	quint32 totalSize = msgSize + frame.bytesize();
-	msg.resize(totalSize);
-	frame.serializeInto(msg.data() + msgSize);
-	m_stream << totalSize;
-	m_socket->write(msg);
+	sendFrame(frame, false, nextFrameSequence(frame, false));
+}
+
+void Client::sendSampleIndexedDataFrame(const DataFrame& frame)
+{
+	sendFrame(frame, true, nextFrameSequence(frame, true));
+}
+
+quint64 Client::nextFrameSequence(const DataFrame& frame, bool sampleIndexed)
+{
+	if (m_session) {
+		return m_session->record(frame, sampleIndexed);
+	}
+	return ++m_frameSequence;
+}
+
+void Client::sendFrame(const DataFrame& frame, bool sampleIndexed, quint64 sequence)
+{
+	if (sendsTypedFrames()) {
+		sendTypedDataFrame(frame, sequence);
+		return;
+	}
+	QByteArray header { sampleIndexed ? "data-samples\n" : "data\n" };
+	auto typeSize = header.size();
+	if (sampleIndexed) {
+		header.resize(typeSize + DataFrame::sampleIndexedHeaderBytesize());
+		frame.serializeSampleIndexedHeaderInto(header.data() + typeSize);
+	} else {
+		header.resize(typeSize + DataFrame::headerBytesize());
+		frame.serializeHeaderInto(header.data() + typeSize);
+	}
+	if (sendsFrameSequence()) {
+		header.append(reinterpret_cast<const char*>(&sequence), sizeof(sequence));
+	}
+	writeFrame(header, frame);
+}
+
+bool Client::sendsFrameSequence() const
+{
+	return m_frameSequenceEnabled || m_session;
+}
+
+void Client::setFrameSequence(bool enabled)
+{
+	m_frameSequenceEnabled = enabled;
+}
+
+bool Client::sendsTypedFrames() const
+{
+	return (m_sampleType != DataFrame::SampleType::Int16) ||
+		(m_sampleLayout != DataFrame::SampleLayout::ChannelMajor);
+}
+
+void Client::sendTypedDataFrame(const DataFrame& frame, quint64 sequence)
+{
+	QByteArray header { "data-typed\n" };
+	auto typeSize = header.size();
+	header.resize(typeSize + DataFrame::typedHeaderBytesize());
+	frame.serializeTypedHeaderInto(header.data() + typeSize, 
+			sequence, m_sampleType, m_sampleLayout);
+	writeFrame(header, frame, m_sampleType, m_sampleLayout);
 }
 
 void Client::sendErrorMessage(const QByteArray& msg)
 {
 	QByteArray err { "error\n" };
-	m_stream << (err + msg);
+	writeControl(err + msg);
+}
+
+void Client::writeControl(const QByteArray& msg)
+{
+	/* Nothing may be written into the middle of a raw export. */
+	if (m_transfer) {
+		m_deferredControl.append(msg);
+		return;
+	}
+
+	/* Streaming a byte array writes its size, followed by the bytes. */
+	m_stream << msg;
 }
 
-void Client::addPendingDataRequest(float start, float stop)
+void Client::writeFrame(const QByteArray& header, const DataFrame& frame,
+		DataFrame::SampleType type, DataFrame::SampleLayout layout)
 {
-	m_pendingRequests.append({ start, stop });
+	if ((m_encoding == framecodec::Encoding::Raw) && m_encodeQueue.isEmpty()) {
+		writeBulk(header, frame, type, layout);
+		return;
+	}
+
+	/* Queue the frame, behind any being encoded, so order is kept. */
+	m_encodeQueue.enqueue({ m_encoding, nullptr, header, frame, type, layout });
+	m_encodeQueueBytes += header.size() + frame.payloadBytesize(type);
+	drainEncodeQueue();
+}
+
+void Client::startEncoding()
+{
+	/* Only a few frames are encoded at once, the rest wait unencoded. */
+	int running = 0;
+	for (auto& msg : m_encodeQueue) {
+		if (running == MaxConcurrentEncodes) {
+			return;
+		}
+		if (msg.encoding == framecodec::Encoding::Raw) {
+			continue;
+		}
+		if (!msg.watcher) {
+			msg.watcher = new QFutureWatcher<QByteArray>(this);
+			QObject::connect(msg.watcher, &QFutureWatcher<QByteArray>::finished,
+					this, &Client::drainEncodeQueue);
+			msg.watcher->setFuture(QtConcurrent::run(encodeDataMessage, 
+						msg.encoding, msg.header, msg.frame, msg.type, msg.layout));
+		}
+		running++;
+	}
+}
+
+void Client::drainEncodeQueue()
+{
+	while (!m_encodeQueue.isEmpty()) {
+		auto& next = m_encodeQueue.head();
+		if (next.encoding == framecodec::Encoding::Raw) {
+			writeBulk(next.header, next.frame, next.type, next.layout);
+		} else if (next.watcher && next.watcher->isFinished()) {
+			writeBulk(next.watcher->result(), DataFrame());
+			next.watcher->deleteLater();
+		} else {
+			break;
+		}
+		m_encodeQueueBytes -= next.header.size() + next.frame.payloadBytesize(next.type);
+		m_encodeQueue.dequeue();
+	}
+	startEncoding();
+	if (readyForBulk()) {
+		scheduleStream();
+	}
+}
+
+framecodec::Encoding Client::encoding() const
+{
+	return m_encoding;
+}
+
+void Client::setEncoding(framecodec::Encoding encoding)
+{
+	m_encoding = encoding;
+}
+
+DataFrame::SampleType Client::sampleType() const
+{
+	return m_sampleType;
+}
+
+void Client::setSampleType(DataFrame::SampleType type)
+{
+	m_sampleType = type;
+}
+
+quint64 Client::framesSent() const
+{
+	return m_session ? m_session->lastSequence() : m_frameSequence;
+}
+
+std::shared_ptr<Session> Client::session() const
+{
+	return m_session;
+}
+
+void Client::openSession(std::shared_ptr<Session> session)
+{
+	m_session = session;
+}
+
+void Client::resumeSession(std::shared_ptr<Session> session, quint64 lastSequence)
+{
+	m_session = session;
+	m_session->attach();
+
+	/* Restore the options with which frames were sent, then replay
+	 * frames missed while disconnected, before any new ones.
+	 */
+	const auto& subscription = m_session->subscription();
+	m_sampleType = subscription.sampleType;
+	m_sampleLayout = subscription.sampleLayout;
+	m_encoding = subscription.encoding;
+	setMaxLatency(subscription.maxLatency);
+	for (const auto& missed : m_session->framesAfter(lastSequence)) {
+		sendFrame(missed.frame, missed.sampleIndexed, missed.sequence);
+	}
+	m_frameSequence = m_session->lastSequence();
+	for (const auto& request : subscription.pendingRequests) {
+		addPendingDataRequest(request);
+	}
+	m_requestedAllData = subscription.requestedAllData;
+}
+
+void Client::detachSession(const QList<DataRequest>& inFlight)
+{
+	if (!m_session) {
+		return;
+	}
+
+	/* Record any held frames without sending them, to be replayed. */
+	m_flushTimer.stop();
+	if (!m_liveFrames.isEmpty()) {
+		m_session->record(DataFrame::concatenate(m_liveFrames), false);
+		m_liveFrames.clear();
+	}
+	/* The rest of any streamed requests is sent again as a whole, as are
+	 * requests being read. Exports do not outlive the connection.
+	 */
+	auto pending = m_pendingRequests + inFlight;
+	for (const auto& request : m_streamedRequests) {
+		if (!request.exported) {
+			pending.append(request);
+		}
+	}
+	m_exporting = false;
+	m_session->detach({ m_requestedAllData, pending, m_sampleType,
+			m_sampleLayout, m_encoding, m_maxLatency });
+	m_session.reset();
+}
+
+DataFrame::SampleLayout Client::sampleLayout() const
+{
+	return m_sampleLayout;
+}
+
+void Client::setSampleLayout(DataFrame::SampleLayout layout)
+{
+	m_sampleLayout = layout;
+}
+
+void Client::writeBulk(const QByteArray& header, const DataFrame& frame,
+		DataFrame::SampleType type, DataFrame::SampleLayout layout)
+{
+	/* Prefix the header with the size of the full message. */
+	auto payload = frame.convertedPayload(type, layout);
+	quint32 size = qToLittleEndian<quint32>(header.size() + payload.size());
+	BulkMessage msg { QByteArray(reinterpret_cast<const char*>(&size), 
+			sizeof(size)) + header, frame, payload };
+
+	if (m_bulkQueue.isEmpty() && !m_transfer &&
+			(m_socket->bytesToWrite() < m_maxSocketBulkBytes)) {
+		transmitBulk(msg);
+	} else {
+		m_bulkQueueBytes += msg.header.size() + msg.payload.size();
+		m_bulkQueue.enqueue(msg);
+	}
+}
+
+void Client::handleBytesWritten()
+{
+	if (!m_zeroCopyPending.isEmpty()) {
+		reapZeroCopyCompletions();
+	}
+	while (!m_bulkQueue.isEmpty() && !m_transfer &&
+			(m_socket->bytesToWrite() < m_maxSocketBulkBytes)) {
+
+		/* Raw exports start once everything before them is written. */
+		if (m_bulkQueue.head().transfer && (m_socket->bytesToWrite() > 0)) {
+			break;
+		}
+		auto msg = m_bulkQueue.dequeue();
+		m_bulkQueueBytes -= msg.header.size() + msg.payload.size();
+		transmitBulk(msg);
+	}
+	if (readyForBulk()) {
+		scheduleStream();
+	}
+}
+
+void Client::transmitBulk(const BulkMessage& msg)
+{
+	if (msg.transfer) {
+		m_transfer = std::make_shared<BulkMessage>(msg);
+		continueTransfer();
+		return;
+	}
+
+	/* Write directly to the socket only if nothing is buffered in
+	 * front of this message, and buffer whatever could not be written.
+	 */
+	qint64 written = 0;
+	if ((m_descriptor != -1) && (m_socket->bytesToWrite() == 0)) {
+		written = writeDirect(msg);
+	}
+
+	qint64 headerSize = msg.header.size();
+	qint64 payloadSize = msg.payload.size();
+	if (written < headerSize) {
+		m_socket->write(msg.header.constData() + written, headerSize - written);
+		written = headerSize;
+	}
+	if (written < headerSize + payloadSize) {
+		auto offset = written - headerSize;
+		m_socket->write(msg.payload.constData() + offset, payloadSize - offset);
+	}
+}
+
+qint64 Client::writeDirect(const BulkMessage& msg)
+{
+#ifdef Q_OS_UNIX
+	struct iovec iov[2];
+	iov[0].iov_base = const_cast<char*>(msg.header.constData());
+	iov[0].iov_len = msg.header.size();
+	iov[1].iov_base = const_cast<char*>(msg.payload.constData());
+	iov[1].iov_len = msg.payload.size();
+
+	struct msghdr hdr;
+	std::memset(&hdr, 0, sizeof(hdr));
+	hdr.msg_iov = iov;
+	hdr.msg_iovlen = (iov[1].iov_len > 0) ? 2 : 1;
+
+	int flags = MSG_DONTWAIT;
+#ifdef MSG_NOSIGNAL
+	flags |= MSG_NOSIGNAL;
+#endif
+	bool zeroCopy = false;
+#ifdef BLDS_HAVE_ZEROCOPY
+	if (m_zeroCopyThreshold > 0) {
+		reapZeroCopyCompletions();
+		if (static_cast<qint64>(iov[1].iov_len) >= m_zeroCopyThreshold) {
+			zeroCopy = true;
+			flags |= MSG_ZEROCOPY;
+		}
+	}
+#endif
+
+	ssize_t n;
+	do {
+		n = ::sendmsg(m_descriptor, &hdr, flags);
+	} while ((n == -1) && (errno == EINTR));
+
+	/* On any error, e.g., a full socket, fall back to the socket's own
+	 * buffer. Fatal errors are reported by the socket itself.
+	 */
+	if (n == -1) {
+		return 0;
+	}
+	if (zeroCopy) {
+		m_zeroCopyPending.append(qMakePair(m_zeroCopyCounter++, msg));
+		if (!m_zeroCopyTimer.isActive()) {
+			m_zeroCopyTimer.start();
+		}
+	}
+	return n;
+#else
+	Q_UNUSED(msg);
+	return 0;
+#endif
+}
+
+void Client::setZeroCopyThreshold(qint64 bytes)
+{
+#ifdef BLDS_HAVE_ZEROCOPY
+	auto *tcp = qobject_cast<QTcpSocket*>(m_socket);
+	if ((bytes > 0) && tcp && (m_descriptor != -1)) {
+		int one = 1;
+		if (::setsockopt(m_descriptor, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0) {
+			m_zeroCopyThreshold = bytes;
+			return;
+		}
+		qWarning().noquote() << "Zero-copy transmission is not supported for client at"
+			<< address();
+	}
+	m_zeroCopyThreshold = 0;
+#else
+	if (bytes > 0) {
+		qWarning("Zero-copy transmission is not supported on this platform.");
+	}
+	m_zeroCopyThreshold = 0;
+#endif
+}
+
+void Client::reapZeroCopyCompletions()
+{
+#ifdef BLDS_HAVE_ZEROCOPY
+	char control[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+	while (true) {
+		struct msghdr msg;
+		std::memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (::recvmsg(m_descriptor, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+			break;
+		}
+
+		for (auto *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (!(((cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == IP_RECVERR)) ||
+					((cmsg->cmsg_level == SOL_IPV6) && (cmsg->cmsg_type == IPV6_RECVERR)))) {
+				continue;
+			}
+			auto *err = reinterpret_cast<struct sock_extended_err*>(CMSG_DATA(cmsg));
+			if ((err->ee_errno != 0) || (err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)) {
+				continue;
+			}
+
+			/* The kernel has finished with sends in [ee_info, ee_data]. */
+			quint32 first = err->ee_info, last = err->ee_data;
+			auto done = std::remove_if(m_zeroCopyPending.begin(), m_zeroCopyPending.end(),
+					[first, last](const QPair<quint32, BulkMessage>& pending) -> bool {
+						return (pending.first - first) <= (last - first);
+					});
+			m_zeroCopyPending.erase(done, m_zeroCopyPending.end());
+		}
+	}
+#endif
+	if (m_zeroCopyPending.isEmpty()) {
+		m_zeroCopyTimer.stop();
+	}
+}
+
+bool Client::canSendFiles() const
+{
+	return m_descriptor != -1;
+}
+
+quint64 Client::maxRawExportBytes()
+{
+	return std::numeric_limits<quint32>::max() - RawExportType.size() -
+		RawExportHeaderSize;
+}
+
+void Client::sendRawExport(quint64 start, quint64 stop, quint32 nchannels,
+		DataFrame::SampleLayout layout, std::shared_ptr<QFile> file,
+		const QList<QPair<qint64, qint64>>& regions)
+{
+	qint64 payloadSize = 0;
+	for (const auto& region : regions) {
+		payloadSize += region.second;
+	}
+	quint32 size = qToLittleEndian<quint32>(
+			RawExportType.size() + RawExportHeaderSize + payloadSize);
+	bool success = true;
+	quint32 values[] = { static_cast<quint32>(stop - start), nchannels,
+			static_cast<quint32>(layout) };
+	QByteArray header;
+	header.append(reinterpret_cast<const char*>(&size), sizeof(size));
+	header.append(RawExportType);
+	header.append(reinterpret_cast<const char*>(&success), sizeof(success));
+	header.append(reinterpret_cast<const char*>(&start), sizeof(start));
+	header.append(reinterpret_cast<const char*>(&stop), sizeof(stop));
+	header.append(reinterpret_cast<const char*>(values), sizeof(values));
+
+	/* Queue the export behind any frames, and start it if there are none. */
+	BulkMessage msg { header, DataFrame(), QByteArray(),
+			std::make_shared<FileTransfer>(FileTransfer { file, regions }) };
+	m_bulkQueueBytes += msg.header.size();
+	m_bulkQueue.enqueue(msg);
+	handleBytesWritten();
+}
+
+void Client::continueTransfer()
+{
+#ifdef Q_OS_UNIX
+	if (m_transferNotifier) {
+		m_transferNotifier->setEnabled(false);
+	}
+	int flags = MSG_DONTWAIT;
+#ifdef MSG_NOSIGNAL
+	flags |= MSG_NOSIGNAL;
+#endif
+	auto& header = m_transfer->header;
+	auto& regions = m_transfer->transfer->regions;
+	auto handle = m_transfer->transfer->file->handle();
+	while (!header.isEmpty() || !regions.isEmpty()) {
+		ssize_t n;
+		if (!header.isEmpty()) {
+			n = ::send(m_descriptor, header.constData(), header.size(), flags);
+		} else {
+			n = sendFileRegion(m_descriptor, handle,
+					regions.first().first, regions.first().second);
+		}
+
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+				if (!m_transferNotifier) {
+					m_transferNotifier = new QSocketNotifier(m_descriptor,
+							QSocketNotifier::Write, this);
+					QObject::connect(m_transferNotifier, &QSocketNotifier::activated,
+							this, &Client::continueTransfer);
+				}
+				m_transferNotifier->setEnabled(true);
+				return;
+			}
+
+			/* The message cannot be completed, so nothing more can be
+			 * sent on this connection.
+			 */
+			qWarning().noquote() << "Could not send raw export to client at"
+				<< address() << ":" << std::strerror(errno);
+			m_transfer.reset();
+			m_deferredControl.clear();
+			m_socket->close();
+			return;
+		}
+
+		if (!header.isEmpty()) {
+			header.remove(0, n);
+		} else {
+			auto& region = regions.first();
+			region.first += n;
+			region.second -= n;
+			if (region.second == 0) {
+				regions.removeFirst();
+			}
+		}
+	}
+#endif
+
+	/* Write what waited for the export, then resume sending frames. */
+	m_transfer.reset();
+	for (const auto& msg : m_deferredControl) {
+		m_stream << msg;
+	}
+	m_deferredControl.clear();
+	handleBytesWritten();
+}
+
+qint64 Client::queuedBulkBytes() const
+{
+	return m_bulkQueueBytes + m_encodeQueueBytes;
+}
+
+void Client::addPendingDataRequest(const DataRequest& request)
+{
+	m_pendingRequests.append(request);
 
 	/* Keep elements sorted by end time of the request, so
 	 * that requests that complete first are serviced first.
@@ -312,13 +1255,304 @@ void Client::addPendingDataRequest(float start, float stop)
 	std::sort(m_pendingRequests.begin(), m_pendingRequests.end(),
 			[](const Client::DataRequest& first, 
 				const Client::DataRequest& second) -> bool {
-					return first.stop < second.stop;
+					return first.stopSample < second.stopSample;
 			});
+	if (request.deadline) {
+		expirePendingRequests();
+	}
+}
+
+qint64 Client::deadlineAfter(quint32 timeout)
+{
+	if (timeout == 0) {
+		return 0;
+	}
+	QElapsedTimer clock;
+	clock.start();
+	return clock.msecsSinceReference() + timeout;
+}
+
+void Client::expirePendingRequests()
+{
+	QElapsedTimer clock;
+	clock.start();
+	auto now = clock.msecsSinceReference();
+
+	qint64 next = 0;
+	auto it = m_pendingRequests.begin();
+	while (it != m_pendingRequests.end()) {
+		if (it->deadline == 0) {
+			++it;
+		} else if (it->deadline <= now) {
+			sendErrorMessage(QString("Request %1 for samples [%2, %3) expired "
+						"before the data was available.").arg(it->id).arg(
+						it->startSample).arg(it->stopSample).toUtf8());
+			it = m_pendingRequests.erase(it);
+		} else {
+			next = next ? qMin(next, it->deadline) : it->deadline;
+			++it;
+		}
+	}
+
+	if (next) {
+		m_expiryTimer.start(static_cast<int>(next - now));
+	} else {
+		m_expiryTimer.stop();
+	}
+}
+
+int Client::cancelPendingRequests(quint32 id, quint64 start, quint64 stop)
+{
+	auto matches = [id, start, stop](const Client::DataRequest& request) -> bool {
+		if (id) {
+			return request.id == id;
+		}
+		return (request.startSample < stop) && (request.stopSample > start);
+	};
+	int count = 0;
+	QList<QList<DataRequest>*> lists { &m_pendingRequests, &m_streamedRequests };
+	for (auto *requests : lists) {
+		if (std::any_of(requests->begin(), requests->end(),
+					[&matches](const DataRequest& request) -> bool {
+						return request.exported && matches(request);
+					})) {
+			abortExport();
+		}
+		auto cancelled = std::remove_if(requests->begin(), requests->end(), matches);
+		count += std::distance(cancelled, requests->end());
+		requests->erase(cancelled, requests->end());
+	}
+	return count;
+}
+
+void Client::addStreamedRequest(const DataRequest& request)
+{
+	m_streamedRequests.enqueue(request);
+	scheduleStream();
+}
+
+bool Client::hasStreamedRequests() const
+{
+	return !m_streamedRequests.isEmpty();
+}
+
+int Client::countStreamedRequests() const
+{
+	return std::count_if(m_streamedRequests.begin(), m_streamedRequests.end(),
+			[](const DataRequest& request) -> bool { return !request.exported; });
+}
+
+Client::DataRequest Client::takeStreamedPiece(quint64 maxSamples)
+{
+	auto& request = m_streamedRequests.head();
+	if (request.stopSample - request.startSample <= maxSamples) {
+		return m_streamedRequests.dequeue();
+	}
+	auto piece = request;
+	piece.stopSample = request.startSample + maxSamples;
+	request.startSample = piece.stopSample;
+	return piece;
+}
+
+void Client::dropStreamedRequest(const DataRequest& piece)
+{
+	if (m_streamedRequests.isEmpty()) {
+		return;
+	}
+	const auto& rest = m_streamedRequests.head();
+	if ((rest.id == piece.id) && (rest.startSample == piece.stopSample) &&
+			(rest.sampleIndexed == piece.sampleIndexed)) {
+		m_streamedRequests.dequeue();
+	}
+}
+
+void Client::clearStreamedRequests()
+{
+	m_streamedRequests.clear();
+}
+
+bool Client::readyForBulk() const
+{
+	return m_bulkQueue.isEmpty() && m_encodeQueue.isEmpty() && !m_transfer &&
+		(m_socket->bytesToWrite() < m_maxSocketBulkBytes);
+}
+
+void Client::scheduleStream()
+{
+	if (m_streamScheduled || m_streamedRequests.isEmpty()) {
+		return;
+	}
+	m_streamScheduled = true;
+	QTimer::singleShot(0, this, [this]() -> void {
+		m_streamScheduled = false;
+		if (!m_streamedRequests.isEmpty()) {
+			emit streamReady(this);
+		}
+	});
+}
+
+bool Client::isExporting() const
+{
+	return m_exporting;
+}
+
+void Client::startExport(quint32 id, quint64 start, quint64 stop,
+		quint32 firstChannel, quint32 nchannels)
+{
+	m_export = { id, start, stop, start, firstChannel, nchannels };
+	m_exporting = true;
+	m_exportProgressAge.start();
+	addStreamedRequest({ 0., 0., start, stop, true, id, 0, true });
+}
+
+void Client::sendExportedFrame(const DataFrame& frame)
+{
+	if (!m_exporting || (frame.startSample() != m_export.next)) {
+		return;
+	}
+	sendSampleIndexedDataFrame(frame.channels(m_export.firstChannel, m_export.nchannels));
+	m_export.next = frame.stopSample();
+	bool done = (m_export.next >= m_export.stop);
+	if (done || (m_exportProgressAge.elapsed() >= ExportProgressInterval)) {
+		sendExportProgress();
+	}
+	if (done) {
+		m_exporting = false;
+	}
+}
+
+void Client::abortExport()
+{
+	m_exporting = false;
+}
+
+void Client::sendExportProgress()
+{
+	QByteArray msg { "export-progress\n" };
+	quint64 sent = m_export.next - m_export.start;
+	quint64 total = m_export.stop - m_export.start;
+	msg.append(reinterpret_cast<const char*>(&m_export.id), sizeof(m_export.id));
+	msg.append(reinterpret_cast<const char*>(&sent), sizeof(sent));
+	msg.append(reinterpret_cast<const char*>(&total), sizeof(total));
+	writeOrdered(msg);
+	m_exportProgressAge.start();
+}
+
+void Client::writeOrdered(const QByteArray& msg)
+{
+	/* Messages queued for encoding without a watcher are written as
+	 * they are, in their place among the frames.
+	 */
+	if (m_encodeQueue.isEmpty()) {
+		writeBulk(msg, DataFrame());
+	} else {
+		m_encodeQueue.enqueue({ framecodec::Encoding::Raw, nullptr, msg, DataFrame(),
+				DataFrame::SampleType::Int16, DataFrame::SampleLayout::ChannelMajor });
+		m_encodeQueueBytes += msg.size();
+	}
 }
 
 void Client::setRequestedAllData(bool requested)
 {
 	m_requestedAllData = requested;
+	if (!requested) {
+		flushLiveData();
+	}
+}
+
+Client::SocketProfile Client::socketProfile() const
+{
+	return m_socketProfile;
+}
+
+void Client::setSocketProfile(SocketProfile profile)
+{
+	auto *tcp = qobject_cast<QTcpSocket*>(m_socket);
+	switch (profile) {
+		case SocketProfile::Default:
+			/* Buffer sizes, once set, can't be returned to the system's
+			 * automatic tuning, so are left as they are.
+			 */
+			if (tcp && m_defaultLowDelay.isValid()) {
+				tcp->setSocketOption(QAbstractSocket::LowDelayOption,
+						m_defaultLowDelay);
+			}
+			m_maxSocketBulkBytes = DefaultMaxSocketBulkBytes;
+			setMaxLatency(0);
+			break;
+		case SocketProfile::Latency:
+			if (tcp) {
+				tcp->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+				tcp->setSocketOption(QAbstractSocket::SendBufferSizeSocketOption,
+						LatencySendBufferSize);
+			}
+			m_maxSocketBulkBytes = LatencyMaxSocketBulkBytes;
+			setMaxLatency(0);
+			break;
+		case SocketProfile::Throughput:
+			if (tcp) {
+				tcp->setSocketOption(QAbstractSocket::LowDelayOption, 0);
+				tcp->setSocketOption(QAbstractSocket::SendBufferSizeSocketOption,
+						ThroughputSocketBufferSize);
+				tcp->setSocketOption(QAbstractSocket::ReceiveBufferSizeSocketOption,
+						ThroughputSocketBufferSize);
+			}
+			m_maxSocketBulkBytes = ThroughputMaxSocketBulkBytes;
+			setMaxLatency(ThroughputMaxLatency);
+			break;
+	}
+	m_socketProfile = profile;
+}
+
+quint32 Client::maxLatency() const
+{
+	return m_maxLatency;
+}
+
+void Client::setMaxLatency(quint32 ms)
+{
+	m_maxLatency = ms;
+	flushLiveData();
+}
+
+void Client::sendLiveDataFrame(const DataFrame& frame)
+{
+	if (m_maxLatency == 0) {
+		sendDataFrame(frame);
+		return;
+	}
+
+	/* Only coalesce frames which directly follow one another. */
+	if (!m_liveFrames.isEmpty() &&
+			((m_liveFrames.last().stopSample() != frame.startSample()) ||
+			(m_liveFrames.last().nchannels() != frame.nchannels()))) {
+		flushLiveData();
+	}
+
+	/* Start the deadline with the first held frame. */
+	if (m_liveFrames.isEmpty()) {
+		m_liveFramesAge.start();
+		m_flushTimer.start(m_maxLatency);
+	}
+	m_liveFrames.append(frame);
+
+	/* Send now if waiting for another frame of the same duration
+	 * would hold the first past the deadline.
+	 */
+	auto interval = static_cast<qint64>(1000 * (frame.stop() - frame.start()));
+	if (m_liveFramesAge.elapsed() + interval >= m_maxLatency) {
+		flushLiveData();
+	}
+}
+
+void Client::flushLiveData()
+{
+	m_flushTimer.stop();
+	if (m_liveFrames.isEmpty()) {
+		return;
+	}
+	sendDataFrame(DataFrame::concatenate(m_liveFrames));
+	m_liveFrames.clear();
 }
 
 bool Client::requestedAllData() const
@@ -336,11 +1570,11 @@ int Client::countPendingRequests() const
 	return m_pendingRequests.size();
 }
 
-int Client::numServicableRequests(float time) const
+int Client::numServicableRequests(quint64 nsamples) const
 {
 	return std::count_if(m_pendingRequests.begin(), m_pendingRequests.end(),
-			[time](const Client::DataRequest& req) -> bool { 
-				return req.stop <= time;
+			[nsamples](const Client::DataRequest& req) -> bool { 
+				return req.stopSample <= nsamples;
 			});
 }
 
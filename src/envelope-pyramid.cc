@@ -0,0 +1,290 @@
+/*! \file envelope-pyramid.cc
+ *
+ * Implementation of the pyramid of minimum and maximum envelopes.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "envelope-pyramid.h"
+#include "sample-kernels.h"
+
+#include <algorithm> // std::min, std::max, std::fill, std::copy
+#include <cstring> // std::memcpy
+#include <limits>
+#include <stdexcept>
+
+/* Identifies a sidecar, and the version of its layout. */
+static const char Magic[8] = { 'B', 'L', 'D', 'S', 'E', 'N', 'V', 'L' };
+static const quint32 Version = 1;
+
+/* Size of the header before the number of bins of each level: the magic,
+ * version, number of channels, bin size, number of levels and capacity.
+ */
+static const qint64 FixedHeaderSize = sizeof(Magic) + 4 * sizeof(quint32) + sizeof(quint64);
+
+QString EnvelopePyramid::sidecarPath(const QString& recording)
+{
+	return recording + ".envelope";
+}
+
+EnvelopePyramid::EnvelopePyramid(const QString& path, bool writable) :
+	m_file(path),
+	m_writable(writable),
+	m_nchannels(0),
+	m_binSize(0),
+	m_capacity(0),
+	m_nlevels(0)
+{
+}
+
+std::unique_ptr<EnvelopePyramid> EnvelopePyramid::create(const QString& path,
+		quint32 nchannels, quint32 binSize, quint64 capacity)
+{
+	if ((nchannels == 0) || (binSize == 0) || (capacity < binSize)) {
+		throw std::runtime_error("The recording is too short to be summarized.");
+	}
+	std::unique_ptr<EnvelopePyramid> pyramid { new EnvelopePyramid(path, true) };
+	if (!pyramid->m_file.open(QIODevice::ReadWrite | QIODevice::Truncate)) {
+		throw std::runtime_error(QString("Could not create envelope sidecar %1: %2").arg(
+					path, pyramid->m_file.errorString()).toStdString());
+	}
+	pyramid->m_nchannels = nchannels;
+	pyramid->m_binSize = binSize;
+	pyramid->m_capacity = capacity;
+
+	/* Add levels for as long as the next still holds a bin. */
+	pyramid->m_nlevels = 1;
+	quint64 size = binSize;
+	while ((pyramid->m_nlevels < MaxLevels) && (capacity / (size * LevelFactor) > 0)) {
+		size *= LevelFactor;
+		pyramid->m_nlevels++;
+	}
+	pyramid->layout();
+	pyramid->m_pending.fill(QVector<qint16>(2 * nchannels), pyramid->m_nlevels);
+	pyramid->m_pendingCount.fill(0, pyramid->m_nlevels);
+	pyramid->writeHeader();
+	return pyramid;
+}
+
+std::unique_ptr<EnvelopePyramid> EnvelopePyramid::open(const QString& path)
+{
+	std::unique_ptr<EnvelopePyramid> pyramid { new EnvelopePyramid(path, false) };
+	if (!pyramid->m_file.open(QIODevice::ReadOnly)) {
+		throw std::runtime_error(QString("Could not open envelope sidecar %1: %2").arg(
+					path, pyramid->m_file.errorString()).toStdString());
+	}
+	auto header = pyramid->m_file.read(FixedHeaderSize);
+	if ((header.size() != FixedHeaderSize) ||
+			std::memcmp(header.constData(), Magic, sizeof(Magic))) {
+		throw std::runtime_error("The envelope sidecar is invalid.");
+	}
+	quint32 fields[4];
+	std::memcpy(fields, header.constData() + sizeof(Magic), sizeof(fields));
+	std::memcpy(&pyramid->m_capacity, header.constData() + sizeof(Magic) + sizeof(fields),
+			sizeof(pyramid->m_capacity));
+	pyramid->m_nchannels = fields[1];
+	pyramid->m_binSize = fields[2];
+	pyramid->m_nlevels = static_cast<int>(fields[3]);
+	if ((fields[0] != Version) || (pyramid->m_nchannels == 0) ||
+			(pyramid->m_binSize == 0) || (fields[3] == 0) ||
+			(fields[3] > static_cast<quint32>(MaxLevels))) {
+		throw std::runtime_error("The envelope sidecar is invalid or of an unknown version.");
+	}
+	pyramid->layout();
+
+	auto counts = pyramid->m_file.read(pyramid->m_nlevels * sizeof(quint64));
+	if (counts.size() != static_cast<int>(pyramid->m_nlevels * sizeof(quint64))) {
+		throw std::runtime_error("The envelope sidecar is invalid.");
+	}
+	std::memcpy(pyramid->m_bins.data(), counts.constData(), counts.size());
+	for (int level = 0; level < pyramid->m_nlevels; level++) {
+		pyramid->m_bins[level] = std::min(pyramid->m_bins[level],
+				pyramid->m_capacities[level]);
+	}
+	return pyramid;
+}
+
+EnvelopePyramid::~EnvelopePyramid()
+{
+	if (m_writable && m_file.isOpen()) {
+		try {
+			writeHeader();
+		} catch (std::runtime_error& e) {
+			qWarning().noquote() << e.what();
+		}
+	}
+}
+
+quint32 EnvelopePyramid::nchannels() const
+{
+	return m_nchannels;
+}
+
+int EnvelopePyramid::nlevels() const
+{
+	return m_nlevels;
+}
+
+quint64 EnvelopePyramid::nsamples() const
+{
+	return m_bins.isEmpty() ? 0 : m_bins[0] * m_binSize;
+}
+
+qint64 EnvelopePyramid::headerSize() const
+{
+	return FixedHeaderSize + m_nlevels * sizeof(quint64);
+}
+
+qint64 EnvelopePyramid::binBytes() const
+{
+	return 2 * m_nchannels * sizeof(qint16);
+}
+
+void EnvelopePyramid::layout()
+{
+	m_offsets.resize(m_nlevels);
+	m_capacities.resize(m_nlevels);
+	m_bins.fill(0, m_nlevels);
+	qint64 offset = headerSize();
+	quint64 size = m_binSize;
+	for (int level = 0; level < m_nlevels; level++) {
+		m_offsets[level] = offset;
+		m_capacities[level] = m_capacity / size;
+		offset += m_capacities[level] * binBytes();
+		size *= LevelFactor;
+	}
+}
+
+void EnvelopePyramid::writeHeader()
+{
+	QByteArray header(Magic, sizeof(Magic));
+	quint32 fields[4] = { Version, m_nchannels, m_binSize,
+		static_cast<quint32>(m_nlevels) };
+	header.append(reinterpret_cast<const char*>(fields), sizeof(fields));
+	header.append(reinterpret_cast<const char*>(&m_capacity), sizeof(m_capacity));
+	header.append(reinterpret_cast<const char*>(m_bins.constData()),
+			m_nlevels * sizeof(quint64));
+	if (!m_file.seek(0) || (m_file.write(header) != header.size())) {
+		throw std::runtime_error(QString("Could not write envelope sidecar %1: %2").arg(
+					m_file.fileName(), m_file.errorString()).toStdString());
+	}
+}
+
+void EnvelopePyramid::flush()
+{
+	writeHeader();
+	m_file.flush();
+}
+
+void EnvelopePyramid::append(const DataFrame::Samples& samples)
+{
+	if (!m_writable) {
+		throw std::logic_error("The envelope sidecar is read-only.");
+	}
+	if (samples.n_cols != m_nchannels) {
+		throw std::logic_error("The samples do not have the channels of the envelope.");
+	}
+
+	auto *min = m_pending[0].data();
+	auto *max = min + m_nchannels;
+	quint64 nsamples = samples.n_rows, offset = 0;
+	while ((offset < nsamples) && (m_bins[0] < m_capacities[0])) {
+		if (m_pendingCount[0] == 0) {
+			std::fill(min, min + m_nchannels, std::numeric_limits<qint16>::max());
+			std::fill(max, max + m_nchannels, std::numeric_limits<qint16>::min());
+		}
+		auto count = std::min<quint64>(nsamples - offset, m_binSize - m_pendingCount[0]);
+		for (quint32 channel = 0; channel < m_nchannels; channel++) {
+			samplekernels::minMax(samples.colptr(channel) + offset, count,
+					min + channel, max + channel);
+		}
+		m_pendingCount[0] += count;
+		offset += count;
+		if (m_pendingCount[0] == m_binSize) {
+			completeBin(0);
+		}
+	}
+}
+
+void EnvelopePyramid::completeBin(int level)
+{
+	const auto& bin = m_pending[level];
+	if (m_bins[level] < m_capacities[level]) {
+		if (!m_file.seek(m_offsets[level] + m_bins[level] * binBytes()) ||
+				(m_file.write(reinterpret_cast<const char*>(bin.constData()),
+					binBytes()) != binBytes())) {
+			throw std::runtime_error(QString("Could not write envelope sidecar %1: %2").arg(
+						m_file.fileName(), m_file.errorString()).toStdString());
+		}
+		m_bins[level]++;
+	}
+	m_pendingCount[level] = 0;
+	if (level + 1 == m_nlevels) {
+		return;
+	}
+
+	/* Copied rather than shared, as bins are accumulated in place. */
+	auto& next = m_pending[level + 1];
+	if (m_pendingCount[level + 1] == 0) {
+		std::copy(bin.constBegin(), bin.constEnd(), next.begin());
+	} else {
+		for (quint32 i = 0; i < m_nchannels; i++) {
+			next[i] = std::min(next[i], bin[i]);
+			next[m_nchannels + i] = std::max(next[m_nchannels + i], bin[m_nchannels + i]);
+		}
+	}
+	if (++m_pendingCount[level + 1] == LevelFactor) {
+		completeBin(level + 1);
+	}
+}
+
+EnvelopePyramid::Envelope EnvelopePyramid::envelope(quint64 start, quint64 stop,
+		quint32 width, quint32 firstChannel, quint32 nchannels)
+{
+	if ((start >= stop) || (width == 0) || (width > MaxWidth) || (nchannels == 0) ||
+			(static_cast<quint64>(firstChannel) + nchannels > m_nchannels)) {
+		throw std::logic_error("The requested envelope is invalid.");
+	}
+	if (m_writable) {
+		m_file.flush();
+	}
+
+	/* The coarsest level with at least width bins over the stretch. */
+	int level = 0;
+	quint64 size = m_binSize;
+	while ((level + 1 < m_nlevels) && ((stop - start) / (size * LevelFactor) >= width)) {
+		size *= LevelFactor;
+		level++;
+	}
+
+	auto first = start / size;
+	auto last = std::min((stop + size - 1) / size, m_bins[level]);
+	Envelope envelope { first * size, first * size, size, 0, nchannels, {} };
+	if (first >= last) {
+		return envelope;
+	}
+	envelope.nbins = static_cast<quint32>(last - first);
+	envelope.stop = last * size;
+
+	auto bytes = envelope.nbins * binBytes();
+	QByteArray bins;
+	if (m_file.seek(m_offsets[level] + first * binBytes())) {
+		bins = m_file.read(bytes);
+	}
+	if (bins.size() != bytes) {
+		throw std::runtime_error(QString("Could not read envelope sidecar %1: %2").arg(
+					m_file.fileName(), m_file.errorString()).toStdString());
+	}
+
+	/* Keep the minima, then the maxima, of the requested channels. */
+	envelope.data.resize(2 * envelope.nbins * nchannels);
+	auto *in = reinterpret_cast<const qint16*>(bins.constData()) + firstChannel;
+	auto *out = envelope.data.data();
+	for (quint32 i = 0; i < 2 * envelope.nbins; i++) {
+		std::memcpy(out, in, nchannels * sizeof(qint16));
+		in += m_nchannels;
+		out += nchannels;
+	}
+	return envelope;
+}
+
@@ -0,0 +1,181 @@
+/*! \file frame-codec.cc
+ *
+ * Implementation of compressed encodings of data frames.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "frame-codec.h"
+
+#include <algorithm> // std::min
+
+namespace framecodec {
+
+/* Compression level used for the deflate encoding, the fastest. */
+static const int DeflateLevel = 1;
+
+Encoding fromName(const QByteArray& name, bool *ok)
+{
+	*ok = true;
+	if (name == "raw") {
+		return Encoding::Raw;
+	} else if (name == "deflate") {
+		return Encoding::Deflate;
+	} else if (name == "delta-bitpack") {
+		return Encoding::DeltaBitpack;
+	}
+	*ok = false;
+	return Encoding::Raw;
+}
+
+QByteArray name(Encoding encoding)
+{
+	switch (encoding) {
+		case Encoding::Deflate:
+			return "deflate";
+		case Encoding::DeltaBitpack:
+			return "delta-bitpack";
+		default:
+			return "raw";
+	}
+}
+
+QByteArray encode(Encoding encoding, const qint16 *samples,
+		quint32 nsamples, quint32 nchannels)
+{
+	auto size = static_cast<int>(sizeof(qint16) * nsamples * nchannels);
+	switch (encoding) {
+		case Encoding::Deflate:
+			return qCompress(reinterpret_cast<const uchar*>(samples), 
+					size, DeflateLevel);
+		case Encoding::DeltaBitpack:
+			return encodeDeltaBitpack(samples, nsamples, nchannels);
+		default:
+			return QByteArray(reinterpret_cast<const char*>(samples), size);
+	}
+}
+
+QByteArray encode(Encoding *encoding, const QByteArray& bytes)
+{
+	switch (*encoding) {
+		case Encoding::Raw:
+			return bytes;
+		default:
+			*encoding = Encoding::Deflate;
+			return qCompress(bytes, DeflateLevel);
+	}
+}
+
+/* Map a difference modulo 2^16 to an unsigned value, interleaving
+ * positive and negative values: 0, -1, 1, -2, 2, ...
+ */
+static inline quint16 zigzag(quint16 delta)
+{
+	auto d = static_cast<qint16>(delta);
+	return static_cast<quint16>((d << 1) ^ (d >> 15));
+}
+
+static inline quint16 unzigzag(quint16 value)
+{
+	return static_cast<quint16>((value >> 1) ^ (-(value & 1)));
+}
+
+/* Return the number of bits needed to represent a value. */
+static inline int bitWidth(quint16 value)
+{
+	int bits = 0;
+	while (value) {
+		bits++;
+		value >>= 1;
+	}
+	return bits;
+}
+
+QByteArray encodeDeltaBitpack(const qint16 *samples,
+		quint32 nsamples, quint32 nchannels)
+{
+	/* Worst case is 16 bits per sample, plus one byte per block. */
+	quint32 nblocks = (nsamples + DeltaBitpackBlockSize - 1) / DeltaBitpackBlockSize;
+	QByteArray encoded;
+	encoded.resize(nchannels * (sizeof(qint16) * nsamples + nblocks));
+	auto *out = reinterpret_cast<quint8*>(encoded.data());
+
+	quint16 values[DeltaBitpackBlockSize];
+	for (quint32 channel = 0; channel < nchannels; channel++) {
+		auto *column = samples + static_cast<size_t>(channel) * nsamples;
+		quint16 previous = 0;
+		for (quint32 start = 0; start < nsamples; start += DeltaBitpackBlockSize) {
+			auto count = std::min<quint32>(DeltaBitpackBlockSize, nsamples - start);
+
+			/* Compute differences, and the widest of them. */
+			quint16 all = 0;
+			for (quint32 i = 0; i < count; i++) {
+				auto current = static_cast<quint16>(column[start + i]);
+				values[i] = zigzag(static_cast<quint16>(current - previous));
+				all |= values[i];
+				previous = current;
+			}
+			int bits = bitWidth(all);
+			*out++ = static_cast<quint8>(bits);
+
+			/* Pack values, least-significant bit first. */
+			quint32 buffer = 0;
+			int buffered = 0;
+			for (quint32 i = 0; i < count; i++) {
+				buffer |= static_cast<quint32>(values[i]) << buffered;
+				buffered += bits;
+				while (buffered >= 8) {
+					*out++ = static_cast<quint8>(buffer);
+					buffer >>= 8;
+					buffered -= 8;
+				}
+			}
+			if (buffered > 0) {
+				*out++ = static_cast<quint8>(buffer);
+			}
+		}
+	}
+	encoded.resize(out - reinterpret_cast<quint8*>(encoded.data()));
+	return encoded;
+}
+
+bool decodeDeltaBitpack(const QByteArray& encoded, qint16 *samples,
+		quint32 nsamples, quint32 nchannels)
+{
+	auto *in = reinterpret_cast<const quint8*>(encoded.constData());
+	auto *end = in + encoded.size();
+
+	for (quint32 channel = 0; channel < nchannels; channel++) {
+		auto *column = samples + static_cast<size_t>(channel) * nsamples;
+		quint16 previous = 0;
+		for (quint32 start = 0; start < nsamples; start += DeltaBitpackBlockSize) {
+			auto count = std::min<quint32>(DeltaBitpackBlockSize, nsamples - start);
+			if (in == end) {
+				return false;
+			}
+			int bits = *in++;
+			if ((bits > 16) || (end - in < static_cast<qint64>((count * bits + 7) / 8))) {
+				return false;
+			}
+
+			quint32 buffer = 0;
+			int buffered = 0;
+			const quint32 mask = (1u << bits) - 1;
+			for (quint32 i = 0; i < count; i++) {
+				while (buffered < bits) {
+					buffer |= static_cast<quint32>(*in++) << buffered;
+					buffered += 8;
+				}
+				auto value = static_cast<quint16>(buffer & mask);
+				buffer >>= bits;
+				buffered -= bits;
+				previous = static_cast<quint16>(previous + unzigzag(value));
+				column[start + i] = static_cast<qint16>(previous);
+			}
+		}
+	}
+	return true;
+}
+
+} // end framecodec namespace
+
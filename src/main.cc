@@ -13,6 +13,10 @@
 #include <cstdlib> 	// abort, exit
 #include <iostream>
 
+#ifdef Q_OS_UNIX
+#include <csignal> // signal, SIGPIPE
+#endif
+
 /*! File stream to which logging information is written. */
 static FILE* logfile;
 
@@ -103,6 +107,13 @@ int main(int argc, char *argv[])
 	parser.process(app);
 	setupLogging(parser.isSet("quiet"));
 
+#ifdef Q_OS_UNIX
+	/* Files are sent to clients with sendfile(), which has no flag
+	 * suppressing SIGPIPE when a client disconnects.
+	 */
+	std::signal(SIGPIPE, SIG_IGN);
+#endif
+
 	Server server(&app);
 	auto retval = app.exec();
 	std::fclose(logfile);
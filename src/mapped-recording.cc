@@ -0,0 +1,184 @@
+/*! \file mapped-recording.cc
+ *
+ * Implementation of the class reading recordings through a memory mapping.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "mapped-recording.h"
+#include "sample-kernels.h"
+
+#include <hdf5.h>
+
+#include <cstring> // std::memcpy
+#include <stdexcept>
+
+/* Name of the dataset holding the samples of a recording. */
+static const char *DatasetName = "data";
+
+MappedRecording::MappedRecording(const QString& path, qint64 offset,
+		quint64 nsamples, quint32 nchannels, bool timeMajor) :
+	m_file(path),
+	m_offset(offset),
+	m_samples(nullptr),
+	m_nsamples(nsamples),
+	m_nchannels(nchannels),
+	m_timeMajor(timeMajor)
+{
+}
+
+MappedRecording::~MappedRecording()
+{
+	if (m_samples) {
+		m_file.unmap(reinterpret_cast<uchar*>(
+					const_cast<DataFrame::DataType*>(m_samples)));
+	}
+}
+
+std::shared_ptr<MappedRecording> MappedRecording::map(const QString& path,
+		quint64 nsamples, quint32 nchannels)
+{
+	if ((nsamples == 0) || (nchannels == 0)) {
+		return nullptr;
+	}
+
+	/* Inspect the layout of the dataset. Failures only mean the file is
+	 * read through the library, so errors are not printed.
+	 */
+	H5E_auto2_t errorFunc;
+	void *errorData;
+	H5Eget_auto2(H5E_DEFAULT, &errorFunc, &errorData);
+	H5Eset_auto2(H5E_DEFAULT, nullptr, nullptr);
+
+	bool contiguous = false, native = false;
+	int rank = -1;
+	hsize_t dims[2] = { 0, 0 };
+	hsize_t userblock = 0;
+	haddr_t offset = HADDR_UNDEF;
+	auto file = H5Fopen(path.toLocal8Bit().constData(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	if (file >= 0) {
+		auto fcpl = H5Fget_create_plist(file);
+		if (fcpl >= 0) {
+			H5Pget_userblock(fcpl, &userblock);
+			H5Pclose(fcpl);
+		}
+		auto dataset = H5Dopen2(file, DatasetName, H5P_DEFAULT);
+		if (dataset >= 0) {
+			auto dcpl = H5Dget_create_plist(dataset);
+			if (dcpl >= 0) {
+				contiguous = (H5Pget_layout(dcpl) == H5D_CONTIGUOUS);
+				H5Pclose(dcpl);
+			}
+			auto type = H5Dget_type(dataset);
+			if (type >= 0) {
+				native = (H5Tequal(type, H5T_NATIVE_INT16) > 0);
+				H5Tclose(type);
+			}
+			auto space = H5Dget_space(dataset);
+			if (space >= 0) {
+				rank = H5Sget_simple_extent_ndims(space);
+				if (rank == 2) {
+					H5Sget_simple_extent_dims(space, dims, nullptr);
+				}
+				H5Sclose(space);
+			}
+			offset = H5Dget_offset(dataset);
+			H5Dclose(dataset);
+		}
+		H5Fclose(file);
+	}
+	H5Eset_auto2(H5E_DEFAULT, errorFunc, errorData);
+
+	if (!contiguous || !native || (rank != 2) || (offset == HADDR_UNDEF)) {
+		return nullptr;
+	}
+	bool timeMajor;
+	if ((dims[0] == nchannels) && (dims[1] == nsamples)) {
+		timeMajor = false;
+	} else if ((dims[0] == nsamples) && (dims[1] == nchannels)) {
+		timeMajor = true;
+	} else {
+		return nullptr;
+	}
+
+	/* Addresses in the file are relative to the end of the user block. */
+	qint64 start = userblock + offset;
+	qint64 size = nsamples * nchannels * sizeof(DataFrame::DataType);
+	if (start % sizeof(DataFrame::DataType)) {
+		return nullptr;
+	}
+	std::shared_ptr<MappedRecording> recording {
+		new MappedRecording(path, start, nsamples, nchannels, timeMajor) };
+	if (!recording->m_file.open(QIODevice::ReadOnly) ||
+			(recording->m_file.size() < start + size)) {
+		return nullptr;
+	}
+	auto *mapped = recording->m_file.map(start, size);
+	if (!mapped) {
+		return nullptr;
+	}
+	recording->m_samples = reinterpret_cast<const DataFrame::DataType*>(mapped);
+	return recording;
+}
+
+quint64 MappedRecording::nsamples() const
+{
+	return m_nsamples;
+}
+
+quint32 MappedRecording::nchannels() const
+{
+	return m_nchannels;
+}
+
+DataFrame::SampleLayout MappedRecording::layout() const
+{
+	return m_timeMajor ? DataFrame::SampleLayout::TimeMajor :
+		DataFrame::SampleLayout::ChannelMajor;
+}
+
+QList<QPair<qint64, qint64>> MappedRecording::regions(quint64 start, quint64 stop) const
+{
+	if ((start >= stop) || (stop > m_nsamples)) {
+		throw std::logic_error("Requested samples are outside of the recording.");
+	}
+	const qint64 sampleSize = sizeof(DataFrame::DataType);
+	QList<QPair<qint64, qint64>> regions;
+	if (m_timeMajor) {
+		regions.append(qMakePair(
+				m_offset + static_cast<qint64>(start * m_nchannels) * sampleSize,
+				static_cast<qint64>((stop - start) * m_nchannels) * sampleSize));
+		return regions;
+	}
+	if ((start == 0) && (stop == m_nsamples)) {
+		regions.append(qMakePair(m_offset,
+				static_cast<qint64>(m_nsamples * m_nchannels) * sampleSize));
+		return regions;
+	}
+	for (quint32 channel = 0; channel < m_nchannels; channel++) {
+		regions.append(qMakePair(
+				m_offset + static_cast<qint64>(channel * m_nsamples + start) * sampleSize,
+				static_cast<qint64>(stop - start) * sampleSize));
+	}
+	return regions;
+}
+
+void MappedRecording::data(quint64 start, quint64 stop,
+		DataFrame::Samples& data) const
+{
+	if ((start >= stop) || (stop > m_nsamples)) {
+		throw std::logic_error("Requested samples are outside of the recording.");
+	}
+	auto nsamples = stop - start;
+	data.set_size(nsamples, m_nchannels);
+	if (m_timeMajor) {
+		samplekernels::transpose(m_samples + start * m_nchannels, data.memptr(),
+				nsamples, m_nchannels);
+	} else {
+		for (quint32 channel = 0; channel < m_nchannels; channel++) {
+			std::memcpy(data.colptr(channel), m_samples + channel * m_nsamples + start,
+					nsamples * sizeof(DataFrame::DataType));
+		}
+	}
+}
+
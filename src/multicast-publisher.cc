@@ -0,0 +1,149 @@
+/*! \file multicast-publisher.cc
+ *
+ * Implementation of the class publishing live data frames to
+ * a UDP multicast group.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "multicast-publisher.h"
+
+#include <algorithm> // std::min
+#include <cstring> // std::memcpy
+#include <limits>
+#include <memory> // std::unique_ptr
+#include <stdexcept>
+
+MulticastPublisher::MulticastPublisher(const QHostAddress& group, quint16 port,
+		int ttl, int datagramSize, const QString& interfaceName) :
+	m_socket(new QUdpSocket),
+	m_group(group),
+	m_port(port),
+	m_datagramSize(datagramSize),
+	m_queued(0),
+	m_sent(0),
+	m_failed(0),
+	m_dropped(0),
+	m_retries(0)
+{
+	/* Deleted by the thread once started, and here until then. */
+	std::unique_ptr<QUdpSocket> socket { m_socket };
+
+	if (!m_group.isMulticast()) {
+		throw std::invalid_argument(QString("%1 is not a multicast address").arg(
+					m_group.toString()).toStdString());
+	}
+	if (m_datagramSize <= HeaderSize) {
+		throw std::invalid_argument("Multicast datagram size is too small");
+	}
+
+	/* Socket options only take effect once the socket is bound. */
+	auto any = (m_group.protocol() == QAbstractSocket::IPv6Protocol) ?
+		QHostAddress::AnyIPv6 : QHostAddress::AnyIPv4;
+	if (!m_socket->bind(QHostAddress(any), 0)) {
+		throw std::invalid_argument(QString("Could not create multicast socket: %1").arg(
+					m_socket->errorString()).toStdString());
+	}
+	m_socket->setSocketOption(QAbstractSocket::MulticastTtlOption, ttl);
+	m_socket->setSocketOption(QAbstractSocket::MulticastLoopbackOption, 1);
+	m_socket->setSocketOption(QAbstractSocket::SendBufferSizeSocketOption,
+			SendBufferSize);
+
+	if (!interfaceName.isEmpty()) {
+		auto iface = QNetworkInterface::interfaceFromName(interfaceName);
+		if (!iface.isValid()) {
+			throw std::invalid_argument(QString("Unknown network interface: %1").arg(
+						interfaceName).toStdString());
+		}
+		m_socket->setMulticastInterface(iface);
+	}
+	m_datagram.resize(m_datagramSize);
+
+	m_socket->moveToThread(&m_thread);
+	QObject::connect(&m_thread, &QThread::finished,
+			socket.release(), &QObject::deleteLater);
+	m_thread.start();
+}
+
+MulticastPublisher::~MulticastPublisher()
+{
+	m_thread.quit();
+	m_thread.wait();
+}
+
+QString MulticastPublisher::address() const
+{
+	return m_group.toString() + ":" + QString::number(m_port);
+}
+
+void MulticastPublisher::publish(const DataFrame& frame, quint64 sequence)
+{
+	if (m_queued >= MaxQueuedFrames) {
+		m_dropped++;
+		return;
+	}
+	m_queued++;
+	QTimer::singleShot(0, m_socket, [this, frame, sequence]() -> void {
+		if (send(frame, sequence)) {
+			m_sent++;
+		} else {
+			m_failed++;
+		}
+		m_queued--;
+	});
+}
+
+QVariantMap MulticastPublisher::status() const
+{
+	return QVariantMap {
+		{ "address", address() },
+		{ "queued", m_queued.load() },
+		{ "sent-frames", m_sent.load() },
+		{ "failed-frames", m_failed.load() },
+		{ "dropped-frames", m_dropped.load() },
+		{ "retried-datagrams", m_retries.load() }
+	};
+}
+
+bool MulticastPublisher::send(const DataFrame& frame, quint64 sequence)
+{
+	/* Serialize once, then send the frame in fragments. */
+	quint32 frameSize = frame.sampleIndexedBytesize();
+	m_frameBuffer.resize(frameSize);
+	frame.serializeSampleIndexedInto(m_frameBuffer.data());
+
+	const quint32 payloadSize = m_datagramSize - HeaderSize;
+	auto count = (frameSize + payloadSize - 1) / payloadSize;
+	if (count > std::numeric_limits<quint16>::max()) {
+		return false;
+	}
+	auto *datagram = m_datagram.data();
+	quint16 nfragments = static_cast<quint16>(count);
+	quint32 magic = Magic;
+	std::memcpy(datagram, &magic, sizeof(magic));
+	std::memcpy(datagram + 4, &sequence, sizeof(sequence));
+	std::memcpy(datagram + 14, &nfragments, sizeof(nfragments));
+	std::memcpy(datagram + 16, &frameSize, sizeof(frameSize));
+
+	/* A fragment the system cannot queue now is sent again once the
+	 * buffer has drained, as a frame missing any fragment is useless.
+	 */
+	for (quint16 index = 0; index < nfragments; index++) {
+		quint32 offset = index * payloadSize;
+		auto size = std::min(payloadSize, frameSize - offset);
+		std::memcpy(datagram + 12, &index, sizeof(index));
+		std::memcpy(datagram + 20, &offset, sizeof(offset));
+		std::memcpy(datagram + HeaderSize, m_frameBuffer.constData() + offset, size);
+		int attempts = 0;
+		while (m_socket->writeDatagram(datagram, HeaderSize + size,
+					m_group, m_port) == -1) {
+			if (++attempts > MaxSendRetries) {
+				return false;
+			}
+			m_retries++;
+			QThread::usleep(SendRetryInterval);
+		}
+	}
+	return true;
+}
+
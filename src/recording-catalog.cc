@@ -0,0 +1,269 @@
+/*! \file recording-catalog.cc
+ *
+ * Implementation of the class keeping an index of recordings.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "recording-catalog.h"
+#include "recording-reader.h" // hdf5Mutex()
+
+#include "libdatafile/include/datafile.h"
+
+#include <hdf5.h>
+
+#include <algorithm> // std::count_if
+
+/* Name of the dataset holding the array configuration of a recording. */
+static const char *ConfigurationName = "configuration";
+
+RecordingCatalog::RecordingCatalog(QObject *parent) :
+	QObject(parent),
+	m_suspended(false),
+	m_reading(nullptr)
+{
+	m_pool.setMaxThreadCount(1);
+	QObject::connect(&m_watcher, &QFileSystemWatcher::directoryChanged,
+			this, &RecordingCatalog::scan);
+}
+
+RecordingCatalog::~RecordingCatalog()
+{
+	m_pool.waitForDone();
+}
+
+void RecordingCatalog::setDirectory(const QString& directory)
+{
+	if (!m_watcher.directories().isEmpty()) {
+		m_watcher.removePaths(m_watcher.directories());
+	}
+	m_entries.clear();
+	m_queue.clear();
+	m_directory = QDir(directory);
+	if (m_directory.exists()) {
+		scan(m_directory.absolutePath());
+	}
+}
+
+void RecordingCatalog::setActiveFile(const QString& path)
+{
+	auto previous = m_activeFile;
+	m_activeFile = path;
+	if (previous.isEmpty() || (previous == path)) {
+		return;
+	}
+
+	/* The finished file has changed since it was listed, and is queued. */
+	auto directory = QFileInfo(previous).absolutePath();
+	if (m_directory.relativeFilePath(directory).startsWith("..")) {
+		return;
+	}
+	scan(directory);
+	auto name = m_directory.relativeFilePath(previous);
+	auto entry = m_entries.constFind(name);
+	if ((entry != m_entries.constEnd()) && !entry->indexed && !m_queue.contains(name)) {
+		m_queue.enqueue(name);
+		readNext();
+	}
+}
+
+void RecordingCatalog::setSuspended(bool suspended)
+{
+	m_suspended = suspended;
+	if (m_suspended) {
+		if (m_reading) {
+			m_reading->waitForFinished();
+		}
+	} else {
+		readNext();
+	}
+}
+
+QList<RecordingCatalog::Entry> RecordingCatalog::entries() const
+{
+	return m_entries.values();
+}
+
+int RecordingCatalog::pending() const
+{
+	return std::count_if(m_entries.cbegin(), m_entries.cend(),
+			[](const Entry& entry) -> bool { return !entry.indexed; });
+}
+
+void RecordingCatalog::scan(const QString& directory)
+{
+	QDir dir(directory);
+	auto relative = m_directory.relativeFilePath(dir.absolutePath());
+	auto prefix = (relative.isEmpty() || (relative == ".")) ?
+		QString() : relative + "/";
+	if (prefix.startsWith("..")) {
+		return;
+	}
+
+	QSet<QString> subdirectories, files;
+	if (dir.exists()) {
+		if (!m_watcher.directories().contains(dir.absolutePath()) &&
+				!m_watcher.addPath(dir.absolutePath())) {
+			qWarning().noquote() << "Could not watch" << dir.absolutePath()
+				<< "for new recordings.";
+		}
+
+		/* Subdirectories already watched are scanned when they change. */
+		for (auto& sub : dir.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+			subdirectories.insert(sub.fileName());
+			if (!m_watcher.directories().contains(sub.absoluteFilePath())) {
+				scan(sub.absoluteFilePath());
+			}
+		}
+
+		/* Only files new or changed since they were listed are read. */
+		for (auto& info : dir.entryInfoList({ "*.h5", "*.hdf5" }, QDir::Files)) {
+			auto name = prefix + info.fileName();
+			files.insert(name);
+			auto entry = m_entries.constFind(name);
+			if ((entry != m_entries.constEnd()) && (entry->size == info.size()) &&
+					(entry->modified == info.lastModified())) {
+				continue;
+			}
+			m_entries.insert(name, { name, info.size(), info.created(),
+					info.lastModified(), false, {}, 0., 0, 0, {} });
+			if (!m_queue.contains(name)) {
+				m_queue.enqueue(name);
+			}
+		}
+	} else {
+		m_watcher.removePath(dir.absolutePath());
+	}
+
+	/* Drop recordings removed from the directory, or in removed subdirectories. */
+	auto it = m_entries.lowerBound(prefix);
+	while ((it != m_entries.end()) && it.key().startsWith(prefix)) {
+		auto rest = it.key().mid(prefix.size());
+		auto ix = rest.indexOf("/");
+		bool exists = (ix == -1) ? files.contains(it.key()) :
+			subdirectories.contains(rest.left(ix));
+		if (exists) {
+			++it;
+		} else {
+			it = m_entries.erase(it);
+		}
+	}
+
+	readNext();
+}
+
+void RecordingCatalog::readNext()
+{
+	if (m_reading || m_suspended) {
+		return;
+	}
+	while (!m_queue.isEmpty()) {
+		auto name = m_queue.dequeue();
+		if (!m_entries.contains(name)) {
+			continue;
+		}
+		QFileInfo info(m_directory.absoluteFilePath(name));
+		auto path = info.absoluteFilePath();
+		if (info.canonicalFilePath() == m_activeFile) {
+			continue;
+		}
+
+		auto size = info.size();
+		auto modified = info.lastModified();
+		m_reading = new QFutureWatcher<Metadata>(this);
+		QObject::connect(m_reading, &QFutureWatcher<Metadata>::finished,
+				this, [this, name, path, size, modified]() -> void {
+					auto metadata = m_reading->result();
+					m_reading->deleteLater();
+					m_reading = nullptr;
+					finish(name, path, size, modified, metadata);
+					readNext();
+				});
+		m_reading->setFuture(QtConcurrent::run(&m_pool, &RecordingCatalog::read, path));
+		return;
+	}
+}
+
+void RecordingCatalog::finish(const QString& name, const QString& path,
+		qint64 size, const QDateTime& modified, const Metadata& metadata)
+{
+	/* The file may have been removed, or the directory changed, meanwhile. */
+	auto entry = m_entries.find(name);
+	if ((entry == m_entries.end()) || (m_directory.absoluteFilePath(name) != path)) {
+		return;
+	}
+	entry->size = size;
+	entry->modified = modified;
+	entry->indexed = true;
+	entry->error = metadata.error;
+	entry->sampleRate = metadata.sampleRate;
+	entry->nsamples = metadata.nsamples;
+	entry->nchannels = metadata.nchannels;
+	entry->configurationHash = metadata.configurationHash;
+}
+
+RecordingCatalog::Metadata RecordingCatalog::read(QString path)
+{
+	Metadata metadata { {}, 0., 0, 0, {} };
+	QMutexLocker lock(&hdf5Mutex());
+	try {
+		datafile::DataFile file(path.toStdString());
+		metadata.sampleRate = file.sampleRate();
+		metadata.nsamples = file.nsamples();
+		metadata.nchannels = file.nchannels();
+	} catch (H5::Exception& e) {
+		metadata.error = QString("Could not read recording: %1").arg(
+				e.getDetailMsg().data());
+		return metadata;
+	} catch (std::exception& e) {
+		metadata.error = QString("Could not read recording: %1").arg(e.what());
+		return metadata;
+	}
+
+	/* Hash the configuration, if any, as stored. Recordings without one
+	 * are expected, so errors are not printed.
+	 */
+	H5E_auto2_t errorFunc;
+	void *errorData;
+	H5Eget_auto2(H5E_DEFAULT, &errorFunc, &errorData);
+	H5Eset_auto2(H5E_DEFAULT, nullptr, nullptr);
+	auto file = H5Fopen(path.toLocal8Bit().constData(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	if (file >= 0) {
+		if (H5Lexists(file, ConfigurationName, H5P_DEFAULT) > 0) {
+			auto dataset = H5Dopen2(file, ConfigurationName, H5P_DEFAULT);
+			if (dataset >= 0) {
+				auto type = H5Dget_type(dataset);
+				auto native = (type >= 0) ?
+					H5Tget_native_type(type, H5T_DIR_ASCEND) : -1;
+				auto space = H5Dget_space(dataset);
+
+				/* Variable-length data is read as pointers, which can't be hashed. */
+				if ((native >= 0) && (space >= 0) &&
+						(H5Tdetect_class(native, H5T_VLEN) == 0) &&
+						(H5Tis_variable_str(native) == 0)) {
+					auto npoints = H5Sget_simple_extent_npoints(space);
+					QByteArray buffer(static_cast<int>(npoints * H5Tget_size(native)), 0);
+					if (H5Dread(dataset, native, H5S_ALL, H5S_ALL,
+								H5P_DEFAULT, buffer.data()) >= 0) {
+						metadata.configurationHash = QCryptographicHash::hash(
+								buffer, QCryptographicHash::Sha1).toHex();
+					}
+				}
+				if (space >= 0) {
+					H5Sclose(space);
+				}
+				if (native >= 0) {
+					H5Tclose(native);
+				}
+				if (type >= 0) {
+					H5Tclose(type);
+				}
+				H5Dclose(dataset);
+			}
+		}
+		H5Fclose(file);
+	}
+	H5Eset_auto2(H5E_DEFAULT, errorFunc, errorData);
+	return metadata;
+}
+
@@ -0,0 +1,530 @@
+/*! \file recording-reader.cc
+ *
+ * Implementation of the class reading data from recordings.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "recording-reader.h"
+
+#include <algorithm> // std::max, std::min
+#include <atomic>
+#include <stdexcept>
+#include <utility> // std::move
+
+QMutex& hdf5Mutex()
+{
+	static QMutex mutex;
+	return mutex;
+}
+
+/* Number of live writers waiting for hdf5Mutex(), and the condition on
+ * which reads wait for them to finish.
+ */
+static std::atomic<int> liveWritersWaiting { 0 };
+static QWaitCondition liveWriteFinished;
+
+/* Time the live writer waited for hdf5Mutex(), updated while holding it. */
+static quint64 liveWrites = 0;
+static qint64 totalLiveWriteWait = 0;
+static qint64 maxLiveWriteWait = 0;
+
+LiveWriteLocker::LiveWriteLocker()
+{
+	QElapsedTimer timer;
+	timer.start();
+	liveWritersWaiting++;
+	hdf5Mutex().lock();
+	liveWritersWaiting--;
+	auto wait = timer.nsecsElapsed();
+	liveWrites++;
+	totalLiveWriteWait += wait;
+	maxLiveWriteWait = std::max(maxLiveWriteWait, wait);
+}
+
+LiveWriteLocker::~LiveWriteLocker()
+{
+	liveWriteFinished.wakeAll();
+	hdf5Mutex().unlock();
+}
+
+/* Wait, with hdf5Mutex() held, until no live writer is waiting for it. */
+static void yieldToLiveWriters()
+{
+	while (liveWritersWaiting.load()) {
+		liveWriteFinished.wait(&hdf5Mutex());
+	}
+}
+
+/* Read samples through the library one slab at a time, taking
+ * hdf5Mutex() for each and letting waiting live writers go first.
+ */
+static void readSlabs(datafile::DataFile& file, quint64 start, quint64 stop,
+		DataFrame::Samples& data)
+{
+	quint64 slabSamples = 0;
+	for (auto first = start; first < stop; ) {
+		QMutexLocker lock(&hdf5Mutex());
+		yieldToLiveWriters();
+		if (!slabSamples) {
+			quint64 nchannels = std::max<quint64>(file.nchannels(), 1);
+			slabSamples = std::max<quint64>(RecordingReader::MaxSlabBytes /
+					(nchannels * sizeof(DataFrame::DataType)), 1);
+			if (stop - start <= slabSamples) {
+				file.data(start, stop, data);
+				return;
+			}
+			data.set_size(stop - start, nchannels);
+		}
+		auto last = std::min(stop, first + slabSamples);
+		DataFrame::Samples slab;
+		file.data(first, last, slab);
+		lock.unlock();
+		data.rows(first - start, last - start - 1) = slab;
+		first = last;
+	}
+}
+
+RecordingReader::RecordingReader(int nthreads, int prefetchDepth,
+		qint64 cacheSize, QObject *parent) :
+	QObject(parent),
+	m_synchronous(false),
+	m_prefetchDepth((cacheSize > 0) ? std::max(prefetchDepth, 0) : 0),
+	m_cache(std::max<qint64>(cacheSize, 0)),
+	m_liveGain(1.),
+	m_liveOffset(0.),
+	m_queuedJobs(0),
+	m_maxQueuedJobs(0),
+	m_reads(0),
+	m_failedReads(0),
+	m_bytesRead(0),
+	m_totalLatency(0),
+	m_maxLatency(0),
+	m_totalReadTime(0),
+	m_executed(0),
+	m_prefetches(0),
+	m_mappedReads(0)
+{
+	m_pool.setMaxThreadCount(std::max(nthreads, 1));
+}
+
+RecordingReader::~RecordingReader()
+{
+	m_pool.waitForDone();
+	QMutexLocker lock(&hdf5Mutex());
+	for (auto& running : m_running) {
+		if (running.job.task.open) {
+			delete running.watcher->result().file;
+		}
+	}
+	m_running.clear();
+	m_queued.clear();
+	m_recordings.clear();
+	m_liveFile.reset();
+}
+
+void RecordingReader::setLiveFile(std::shared_ptr<datafile::DataFile> file,
+		const QString& path, float gain, float offset)
+{
+	if (!path.isEmpty()) {
+		m_cache.remove(path);
+	}
+	release(m_liveFile);
+	m_liveFile = file;
+	m_livePath = path;
+	m_liveGain = gain;
+	m_liveOffset = offset;
+}
+
+void RecordingReader::setSynchronous(bool synchronous)
+{
+	if (synchronous && !m_synchronous) {
+		m_pool.waitForDone();
+	}
+	m_synchronous = synchronous;
+}
+
+void RecordingReader::open(Client *client, const QString& path)
+{
+	Job job { { true, path, nullptr, nullptr, {}, 1., 0. }, nullptr, path, false, {} };
+	submit(client, job);
+}
+
+void RecordingReader::close(Client *client)
+{
+	auto recording = m_recordings.take(client);
+	release(recording.file);
+}
+
+std::shared_ptr<const MappedRecording> RecordingReader::mapping(Client *client) const
+{
+	return m_recordings.value(client).mapping;
+}
+
+void RecordingReader::removeClient(Client *client)
+{
+	auto queue = m_queued.take(client);
+	m_queuedJobs -= queue.size();
+	for (auto& job : queue) {
+		release(job.file);
+	}
+	auto recording = m_recordings.take(client);
+	release(recording.file);
+	m_access.remove(client);
+	if (m_running.contains(client)) {
+		m_discarded.insert(client);
+	}
+}
+
+QList<Client::DataRequest> RecordingReader::requests(Client *client) const
+{
+	QList<Client::DataRequest> requests;
+	auto running = m_running.constFind(client);
+	if ((running != m_running.constEnd()) && !m_discarded.contains(client)) {
+		const auto& job = running->job;
+		if (!job.task.open && !job.prefetch && !job.task.request.exported) {
+			requests.append(job.task.request);
+		}
+	}
+	for (const auto& job : m_queued.value(client)) {
+		if (!job.task.open && !job.prefetch && !job.task.request.exported) {
+			requests.append(job.task.request);
+		}
+	}
+	return requests;
+}
+
+void RecordingReader::read(Client *client, const Client::DataRequest& request)
+{
+	Job job { { false, QString(), nullptr, nullptr, request, m_liveGain, m_liveOffset },
+			m_liveFile, m_livePath, false, {} };
+	auto recording = m_recordings.constFind(client);
+	if (recording != m_recordings.constEnd()) {
+		job.file = recording->file;
+		job.filePath = recording->info.path;
+		job.task.mapping = recording->mapping;
+		job.task.gain = recording->info.gain;
+		job.task.offset = recording->info.offset;
+	}
+	job.task.file = job.file.get();
+	readAhead(client, job);
+}
+
+void RecordingReader::readAhead(Client *client, const Job& job)
+{
+	const auto& request = job.task.request;
+	auto length = request.stopSample - request.startSample;
+	auto last = m_access.value(client, { QString(), 0, 0 });
+	bool sequential = !job.filePath.isEmpty() && (job.filePath == last.filePath) &&
+		(request.startSample == last.nextSample) && (length == last.length);
+	m_access.insert(client, { job.filePath, request.stopSample, length });
+
+	/* Serve the request in place of a queued job reading the same
+	 * chunk ahead, or drop all such jobs if the client stopped reading
+	 * sequentially.
+	 */
+	auto& queue = m_queued[client];
+	bool queued = false;
+	for (auto it = queue.begin(); it != queue.end(); ) {
+		if (!it->prefetch) {
+			++it;
+		} else if (sequential && !queued && (it->filePath == job.filePath) &&
+				(it->task.request.startSample == request.startSample) &&
+				(it->task.request.stopSample == request.stopSample)) {
+			it->prefetch = false;
+			it->task.request = request;
+			it->requested.start();
+			queued = true;
+			++it;
+		} else if (!sequential) {
+			release(it->file);
+			it = queue.erase(it);
+			m_queuedJobs--;
+		} else {
+			++it;
+		}
+	}
+	if (queue.isEmpty()) {
+		m_queued.remove(client);
+	}
+	if (!queued) {
+		submit(client, job);
+	}
+	if (!sequential || !job.file || (m_prefetchDepth == 0)) {
+		return;
+	}
+
+	/* Read ahead the next windows not already cached, queued or read. */
+	auto available = static_cast<quint64>(job.file->nsamples());
+	auto recording = m_recordings.constFind(client);
+	if ((recording != m_recordings.constEnd()) && (recording->file == job.file)) {
+		available = recording->info.nsamples;
+	}
+	for (int i = 0; i < m_prefetchDepth; i++) {
+		auto start = request.stopSample + i * length;
+		auto stop = start + length;
+		if (stop > available) {
+			break;
+		}
+		if (pending(client, job.filePath, start, stop)) {
+			continue;
+		}
+		auto ahead = job;
+		ahead.prefetch = true;
+		ahead.task.request = { 0., 0., start, stop, request.sampleIndexed, 0, 0 };
+		submit(client, ahead);
+	}
+}
+
+void RecordingReader::release(std::shared_ptr<datafile::DataFile>& file)
+{
+	if (!file || (file.use_count() > 1)) {
+		file.reset();
+		return;
+	}
+	if (m_synchronous) {
+		QMutexLocker lock(&hdf5Mutex());
+		file.reset();
+		return;
+	}
+
+	/* Held through a pointer, so that no copy outlives the task. */
+	auto *last = new std::shared_ptr<datafile::DataFile>(std::move(file));
+	QtConcurrent::run(&m_pool, [last]() -> void {
+		QMutexLocker lock(&hdf5Mutex());
+		delete last;
+	});
+}
+
+bool RecordingReader::pending(Client *client, const QString& filePath,
+		quint64 start, quint64 stop) const
+{
+	if (m_cache.contains(filePath, start, stop)) {
+		return true;
+	}
+	auto matches = [&filePath, start, stop](const Job& job) -> bool {
+		return (job.filePath == filePath) && (job.task.request.startSample == start) &&
+			(job.task.request.stopSample == stop);
+	};
+	for (const auto& job : m_queued.value(client)) {
+		if (matches(job)) {
+			return true;
+		}
+	}
+	auto running = m_running.constFind(client);
+	return (running != m_running.constEnd()) && matches(running->job);
+}
+
+QVariantMap RecordingReader::status() const
+{
+	auto completed = static_cast<double>(std::max<quint64>(m_reads, 1));
+	auto executed = static_cast<double>(std::max<quint64>(m_executed, 1));
+	double readSeconds = m_totalReadTime / 1e9;
+	return QVariantMap {
+		{ "threads", m_pool.maxThreadCount() },
+		{ "synchronous", m_synchronous },
+		{ "active", m_running.size() },
+		{ "queued", m_queuedJobs },
+		{ "max-queued", m_maxQueuedJobs },
+		{ "requests", m_reads },
+		{ "failed-requests", m_failedReads },
+		{ "bytes-read", m_bytesRead },
+		{ "mean-latency", m_totalLatency / completed / 1e6 },
+		{ "max-latency", m_maxLatency / 1e6 },
+		{ "mean-read-time", m_totalReadTime / executed / 1e6 },
+		{ "prefetches", m_prefetches },
+		{ "mapped-reads", m_mappedReads },
+		{ "throughput", (readSeconds > 0) ? (m_bytesRead / readSeconds / (1 << 20)) : 0. },
+		{ "live-writes", liveWrites },
+		{ "mean-live-write-wait", totalLiveWriteWait /
+				static_cast<double>(std::max<quint64>(liveWrites, 1)) / 1e6 },
+		{ "max-live-write-wait", maxLiveWriteWait / 1e6 }
+	};
+}
+
+QVariantMap RecordingReader::cacheStatus() const
+{
+	return m_cache.status();
+}
+
+RecordingReader::Result RecordingReader::execute(Task task)
+{
+	Result result { nullptr, nullptr, { task.path, 0., 0, 0, 1., 0. }, {}, {}, 0 };
+	QElapsedTimer timer;
+	timer.start();
+
+	if (task.open) {
+		QMutexLocker lock(&hdf5Mutex());
+		yieldToLiveWriters();
+		try {
+			std::unique_ptr<datafile::DataFile> file {
+				new datafile::DataFile(task.path.toStdString()) };
+			result.info.sampleRate = file->sampleRate();
+			result.info.nsamples = file->nsamples();
+			result.info.nchannels = file->nchannels();
+			result.info.gain = file->gain();
+			result.info.offset = file->offset();
+			result.mapping = MappedRecording::map(task.path,
+					result.info.nsamples, result.info.nchannels);
+			result.file = file.release();
+		} catch (H5::Exception& e) {
+			result.error = QString("Could not open recording: %1").arg(
+					e.getDetailMsg().data());
+		} catch (std::exception& e) {
+			result.error = QString("Could not open recording: %1").arg(e.what());
+		}
+		result.readTime = timer.nsecsElapsed();
+		return result;
+	}
+
+	if (!task.file) {
+		result.error = "There is no active recording, data cannot be requested.";
+		return result;
+	}
+
+	/* Mapped recordings are read without the library, and so its lock. */
+	DataFrame::Samples data;
+	try {
+		if (task.mapping) {
+			task.mapping->data(task.request.startSample, task.request.stopSample, data);
+		} else {
+			readSlabs(*task.file, task.request.startSample, task.request.stopSample, data);
+		}
+	} catch (H5::Exception& e) {
+		result.error = QString("Could not read data from recording file: %1").arg(
+				e.getDetailMsg().data());
+	} catch (std::logic_error& e) {
+		result.error = QString("Could not read data from recording file: %1").arg(
+				e.what());
+	}
+
+	if (result.error.isEmpty()) {
+		result.frame = DataFrame { task.request.start, task.request.stop,
+				task.request.startSample, task.request.stopSample, std::move(data) };
+		result.frame.setScale(task.gain, task.offset);
+	}
+	result.readTime = timer.nsecsElapsed();
+	return result;
+}
+
+void RecordingReader::submit(Client *client, Job job)
+{
+	job.requested.start();
+	m_queued[client].enqueue(job);
+	m_queuedJobs++;
+	m_maxQueuedJobs = std::max(m_maxQueuedJobs, m_queuedJobs);
+	if (!m_running.contains(client)) {
+		startNext(client);
+	}
+}
+
+void RecordingReader::startNext(Client *client)
+{
+	auto queue = m_queued.find(client);
+	if ((queue == m_queued.end()) || m_running.contains(client)) {
+		return;
+	}
+	auto job = queue->dequeue();
+	if (queue->isEmpty()) {
+		m_queued.erase(queue);
+	}
+	m_queuedJobs--;
+
+	/* Serve requests from the cache, and skip reading ahead chunks
+	 * cached since the job was queued, e.g., for another client.
+	 */
+	if (!job.task.open && !job.filePath.isEmpty()) {
+		const auto& request = job.task.request;
+		DataFrame frame;
+		if (job.prefetch && m_cache.contains(job.filePath,
+					request.startSample, request.stopSample)) {
+			release(job.file);
+			startNext(client);
+			return;
+		}
+		if (!job.prefetch && m_cache.find(job.filePath,
+					request.startSample, request.stopSample, &frame)) {
+			frame.setTimes(request.start, request.stop);
+			finish(client, std::move(job), { nullptr, nullptr, {}, frame, {}, 0 });
+			return;
+		}
+	}
+
+	if (m_synchronous) {
+		auto result = execute(job.task);
+		finish(client, std::move(job), result);
+		return;
+	}
+
+	auto *watcher = new QFutureWatcher<Result>(this);
+	m_running.insert(client, { watcher, job });
+	QObject::connect(watcher, &QFutureWatcher<Result>::finished,
+			this, [this, client]() -> void {
+				auto running = m_running.take(client);
+				running.watcher->deleteLater();
+				finish(client, std::move(running.job), running.watcher->result());
+			});
+	watcher->setFuture(QtConcurrent::run(&m_pool, &RecordingReader::execute, job.task));
+}
+
+void RecordingReader::finish(Client *client, Job job, Result result)
+{
+	if (result.readTime) {
+		m_executed++;
+		m_totalReadTime += result.readTime;
+		if (result.error.isEmpty() && !job.task.open) {
+			m_bytesRead += result.frame.payloadBytesize();
+			if (job.task.mapping) {
+				m_mappedReads++;
+			}
+			if (!job.filePath.isEmpty()) {
+				m_cache.insert(job.filePath, job.task.request.startSample,
+						job.task.request.stopSample, result.frame);
+			}
+		}
+	}
+	if (job.prefetch) {
+		m_prefetches++;
+	} else {
+		auto latency = job.requested.nsecsElapsed();
+		m_totalLatency += latency;
+		m_maxLatency = std::max(m_maxLatency, latency);
+		m_reads++;
+		if (!result.error.isEmpty()) {
+			m_failedReads++;
+		}
+	}
+
+	/* An opened file replaces any the client had open. */
+	bool discarded = m_discarded.remove(client);
+	release(job.file);
+	if (job.task.open && result.file) {
+		std::shared_ptr<datafile::DataFile> file { result.file };
+		if (discarded) {
+			release(file);
+		} else {
+			auto previous = m_recordings.take(client);
+			release(previous.file);
+			m_recordings.insert(client, { file, result.mapping, result.info });
+		}
+	}
+
+	/* Chunks read ahead are only cached, and failures to read them not
+	 * reported, as the client did not request them.
+	 */
+	if (!discarded && !job.prefetch) {
+		if (job.task.open) {
+			emit opened(client, result.error.isEmpty(), result.error, result.info);
+		} else if (result.error.isEmpty()) {
+			emit dataRead(client, job.task.request, result.frame);
+		} else {
+			emit readFailed(client, job.task.request, result.error);
+		}
+	}
+
+	/* The next job starts from the event loop, rather than recursing
+	 * through jobs served from the cache or read synchronously.
+	 */
+	QTimer::singleShot(0, this, [this, client]() -> void { startNext(client); });
+}
+
@@ -0,0 +1,175 @@
+/*! \file sample-kernels.cc
+ *
+ * Implementation of the vectorized sample conversion kernels.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "sample-kernels.h"
+
+#include <algorithm> // std::min, std::max
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define BLDS_HAVE_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define BLDS_HAVE_NEON
+#endif
+
+namespace samplekernels {
+
+/* Size of the square tiles in which matrices are transposed. Two tiles
+ * of int16 values, one read and one written, take 16 kB.
+ */
+static const size_t TransposeTileSize = 64;
+
+/* Size of the square blocks transposed in registers. */
+static const size_t TransposeBlockSize = 8;
+
+void int16ToFloat(const qint16 *in, float *out, size_t n,
+		float gain, float offset)
+{
+	size_t i = 0;
+#if defined(BLDS_HAVE_SSE2)
+	const __m128 g = _mm_set1_ps(gain);
+	const __m128 o = _mm_set1_ps(offset);
+	for (; i + 8 <= n; i += 8) {
+		/* Sign-extend 8 samples to two vectors of 32-bit integers. */
+		__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+		_mm_storeu_ps(out + i, 
+				_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(lo), g), o));
+		_mm_storeu_ps(out + i + 4, 
+				_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(hi), g), o));
+	}
+#elif defined(BLDS_HAVE_NEON)
+	const float32x4_t g = vdupq_n_f32(gain);
+	const float32x4_t o = vdupq_n_f32(offset);
+	for (; i + 8 <= n; i += 8) {
+		int16x8_t x = vld1q_s16(in + i);
+		float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(x)));
+		float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(x)));
+
+		/* Multiply and add separately, as a fused operation would round
+		 * differently from the scalar path.
+		 */
+		vst1q_f32(out + i, vaddq_f32(vmulq_f32(lo, g), o));
+		vst1q_f32(out + i + 4, vaddq_f32(vmulq_f32(hi, g), o));
+	}
+#endif
+	for (; i < n; i++) {
+		float scaled = static_cast<float>(in[i]) * gain;
+		out[i] = scaled + offset;
+	}
+}
+
+#if defined(BLDS_HAVE_SSE2)
+/* Transpose one 8x8 block of int16 values, with 3 rounds of interleaving. */
+static void transposeBlock(const qint16 *in, size_t inStride,
+		qint16 *out, size_t outStride)
+{
+	__m128i a[8], t[8], u[8];
+	for (int i = 0; i < 8; i++) {
+		a[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i * inStride));
+	}
+	for (int i = 0; i < 4; i++) {
+		t[2 * i] = _mm_unpacklo_epi16(a[2 * i], a[2 * i + 1]);
+		t[2 * i + 1] = _mm_unpackhi_epi16(a[2 * i], a[2 * i + 1]);
+	}
+	for (int i = 0; i < 2; i++) {
+		u[4 * i] = _mm_unpacklo_epi32(t[4 * i], t[4 * i + 2]);
+		u[4 * i + 1] = _mm_unpackhi_epi32(t[4 * i], t[4 * i + 2]);
+		u[4 * i + 2] = _mm_unpacklo_epi32(t[4 * i + 1], t[4 * i + 3]);
+		u[4 * i + 3] = _mm_unpackhi_epi32(t[4 * i + 1], t[4 * i + 3]);
+	}
+	for (int i = 0; i < 4; i++) {
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i * outStride),
+				_mm_unpacklo_epi64(u[i], u[i + 4]));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + (2 * i + 1) * outStride),
+				_mm_unpackhi_epi64(u[i], u[i + 4]));
+	}
+}
+#endif
+
+void transpose(const qint16 *in, qint16 *out, size_t rows, size_t cols)
+{
+	for (size_t rowTile = 0; rowTile < rows; rowTile += TransposeTileSize) {
+		auto rowEnd = std::min(rows, rowTile + TransposeTileSize);
+		for (size_t colTile = 0; colTile < cols; colTile += TransposeTileSize) {
+			auto colEnd = std::min(cols, colTile + TransposeTileSize);
+
+			size_t row = rowTile;
+#if defined(BLDS_HAVE_SSE2)
+			for (; row + TransposeBlockSize <= rowEnd; row += TransposeBlockSize) {
+				size_t col = colTile;
+				for (; col + TransposeBlockSize <= colEnd; col += TransposeBlockSize) {
+					transposeBlock(in + row * cols + col, cols, 
+							out + col * rows + row, rows);
+				}
+				for (; col < colEnd; col++) {
+					for (size_t r = row; r < row + TransposeBlockSize; r++) {
+						out[col * rows + r] = in[r * cols + col];
+					}
+				}
+			}
+#endif
+			for (; row < rowEnd; row++) {
+				for (size_t col = colTile; col < colEnd; col++) {
+					out[col * rows + row] = in[row * cols + col];
+				}
+			}
+		}
+	}
+}
+
+void minMax(const qint16 *in, size_t n, qint16 *min, qint16 *max)
+{
+	size_t i = 0;
+	qint16 lo = *min, hi = *max;
+#if defined(BLDS_HAVE_SSE2)
+	if (n >= 8) {
+		__m128i vmin = _mm_set1_epi16(lo);
+		__m128i vmax = _mm_set1_epi16(hi);
+		for (; i + 8 <= n; i += 8) {
+			__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+			vmin = _mm_min_epi16(vmin, x);
+			vmax = _mm_max_epi16(vmax, x);
+		}
+		qint16 lanes[16];
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), vmin);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes + 8), vmax);
+		for (int lane = 0; lane < 8; lane++) {
+			lo = std::min(lo, lanes[lane]);
+			hi = std::max(hi, lanes[lane + 8]);
+		}
+	}
+#elif defined(BLDS_HAVE_NEON)
+	if (n >= 8) {
+		int16x8_t vmin = vdupq_n_s16(lo);
+		int16x8_t vmax = vdupq_n_s16(hi);
+		for (; i + 8 <= n; i += 8) {
+			int16x8_t x = vld1q_s16(in + i);
+			vmin = vminq_s16(vmin, x);
+			vmax = vmaxq_s16(vmax, x);
+		}
+		qint16 lanes[16];
+		vst1q_s16(lanes, vmin);
+		vst1q_s16(lanes + 8, vmax);
+		for (int lane = 0; lane < 8; lane++) {
+			lo = std::min(lo, lanes[lane]);
+			hi = std::max(hi, lanes[lane + 8]);
+		}
+	}
+#endif
+	for (; i < n; i++) {
+		lo = std::min(lo, in[i]);
+		hi = std::max(hi, in[i]);
+	}
+	*min = lo;
+	*max = hi;
+}
+
+} // end samplekernels namespace
+
@@ -9,15 +9,24 @@
 
 #include "libdatafile/include/hidensfile.h"
 
+#include <limits>
+
 Server::Server(QObject* parent) :
 	QObject(parent),
 	source(nullptr),
+	sourceReplaysFile(false),
+	localServer(nullptr),
 	nclients(0),
 	startTime(QDateTime::currentDateTime())
 {
 	readConfigFile();
 	initServer();
+	initLocalServer();
 	initStatusServer();
+	initSharedMemory();
+	initMulticast();
+	initRecordingReader();
+	initRecordingCatalog();
 	QObject::connect(this, &Server::recordingFinished,
 			this, &Server::handleRecordingFinished);
 }
@@ -25,7 +34,7 @@ Server::Server(QObject* parent) :
 Server::~Server()
 {
 	/* Delete file, flushing any remaining data. */
-	file.reset(nullptr);
+	closeFile();
 
 	/* Close HTTP server */
 	statusServer.close();
@@ -35,6 +44,8 @@ Server::~Server()
 
 	/* Close main server */
 	server->close();
+	if (localServer)
+		localServer->close();
 
 	/* Delete source object and stop background thread */
 	if (source)
@@ -61,6 +72,18 @@ void Server::readConfigFile()
 			httpPort = DefaultHttpPort;
 			port = DefaultClientPort;
 			maxConnections = DefaultMaxConnections;
+			zeroCopyThreshold = DefaultZeroCopyThreshold;
+			sharedMemoryName = DefaultSharedMemoryName;
+			sharedMemorySize = DefaultSharedMemorySize;
+			sessionTimeout = DefaultSessionTimeout;
+			sessionHistorySize = DefaultSessionHistorySize;
+			maxPendingRequests = DefaultMaxPendingRequests;
+			streamFrameSize = DefaultStreamFrameSize;
+			readThreads = DefaultReadThreads;
+			prefetchDepth = DefaultPrefetchDepth;
+			cacheSize = DefaultCacheSize;
+			envelopeBinSize = DefaultEnvelopeBinSize;
+			timeIndexInterval = DefaultTimeIndexInterval;
 			return;
 		}
 	}
@@ -114,6 +137,131 @@ void Server::readConfigFile()
 	if (!ok) {
 		qWarning("Invalid maximum data chunk size in blds.conf, using default of %0.2f",
 				MaximumDataRequestChunkSize);
+		maxRequestChunkSize = MaximumDataRequestChunkSize;
+	}
+
+	/* Maximum length of each frame sent in reply to a request. */
+	streamFrameSize = settings.value("stream-frame-size",
+			DefaultStreamFrameSize).toDouble(&ok);
+	if (!ok || (streamFrameSize <= 0)) {
+		qWarning("Invalid stream frame size in blds.conf, using default of %0.2f",
+				DefaultStreamFrameSize);
+		streamFrameSize = DefaultStreamFrameSize;
+	}
+
+	/* Maximum number of queued requests for data per client. */
+	maxPendingRequests = settings.value("max-pending-requests", 
+			DefaultMaxPendingRequests).toInt(&ok);
+	if (!ok) {
+		qWarning("Invalid maximum number of pending requests in blds.conf, "
+				"using default of %d", DefaultMaxPendingRequests);
+		maxPendingRequests = DefaultMaxPendingRequests;
+	}
+
+	/* Number of threads reading requested data. */
+	readThreads = settings.value("read-threads", DefaultReadThreads).toInt(&ok);
+	if (!ok || (readThreads < 1)) {
+		qWarning("Invalid number of read threads in blds.conf, using default of %d",
+				DefaultReadThreads);
+		readThreads = DefaultReadThreads;
+	}
+
+	/* Number of chunks read ahead for clients reading sequentially. */
+	prefetchDepth = settings.value("prefetch-depth", DefaultPrefetchDepth).toInt(&ok);
+	if (!ok || (prefetchDepth < 0)) {
+		qWarning("Invalid prefetch depth in blds.conf, using default of %d",
+				DefaultPrefetchDepth);
+		prefetchDepth = DefaultPrefetchDepth;
+	}
+
+	/* Size of the cache of chunks read from recordings, in MiB. */
+	cacheSize = settings.value("cache-size", DefaultCacheSize).toInt(&ok);
+	if (!ok || (cacheSize < 0)) {
+		qWarning("Invalid cache size in blds.conf, using default of %d MiB",
+				DefaultCacheSize);
+		cacheSize = DefaultCacheSize;
+	}
+
+	/* Size of the finest bins of the envelope of each recording. */
+	envelopeBinSize = settings.value("envelope-bin-size",
+			DefaultEnvelopeBinSize).toUInt(&ok);
+	if (!ok) {
+		qWarning("Invalid envelope bin size in blds.conf, using default of %d",
+				DefaultEnvelopeBinSize);
+		envelopeBinSize = DefaultEnvelopeBinSize;
+	}
+
+	/* Interval between pairs of the time index of each recording. */
+	timeIndexInterval = settings.value("time-index-interval",
+			DefaultTimeIndexInterval).toUInt(&ok);
+	if (!ok) {
+		qWarning("Invalid time index interval in blds.conf, using default of %d ms",
+				DefaultTimeIndexInterval);
+		timeIndexInterval = DefaultTimeIndexInterval;
+	}
+
+	/* Name of the local socket, which is disabled if empty. */
+	localSocketName = settings.value("local-socket", QString()).toString();
+
+	/* Minimum frame size using zero-copy transmission. */
+	zeroCopyThreshold = settings.value("zero-copy-threshold",
+			DefaultZeroCopyThreshold).toLongLong(&ok);
+	if (!ok) {
+		qWarning("Invalid zero-copy threshold in blds.conf, using default of %lld",
+				DefaultZeroCopyThreshold);
+		zeroCopyThreshold = DefaultZeroCopyThreshold;
+	}
+
+	/* Name and size of the shared-memory ring for local clients. */
+	sharedMemoryName = settings.value("shared-memory-name",
+			DefaultSharedMemoryName).toString();
+	if (!sharedMemoryName.startsWith("/")) {
+		sharedMemoryName.prepend("/");
+	}
+	sharedMemorySize = settings.value("shared-memory-size", 
+			DefaultSharedMemorySize).toUInt(&ok);
+	if (!ok) {
+		qWarning("Invalid shared-memory size in blds.conf, using default of %d",
+				DefaultSharedMemorySize);
+		sharedMemorySize = DefaultSharedMemorySize;
+	}
+
+	/* Multicast publication of the live stream, disabled if no group. */
+	multicastGroup = settings.value("multicast-group", QString()).toString();
+	multicastPort = settings.value("multicast-port", DefaultMulticastPort).toUInt(&ok);
+	if (!ok) {
+		qWarning("Invalid multicast port in blds.conf, using default of %d",
+				DefaultMulticastPort);
+		multicastPort = DefaultMulticastPort;
+	}
+	multicastTtl = settings.value("multicast-ttl", DefaultMulticastTtl).toInt(&ok);
+	if (!ok) {
+		qWarning("Invalid multicast TTL in blds.conf, using default of %d",
+				DefaultMulticastTtl);
+		multicastTtl = DefaultMulticastTtl;
+	}
+	multicastDatagramSize = settings.value("multicast-datagram-size",
+			DefaultMulticastDatagramSize).toInt(&ok);
+	if (!ok) {
+		qWarning("Invalid multicast datagram size in blds.conf, using default of %d",
+				DefaultMulticastDatagramSize);
+		multicastDatagramSize = DefaultMulticastDatagramSize;
+	}
+	multicastInterface = settings.value("multicast-interface", QString()).toString();
+
+	/* Sessions with which disconnected clients may resume. */
+	sessionTimeout = settings.value("session-timeout", DefaultSessionTimeout).toUInt(&ok);
+	if (!ok) {
+		qWarning("Invalid session timeout in blds.conf, using default of %d",
+				DefaultSessionTimeout);
+		sessionTimeout = DefaultSessionTimeout;
+	}
+	sessionHistorySize = settings.value("session-history-size",
+			DefaultSessionHistorySize).toUInt(&ok);
+	if (!ok) {
+		qWarning("Invalid session history size in blds.conf, using default of %d",
+				DefaultSessionHistorySize);
+		sessionHistorySize = DefaultSessionHistorySize;
 	}
 
 	/* Use default save directory to start */
@@ -137,6 +285,45 @@ void Server::initServer()
 }
 
 
+/*
+ * Setup the local socket server used for communication with
+ * clients on the same machine.
+ */
+void Server::initLocalServer()
+{
+	if (localSocketName.isEmpty()) {
+		return;
+	}
+	localServer = new QLocalServer(this);
+
+	/* A socket left behind by a previous instance is removed, but only
+	 * if nothing accepts connections on it, so that a running instance
+	 * is never replaced.
+	 */
+	bool listening = localServer->listen(localSocketName);
+	if (!listening && (localServer->serverError() == QAbstractSocket::AddressInUseError)) {
+		QLocalSocket probe;
+		probe.connectToServer(localSocketName);
+		if (probe.waitForConnected(LocalSocketProbeTimeout)) {
+			probe.disconnectFromServer();
+		} else {
+			QLocalServer::removeServer(localSocketName);
+			listening = localServer->listen(localSocketName);
+		}
+	}
+	if (!listening) {
+		qWarning().noquote() << "Could not initialize local BLDS server at"
+			<< localSocketName << ":" << localServer->errorString();
+		localServer->deleteLater();
+		localServer = nullptr;
+		return;
+	}
+	qInfo().noquote() << "Data server listening on local socket" 
+		<< localServer->fullServerName();
+	QObject::connect(localServer, &QLocalServer::newConnection,
+			this, &Server::handleNewLocalClient);
+}
+
 /*
  * Setup the HTTP server used to serve status requests.
  */
@@ -151,6 +338,71 @@ void Server::initStatusServer()
 		statusServer.serverPort() << ".";
 }
 
+/*
+ * Setup the shared-memory ring used to publish frames to local clients.
+ */
+void Server::initSharedMemory()
+{
+	if (sharedMemorySize == 0) {
+		return;
+	}
+#ifdef Q_OS_UNIX
+	try {
+		sharedMemory.reset(new SharedMemoryRing(sharedMemoryName,
+				static_cast<quint64>(sharedMemorySize) << 20));
+		qInfo().nospace() << "Publishing data frames to shared memory at "
+			<< sharedMemoryName << " (" << sharedMemorySize << " MiB).";
+	} catch (std::runtime_error& e) {
+		qWarning().noquote() << "Could not initialize shared-memory ring:" << e.what();
+	}
+#else
+	qWarning("Shared-memory publication is not supported on this platform.");
+#endif
+}
+
+/*
+ * Start the pool of threads reading requested data for clients.
+ */
+void Server::initRecordingReader()
+{
+	recordingReader = new RecordingReader(readThreads, prefetchDepth,
+			static_cast<qint64>(cacheSize) << 20, this);
+	QObject::connect(recordingReader, &RecordingReader::opened,
+			this, &Server::handleRecordingOpened);
+	QObject::connect(recordingReader, &RecordingReader::dataRead,
+			this, &Server::handleRecordingDataRead);
+	QObject::connect(recordingReader, &RecordingReader::readFailed,
+			this, &Server::handleRecordingReadFailed);
+}
+
+/*
+ * Start indexing the recordings in the save directory.
+ */
+void Server::initRecordingCatalog()
+{
+	recordingCatalog = new RecordingCatalog(this);
+	recordingCatalog->setDirectory(saveDirectory);
+}
+
+/*
+ * Setup publication of live frames to a multicast group.
+ */
+void Server::initMulticast()
+{
+	if (multicastGroup.isEmpty()) {
+		return;
+	}
+	try {
+		multicast.reset(new MulticastPublisher(QHostAddress(multicastGroup),
+				multicastPort, multicastTtl, multicastDatagramSize,
+				multicastInterface));
+		qInfo().noquote() << "Publishing live data frames to multicast group"
+			<< multicast->address();
+	} catch (std::invalid_argument& e) {
+		qWarning().noquote() << "Could not initialize multicast publication:" << e.what();
+	}
+}
+
 /*
  * Base handler for HTTP requests. Just delegates to appropriate sub-handler.
  */
@@ -161,6 +413,14 @@ void Server::handleHttpRequest(Tufao::HttpServerRequest& request,
 		serveSourceStatus(request, response);
 	} else if (request.url().toString() == "/status") {
 		serveStatus(request, response);
+	} else if (request.url().toString() == "/stream") {
+		serveStreamStatus(request, response);
+	} else if (request.url().toString() == "/reads") {
+		serveReadStatus(request, response);
+	} else if (request.url().toString() == "/cache") {
+		serveCacheStatus(request, response);
+	} else if (request.url().toString() == "/recordings") {
+		serveRecordings(request, response);
 	} else {
 		response.writeHead(404, "Not Found");
 		response.end();
@@ -249,6 +509,120 @@ void Server::serveStatus(Tufao::HttpServerRequest& request,
 	response.end();
 }
 
+/*
+ * Handle HTTP requests for the counters of reads of requested data.
+ */
+void Server::serveReadStatus(Tufao::HttpServerRequest& request,
+		Tufao::HttpServerResponse& response)
+{
+	if ( (request.method() != "GET") && (request.method() != "HEAD") ) {
+		response.writeHead(405, "Method Not Allowed");
+		response.end();
+		return;
+	}
+	response.writeHead(200, "OK");
+
+	if (request.method() == "GET") {
+		auto json = QJsonObject::fromVariantMap(recordingReader->status());
+		response.write(QJsonDocument(json).toJson());
+	}
+	response.end();
+}
+
+/*
+ * Handle HTTP requests for the counters of the cache of chunks read.
+ */
+void Server::serveCacheStatus(Tufao::HttpServerRequest& request,
+		Tufao::HttpServerResponse& response)
+{
+	if ( (request.method() != "GET") && (request.method() != "HEAD") ) {
+		response.writeHead(405, "Method Not Allowed");
+		response.end();
+		return;
+	}
+	response.writeHead(200, "OK");
+
+	if (request.method() == "GET") {
+		auto json = QJsonObject::fromVariantMap(recordingReader->cacheStatus());
+		response.write(QJsonDocument(json).toJson());
+	}
+	response.end();
+}
+
+/*
+ * Handle HTTP requests for the recordings in the save directory.
+ */
+void Server::serveRecordings(Tufao::HttpServerRequest& request,
+		Tufao::HttpServerResponse& response)
+{
+	if ( (request.method() != "GET") && (request.method() != "HEAD") ) {
+		response.writeHead(405, "Method Not Allowed");
+		response.end();
+		return;
+	}
+	response.writeHead(200, "OK");
+
+	if (request.method() == "GET") {
+		QJsonArray recordings;
+		for (auto& entry : recordingCatalog->entries()) {
+			QJsonObject recording {
+				{ "name", entry.name },
+				{ "size", entry.size },
+				{ "created", entry.created.toString(Qt::ISODate) },
+				{ "modified", entry.modified.toString(Qt::ISODate) },
+				{ "indexed", entry.indexed }
+			};
+			if (entry.indexed && entry.error.isEmpty()) {
+				recording.insert("sample-rate", entry.sampleRate);
+				recording.insert("nsamples", static_cast<qint64>(entry.nsamples));
+				recording.insert("nchannels", static_cast<qint64>(entry.nchannels));
+				recording.insert("length", entry.sampleRate > 0 ?
+						entry.nsamples / entry.sampleRate : 0.);
+				recording.insert("configuration-hash",
+						QString::fromLatin1(entry.configurationHash));
+			} else if (entry.indexed) {
+				recording.insert("error", entry.error);
+			}
+			recordings.append(recording);
+		}
+		QJsonObject json {
+			{ "save-directory", saveDirectory },
+			{ "pending", recordingCatalog->pending() },
+			{ "recordings", recordings }
+		};
+		response.write(QJsonDocument(json).toJson());
+	}
+	response.end();
+}
+
+/*
+ * Handle HTTP requests for the sequence and gap counters of the data stream.
+ */
+void Server::serveStreamStatus(Tufao::HttpServerRequest& request,
+		Tufao::HttpServerResponse& response)
+{
+	if ( (request.method() != "GET") && (request.method() != "HEAD") ) {
+		response.writeHead(405, "Method Not Allowed");
+		response.end();
+		return;
+	}
+	response.writeHead(200, "OK");
+
+	if (request.method() == "GET") {
+		auto json = QJsonObject::fromVariantMap(streamMonitor.status());
+		QJsonObject frames;
+		for (auto& c : clients) {
+			frames.insert(c->address(), static_cast<qint64>(c->framesSent()));
+		}
+		json.insert("frames-sent", frames);
+		if (multicast) {
+			json.insert("multicast", QJsonObject::fromVariantMap(multicast->status()));
+		}
+		response.write(QJsonDocument(json).toJson());
+	}
+	response.end();
+}
+
 /*
  * Handler for dealing with new remote client connections.
  */
@@ -265,6 +639,27 @@ void Server::handleNewClient()
 
 	/* Create Client object to manage communication with this new client */
 	auto *client = new Client(socket);
+	client->setZeroCopyThreshold(zeroCopyThreshold);
+	addClient(client);
+}
+
+/*
+ * Handler for dealing with new clients on the local socket.
+ */
+void Server::handleNewLocalClient()
+{
+	auto socket = localServer->nextPendingConnection();
+	if (nclients == maxConnections) {
+		qWarning() << "Received connection attempt while already at maximum number" 
+			<< " of connected clients. Ignoring the connection.";
+		socket->deleteLater();
+		return;
+	}
+	addClient(new Client(socket));
+}
+
+void Server::addClient(Client *client)
+{
 	connectClientSignals(client);
 	nclients++;
 	clients.append(client);
@@ -278,6 +673,33 @@ void Server::handleClientDisconnection(Client *client)
 {
 	qInfo().noquote() << "Client disconnected" << client->address();
 	QObject::disconnect(client, 0, 0, 0);
+
+	/* Close any recording the client opened. Its requests for data
+	 * cannot be resumed from the current recording.
+	 */
+	bool opened = openRecordings.remove(client);
+	if (opened) {
+		client->cancelPendingRequests(0, 0, std::numeric_limits<quint64>::max());
+	}
+
+	/* Keep the client's session for a while, so that it may resume. Requests
+	 * being read are kept with it, before the reader discards them.
+	 */
+	if (auto session = client->session()) {
+		client->detachSession(opened ? QList<Client::DataRequest>() :
+				recordingReader->requests(client));
+		auto token = session->token();
+		qint64 timeout = 1000 * static_cast<qint64>(sessionTimeout);
+		QTimer::singleShot(timeout, Qt::PreciseTimer, this, [this, token, timeout]() -> void {
+			auto session = sessions.value(token);
+			if (session && !session->attached() && (session->detachedFor() >= timeout)) {
+				sessions.remove(token);
+				qInfo().noquote() << "Session" << token << "expired";
+			}
+		});
+	}
+	recordingReader->removeClient(client);
+	streamReadsInFlight.remove(client);
 	clients.removeOne(client);
 	client->deleteLater();
 	nclients--;
@@ -333,6 +755,7 @@ void Server::createFile()
 	/* Create the data file */
 	auto path = pathInfo.absoluteFilePath().toStdString();
 	auto type = sourceStatus["device-type"].toString();
+	QMutexLocker lock(&hdf5Mutex());
 	try {
 		if (type.startsWith("hidens")) {
 			auto nchannels = sourceStatus["nchannels"].toInt();
@@ -354,6 +777,34 @@ void Server::createFile()
 	file->setGain(sourceStatus["gain"].toFloat());
 	file->setOffset(sourceStatus["adc-range"].toFloat());
 	file->setDate(QDateTime::currentDateTime().toString(Qt::ISODate).toStdString());
+	lock.unlock();
+
+	/* Cache chunks under the path by which clients later open the file. */
+	auto canonicalPath = QFileInfo(fullpath).canonicalFilePath();
+	recordingReader->setLiveFile(file, canonicalPath,
+			sourceStatus["gain"].toFloat(), sourceStatus["adc-range"].toFloat());
+	recordingCatalog->setActiveFile(canonicalPath);
+	if (envelopeBinSize) {
+		envelopePath = EnvelopePyramid::sidecarPath(canonicalPath);
+	}
+
+	/* Index the samples by the time they arrive, from now on. */
+	if (timeIndexInterval) {
+		try {
+			timeIndex = TimeIndex::create(TimeIndex::sidecarPath(canonicalPath));
+			nextTimeIndexEntry = 0;
+			lastArrival = { 0, 0 };
+		} catch (std::runtime_error& e) {
+			qWarning().noquote() << "Could not create time index of the recording:"
+				<< e.what();
+		}
+	}
+
+#ifdef Q_OS_UNIX
+	if (sharedMemory) {
+		sharedMemory->setSampleRate(file->sampleRate());
+	}
+#endif
 }
 
 void Server::initSource()
@@ -401,8 +852,20 @@ void Server::initSource()
 void Server::deleteSource()
 {
 	QObject::disconnect(source, 0, 0, 0);
+
+	/* Requested data may be read in the pool again once the source,
+	 * and any file it replays, is gone, unless another source replaying
+	 * a file has been created meanwhile.
+	 */
+	QObject::connect(source, &QObject::destroyed, recordingReader, [this]() -> void {
+		if (!source || !sourceReplaysFile) {
+			recordingReader->setSynchronous(false);
+			recordingCatalog->setSuspended(false);
+		}
+	});
 	source->deleteLater();
 	source = nullptr;
+	sourceReplaysFile = false;
 }
 
 void Server::handleSourceGetResponse(Client* client, const QString& param, 
@@ -499,8 +962,10 @@ void Server::handleSourceStreamStarted(Client *client, bool success, const QStri
 	if (success) {
 		qInfo().noquote() << "Recording started by client at" << client->address();
 		qInfo().noquote() << "Recording data to" << saveDirectory + "/" + saveFile;
+		streamMonitor.start(file->sampleRate(), 
+				sourceStatus.value("read-interval", readInterval).toUInt());
 	} else {
-		file.reset(nullptr);
+		closeFile();
 		saveFile.clear();
 		QObject::disconnect(source, &datasource::BaseSource::dataAvailable,
 				this, &Server::handleNewDataAvailable);
@@ -515,7 +980,9 @@ void Server::handleSourceStreamStopped(Client *client, bool success, const QStri
 	if (success) {
 		qInfo().noquote() << "Recording stopped after" << file->length() 
 			<< "seconds by client at" << client->address();
-		file.reset(nullptr);
+		stopStreamMonitor();
+		flushLiveData();
+		closeFile();
 		saveFile.clear();
 	} else {
 		qWarning().noquote() << "Could not stop recording:" << msg;
@@ -538,6 +1005,7 @@ void Server::handleNewDataAvailable(datasource::Samples samples)
 {
 	/* Append data to file */
 	try {
+		LiveWriteLocker lock;
 		file->setData(file->nsamples(), file->nsamples() + samples.n_rows, samples);
 	} catch (H5::Exception& e) {
 		/* Error writing data to file. */
@@ -552,8 +1020,11 @@ void Server::handleNewDataAvailable(datasource::Samples samples)
 		return;
 	}
 
+	updateTimeIndex();
+	updateEnvelope(samples);
+	auto sequence = streamMonitor.addChunk(samples.n_rows);
+	sendDataToClients(samples, sequence);
 	if (nclients) {
-		sendDataToClients(samples);
 		servicePendingDataRequests();
 	}
 
@@ -561,7 +1032,57 @@ void Server::handleNewDataAvailable(datasource::Samples samples)
 	checkRecordingFinished();
 }
 
-void Server::sendDataToClients(datasource::Samples& samples)
+void Server::updateEnvelope(const datasource::Samples& samples)
+{
+	/* Samples beyond the length of the recording are not summarized, so
+	 * leave room for those read after it is reached.
+	 */
+	if (!envelope && !envelopePath.isEmpty()) {
+		auto capacity = static_cast<quint64>(
+				(recordingLength + 1) * file->sampleRate()) + samples.n_rows;
+		try {
+			envelope = EnvelopePyramid::create(envelopePath, samples.n_cols,
+					envelopeBinSize, capacity);
+		} catch (std::runtime_error& e) {
+			qWarning().noquote() << "Could not create envelope of the recording:"
+				<< e.what();
+		}
+		envelopePath.clear();
+	}
+	if (!envelope) {
+		return;
+	}
+	try {
+		envelope->append(samples);
+	} catch (std::exception& e) {
+		qWarning().noquote() << "Could not update envelope of the recording:"
+			<< e.what();
+		envelope.reset();
+	}
+}
+
+void Server::updateTimeIndex()
+{
+	if (!timeIndex) {
+		return;
+	}
+	lastArrival = { timeIndex->elapsed(), static_cast<quint64>(file->nsamples()) };
+	if (lastArrival.time < nextTimeIndexEntry) {
+		return;
+	}
+	try {
+		timeIndex->append(lastArrival.time, lastArrival.sample);
+	} catch (std::exception& e) {
+		qWarning().noquote() << "Could not update time index of the recording:"
+			<< e.what();
+		timeIndex.reset();
+		return;
+	}
+	nextTimeIndexEntry = lastArrival.time +
+		static_cast<qint64>(timeIndexInterval) * 1000000;
+}
+
+void Server::sendDataToClients(datasource::Samples& samples, quint64 sequence)
 {
 	/* Gather current timing information */
 	auto sr = file->sampleRate();
@@ -574,35 +1095,48 @@ void Server::sendDataToClients(datasource::Samples& samples)
 	 * This uses the move-constructor of the underlying data, so
 	 * is very fast.
 	 */
-	DataFrame frame {start, stop, std::move(samples) };
+	DataFrame frame { start, stop, static_cast<quint64>(startSample),
+			static_cast<quint64>(stopSample), std::move(samples) };
+	setFrameScale(frame);
+
+#ifdef Q_OS_UNIX
+	if (sharedMemory && !sharedMemory->publish(frame)) {
+		qWarning() << "Data frame is larger than the shared-memory ring, "
+			"increase shared-memory-size in blds.conf.";
+	}
+#endif
+
+	if (multicast) {
+		multicast->publish(frame, sequence);
+	}
+
 	for (auto client : clients) {
 		if (client->requestedAllData()) {
-			client->sendDataFrame(frame);
+			client->sendLiveDataFrame(frame);
+		}
+	}
+
+	/* Keep live frames for disconnected clients, to be replayed. */
+	for (const auto& session : sessions) {
+		if (!session->attached() && session->subscription().requestedAllData) {
+			session->record(frame, false);
 		}
 	}
 }
 
+void Server::setFrameScale(DataFrame& frame) const
+{
+	frame.setScale(sourceStatus["gain"].toFloat(), 
+			sourceStatus["adc-range"].toFloat());
+}
+
 void Server::servicePendingDataRequests()
 {
 	/* Service any outstanding request for data that can now be filled. */
-	auto sr = file->sampleRate();
-	auto currentTime = file->length();
-	datasource::Samples samples;
+	auto available = static_cast<quint64>(file->nsamples());
 	for (auto client : clients) {
-		while (client->numServicableRequests(currentTime) > 0) {
-			auto request = client->nextPendingRequest();
-			auto begin = static_cast<int>(request.start * sr);
-			auto end = static_cast<int>(request.stop * sr);
-			try {
-				file->data(begin, end, samples);
-			} catch (std::logic_error& e) {
-				client->sendErrorMessage(QString("Could not read requested "
-							"data from file: %1").arg(
-							e.what()).toUtf8());
-				continue;
-			}
-			client->sendDataFrame({request.start, request.stop, 
-					std::move(samples)});
+		while (client->numServicableRequests(available) > 0) {
+			sendRequestedData(client, client->nextPendingRequest());
 		}
 	}
 }
@@ -623,6 +1157,16 @@ void Server::handleClientCreateSourceMessage(Client *client,
 			 * if the source couldn't be reached or created for some other 
 			 * reason.
 			 */
+			/* Sources replaying a file read it through HDF5 in this
+			 * thread, without holding hdf5Mutex(). Requested data is then
+			 * read in this thread as well, so that the two never call
+			 * into the library at the same time.
+			 */
+			sourceReplaysFile = (type == "file");
+			if (sourceReplaysFile) {
+				recordingReader->setSynchronous(true);
+				recordingCatalog->setSuspended(true);
+			}
 			source = datasource::create(QString::fromUtf8(type), 
 					QString::fromUtf8(location), static_cast<int>(readInterval));
 
@@ -640,6 +1184,9 @@ void Server::handleClientCreateSourceMessage(Client *client,
 			return;
 
 		} catch (std::invalid_argument& err) {
+			sourceReplaysFile = false;
+			recordingReader->setSynchronous(false);
+			recordingCatalog->setSuspended(false);
 			QByteArray msg { "Could not create source! " };
 			msg.append(err.what());
 			qWarning().noquote() << msg;
@@ -699,6 +1246,7 @@ void Server::handleClientSetServerParamMessage(Client *client,
 			auto dir = data.toString();
 			if (QFileInfo::exists(dir)) {
 				saveDirectory = dir;
+				recordingCatalog->setDirectory(saveDirectory);
 				qInfo().noquote() << "Client at" << client->address() 
 					<< "set the save directory to" << saveDirectory;
 				success = true;
@@ -711,6 +1259,7 @@ void Server::handleClientSetServerParamMessage(Client *client,
 					qInfo().noquote() << "Created requested save directory"
 						<< dir;
 					saveDirectory = d.absolutePath();
+					recordingCatalog->setDirectory(saveDirectory);
 				} else {
 					success = false;
 					qWarning().noquote() << "Could not create requested"
@@ -768,6 +1317,16 @@ void Server::handleClientGetServerParamMessage(Client *client, const QByteArray&
 	} else if (param == "source-location") {
 		valid = true;
 		data = sourceStatus["location"].toString().toUtf8();
+	} else if (param == "multicast-address") {
+		valid = true;
+		data = (multicast) ? multicast->address().toUtf8() : QByteArray();
+	} else if (param == "shared-memory-name") {
+		valid = true;
+#ifdef Q_OS_UNIX
+		data = (sharedMemory) ? sharedMemory->name().toUtf8() : QByteArray();
+#else
+		data = QByteArray();
+#endif
 	} else {
 		valid = false;
 		data = ("Unknown parameter type: " + param);
@@ -888,52 +1447,437 @@ void Server::handleClientStopRecordingMessage(Client *client)
 	client->sendStopRecordingResponse(false, msg);
 }
 
-void Server::handleClientDataRequest(Client *client, float start, float stop)
+void Server::handleClientDataRequest(Client *client, float start, float stop,
+		quint32 id, quint32 timeout)
 {
-	if (file) {
-		if (stop > recordingLength) {
-			client->sendErrorMessage(
-					"Cannot request more data than will exist in the recording");
-		} else {
+	/* Requests are read from the client's open recording, if any. */
+	auto recording = openRecordings.constFind(client);
+	bool opened = (recording != openRecordings.constEnd());
+	if (!opened && !file) {
+		client->sendErrorMessage("There is no active recording, data cannot be requested.");
+		return;
+	}
 
-			/* Basic verification of the request */
-			if (!verifyChunkRequest(start, stop)) {
-				client->sendErrorMessage(
-						QString("The requested data chunk is invalid. Both values must "
-						"be positive, the second less than the first, and the resulting "
-						" chunk size must be less than %1. The request was for [%2, %3)"
-						).arg(maxRequestChunkSize).arg(start, 0, 'f', 1).arg(
-						stop, 0, 'f', 1).toUtf8());
-				return;
-			}
+	if (!opened && (stop > recordingLength)) {
+		client->sendErrorMessage(
+				"Cannot request more data than will exist in the recording");
+		return;
+	}
 
-			auto sr = file->sampleRate();
-			auto endSample = static_cast<int>(stop * sr);
-			if (file->nsamples() >= endSample) {
+	/* Basic verification of the request */
+	auto sr = opened ? recording->sampleRate : file->sampleRate();
+	if (!verifyChunkRequest(start, stop, sr)) {
+		client->sendErrorMessage(
+				QString("The requested data chunk is invalid. Both values must "
+				"be positive, the second less than the first, and the resulting "
+				" chunk size must be less than %1. The request was for [%2, %3)"
+				).arg(maxRequestChunkSize).arg(start, 0, 'f', 1).arg(
+				stop, 0, 'f', 1).toUtf8());
+		return;
+	}
 
-				/* If data is currently available, send it immediately */
-				auto startSample = static_cast<int>(start * sr);
-				DataFrame::Samples data;
+	Client::DataRequest request { start, stop,
+			static_cast<quint64>(start * sr), static_cast<quint64>(stop * sr),
+			false, id, Client::deadlineAfter(timeout) };
+	if (opened) {
+		readOpenRecording(client, request);
+	} else {
+		handleVerifiedDataRequest(client, request);
+	}
+}
 
-				try {
-					file->data(startSample, endSample, data);
-				} catch (std::logic_error& e) {
-					client->sendErrorMessage(QString("Could not read data "
-								"from recording file: %1").arg(e.what()).toUtf8());
-					return;
-				}
-				client->sendDataFrame(DataFrame{start, stop, std::move(data)});
+void Server::handleClientSampleDataRequest(Client *client, quint64 start, quint64 stop,
+		quint32 id, quint32 timeout)
+{
+	/* Requests are read from the client's open recording, if any. */
+	auto recording = openRecordings.constFind(client);
+	bool opened = (recording != openRecordings.constEnd());
+	if (!opened && !file) {
+		client->sendErrorMessage("There is no active recording, data cannot be requested.");
+		return;
+	}
 
-			} else {
-				/* Data is not yet available, add this to the list of pending
-				 * data requests.
-				 */
-				client->addPendingDataRequest(start, stop);
-			}
+	auto sr = opened ? recording->sampleRate : file->sampleRate();
+	if (!opened && (stop > static_cast<quint64>(recordingLength * sr))) {
+		client->sendErrorMessage(
+				"Cannot request more data than will exist in the recording");
+		return;
+	}
+
+	if (!verifySampleChunkRequest(start, stop, sr)) {
+		client->sendErrorMessage(
+				QString("The requested data chunk is invalid. The stop sample must "
+				"be greater than the start sample, and the resulting chunk size "
+				"must be less than %1 seconds. The request was for [%2, %3)"
+				).arg(maxRequestChunkSize).arg(start).arg(stop).toUtf8());
+		return;
+	}
+
+	Client::DataRequest request { static_cast<float>(start / sr),
+			static_cast<float>(stop / sr), start, stop, true,
+			id, Client::deadlineAfter(timeout) };
+	if (opened) {
+		readOpenRecording(client, request);
+	} else {
+		handleVerifiedDataRequest(client, request);
+	}
+}
+
+int Server::countQueuedRequests(Client *client) const
+{
+	return client->countPendingRequests() + client->countStreamedRequests() +
+		recordingReader->requests(client).size();
+}
+
+bool Server::acceptRequest(Client *client)
+{
+	if (countQueuedRequests(client) < maxPendingRequests) {
+		return true;
+	}
+	client->sendErrorMessage(QString("Too many pending requests for data, "
+				"at most %1 may be queued.").arg(maxPendingRequests).toUtf8());
+	return false;
+}
+
+void Server::handleVerifiedDataRequest(Client *client, 
+		const Client::DataRequest& request)
+{
+	/* Requests waiting for data, being read and being streamed all
+	 * count against the same limit.
+	 */
+	if (!acceptRequest(client)) {
+		return;
+	}
+	if (static_cast<quint64>(file->nsamples()) >= request.stopSample) {
+		/* If data is currently available, send it immediately */
+		sendRequestedData(client, request);
+	} else {
+		/* Data is not yet available, add this to the list of pending
+		 * data requests.
+		 */
+		client->addPendingDataRequest(request);
+	}
+}
+
+void Server::sendRequestedData(Client *client, const Client::DataRequest& request)
+{
+	/* Requests longer than a single frame are streamed as several. */
+	auto maxSamples = static_cast<quint64>(streamFrameSize * file->sampleRate());
+	if (request.stopSample - request.startSample > maxSamples) {
+		client->addStreamedRequest(request);
+		return;
+	}
+
+	recordingReader->read(client, request);
+}
+
+void Server::readOpenRecording(Client *client, const Client::DataRequest& request)
+{
+	/* Finished recordings do not grow, so there is nothing to wait for. */
+	const auto& recording = openRecordings[client];
+	if (request.stopSample > recording.nsamples) {
+		client->sendErrorMessage(QString("Cannot request data past the end of "
+				"the recording, which has %1 samples.").arg(
+				recording.nsamples).toUtf8());
+		return;
+	}
+	if (!acceptRequest(client)) {
+		return;
+	}
+
+	auto maxSamples = static_cast<quint64>(streamFrameSize * recording.sampleRate);
+	if (request.stopSample - request.startSample > maxSamples) {
+		client->addStreamedRequest(request);
+		return;
+	}
+	recordingReader->read(client, request);
+}
+
+void Server::handleClientOpenRecordingMessage(Client *client, const QString& path)
+{
+	QDir saveDir(saveDirectory);
+	QFileInfo info(saveDir.absoluteFilePath(path));
+	auto canonicalPath = info.canonicalFilePath();
+	if (!info.isFile() ||
+			!canonicalPath.startsWith(saveDir.canonicalPath() + "/")) {
+		client->sendOpenRecordingResponse(false, 0., 0, 0, QString("There is "
+				"no recording %1 in the save directory.").arg(path).toUtf8());
+		return;
+	}
+	if (file && (canonicalPath ==
+				QFileInfo(saveDir.absoluteFilePath(saveFile)).canonicalFilePath())) {
+		client->sendOpenRecordingResponse(false, 0., 0, 0,
+				"The current recording cannot be opened until it is finished.");
+		return;
+	}
+	recordingReader->open(client, canonicalPath);
+}
+
+void Server::handleRecordingOpened(Client *client, bool success,
+		const QString& msg, const RecordingReader::Info& info)
+{
+	if (!clients.contains(client)) {
+		return;
+	}
+	if (!success) {
+		client->sendOpenRecordingResponse(false, 0., 0, 0, msg.toUtf8());
+		return;
+	}
+	client->cancelPendingRequests(0, 0, std::numeric_limits<quint64>::max());
+	streamReadsInFlight.remove(client);
+	openRecordings.insert(client, info);
+	qInfo().noquote() << "Client at" << client->address()
+		<< "opened recording" << info.path;
+	client->sendOpenRecordingResponse(true, info.sampleRate,
+			info.nsamples, info.nchannels);
+}
+
+void Server::handleClientCloseRecordingMessage(Client *client)
+{
+	if (!openRecordings.remove(client)) {
+		client->sendCloseRecordingResponse(false, "There is no open recording.");
+		return;
+	}
+	recordingReader->close(client);
+	client->cancelPendingRequests(0, 0, std::numeric_limits<quint64>::max());
+	streamReadsInFlight.remove(client);
+	client->sendCloseRecordingResponse(true);
+}
+
+void Server::handleClientGetRecordingsMessage(Client *client)
+{
+	client->sendRecordingsResponse(recordingCatalog->entries());
+}
+
+void Server::handleClientExportMessage(Client *client, quint64 start, quint64 stop,
+		quint32 firstChannel, quint32 nchannels, quint32 id)
+{
+	auto recording = openRecordings.constFind(client);
+	bool opened = (recording != openRecordings.constEnd());
+	if (!opened && !file) {
+		client->sendExportResponse(false, id, 0, 0, 0,
+				"There is no open or active recording to export.");
+		return;
+	}
+	if (client->isExporting()) {
+		client->sendExportResponse(false, id, 0, 0, 0, "An export is already "
+				"in progress, and must finish or be cancelled first.");
+		return;
+	}
+
+	quint64 available = opened ? recording->nsamples :
+		static_cast<quint64>(file->nsamples());
+	quint32 channels = opened ? recording->nchannels :
+		static_cast<quint32>(file->nchannels());
+	if (stop == 0) {
+		stop = available;
+	}
+	if (nchannels == 0) {
+		nchannels = (firstChannel < channels) ? channels - firstChannel : 0;
+	}
+	if ((start >= stop) || (stop > available)) {
+		client->sendExportResponse(false, id, 0, 0, 0, QString("The requested "
+				"samples are invalid. The stop sample must be greater than the "
+				"start sample, and at most the %1 samples available. The request "
+				"was for [%2, %3).").arg(available).arg(start).arg(stop).toUtf8());
+		return;
+	}
+	if ((nchannels == 0) || (static_cast<quint64>(firstChannel) + nchannels > channels)) {
+		client->sendExportResponse(false, id, 0, 0, 0, QString("The requested "
+				"channels are invalid, the recording has %1 channels.").arg(
+				channels).toUtf8());
+		return;
+	}
+
+	client->sendExportResponse(true, id, start, stop, nchannels);
+	client->startExport(id, start, stop, firstChannel, nchannels);
+}
+
+void Server::handleClientGetEnvelopeMessage(Client *client, quint64 start, quint64 stop,
+		quint32 width, quint32 firstChannel, quint32 nchannels, quint32 id)
+{
+	/* Sidecars of finished recordings are opened for each request, and
+	 * only their header and the requested bins are read.
+	 */
+	auto recording = openRecordings.constFind(client);
+	bool opened = (recording != openRecordings.constEnd());
+	std::unique_ptr<EnvelopePyramid> sidecar;
+	EnvelopePyramid *pyramid = envelope.get();
+	float gain = sourceStatus["gain"].toFloat();
+	float offset = sourceStatus["adc-range"].toFloat();
+	if (opened) {
+		try {
+			sidecar = EnvelopePyramid::open(EnvelopePyramid::sidecarPath(recording->path));
+		} catch (std::runtime_error& e) {
+			client->sendEnvelopeFailure(id, QString("The recording has no "
+					"envelope: %1").arg(e.what()).toUtf8());
+			return;
 		}
+		pyramid = sidecar.get();
+		gain = recording->gain;
+		offset = recording->offset;
+	} else if (!pyramid) {
+		client->sendEnvelopeFailure(id, "There is no open or active recording "
+				"with an envelope.");
+		return;
+	}
+
+	if (stop == 0) {
+		stop = pyramid->nsamples();
+	}
+	if ((nchannels == 0) && (firstChannel < pyramid->nchannels())) {
+		nchannels = pyramid->nchannels() - firstChannel;
+	}
+	try {
+		client->sendEnvelopeResponse(id, pyramid->envelope(start, stop, width,
+				firstChannel, nchannels), gain, offset);
+	} catch (std::logic_error&) {
+		client->sendEnvelopeFailure(id, QString("The requested envelope is "
+				"invalid. The stop sample must be greater than the start sample, "
+				"the width at most %1, and the recording has %2 channels.").arg(
+				EnvelopePyramid::MaxWidth).arg(pyramid->nchannels()).toUtf8());
+	} catch (std::runtime_error& e) {
+		client->sendEnvelopeFailure(id, e.what());
+	}
+}
+
+void Server::handleClientTimeToSampleMessage(Client *client, qint64 time, quint32 id)
+{
+	auto recording = openRecordings.constFind(client);
+	std::unique_ptr<TimeIndex> sidecar;
+	TimeIndex *index = timeIndex.get();
+	if (recording != openRecordings.constEnd()) {
+		try {
+			sidecar = TimeIndex::open(TimeIndex::sidecarPath(recording->path));
+		} catch (std::runtime_error& e) {
+			client->sendTimeToSampleResponse(false, id, 0, 0, 0, QString("The "
+					"recording has no time index: %1").arg(e.what()).toUtf8());
+			return;
+		}
+		index = sidecar.get();
+	} else if (!index) {
+		client->sendTimeToSampleResponse(false, id, 0, 0, 0, "There is no open "
+				"or active recording with a time index.");
+		return;
+	}
+
+	try {
+		auto samples = index->lookup(time);
+		client->sendTimeToSampleResponse(true, id, samples.start,
+				samples.stop, samples.sample);
+	} catch (std::out_of_range& e) {
+		client->sendTimeToSampleResponse(false, id, 0, 0, 0, e.what());
+	}
+}
+
+void Server::handleClientExportRawMessage(Client *client, quint64 start, quint64 stop)
+{
+	auto recording = openRecordings.constFind(client);
+	if (recording == openRecordings.constEnd()) {
+		client->sendExportRawFailure("A recording must be opened to be exported.");
+		return;
+	}
+	auto mapping = recordingReader->mapping(client);
+	if (!mapping || !client->canSendFiles()) {
+		client->sendExportRawFailure("The recording cannot be exported raw, "
+				"as it is not stored contiguously or files cannot be sent to "
+				"this client. Its data must be requested instead.");
+		return;
+	}
+	if ((start >= stop) || (stop > recording->nsamples)) {
+		client->sendExportRawFailure(QString("The requested samples are invalid. "
+				"The stop sample must be greater than the start sample, and at most "
+				"the %1 samples of the recording. The request was for [%2, %3).").arg(
+				recording->nsamples).arg(start).arg(stop).toUtf8());
+		return;
+	}
+	if ((stop - start) * mapping->nchannels() * sizeof(DataFrame::DataType) >
+			Client::maxRawExportBytes()) {
+		client->sendExportRawFailure("The requested samples are too large "
+				"for one message, and must be exported in several.");
+		return;
+	}
+
+	/* The file is opened again, so that the transfer has a descriptor of
+	 * its own, which remains valid however long it takes.
+	 */
+	auto file = std::make_shared<QFile>(recording->path);
+	if (!file->open(QIODevice::ReadOnly)) {
+		client->sendExportRawFailure(QString("Could not open the recording: %1").arg(
+				file->errorString()).toUtf8());
+		return;
+	}
+	client->sendRawExport(start, stop, mapping->nchannels(), mapping->layout(),
+			file, mapping->regions(start, stop));
+}
+
+void Server::handleRecordingDataRead(Client *client,
+		const Client::DataRequest& request, const DataFrame& frame)
+{
+	if (request.exported) {
+		client->sendExportedFrame(frame);
+	} else if (request.sampleIndexed) {
+		client->sendSampleIndexedDataFrame(frame);
 	} else {
-		client->sendErrorMessage("There is no active recording, data cannot be requested.");
+		client->sendDataFrame(frame);
+	}
+	if (streamReadsInFlight.remove(client) && client->readyForBulk()) {
+		client->scheduleStream();
+	}
+}
+
+void Server::handleRecordingReadFailed(Client *client,
+		const Client::DataRequest& request, const QString& msg)
+{
+	if (streamReadsInFlight.remove(client)) {
+		client->dropStreamedRequest(request);
+		if (client->readyForBulk()) {
+			client->scheduleStream();
+		}
+	}
+	if (request.exported) {
+		client->abortExport();
+	}
+	client->sendErrorMessage(msg.toUtf8());
+}
+
+void Server::handleClientStreamReady(Client *client)
+{
+	/* Pieces are read one at a time, and the next is taken once the
+	 * last has been sent.
+	 */
+	if (streamReadsInFlight.contains(client)) {
+		return;
+	}
+
+	auto recording = openRecordings.constFind(client);
+	bool opened = (recording != openRecordings.constEnd());
+	if (!opened && !file) {
+		client->clearStreamedRequests();
+		client->abortExport();
+		client->sendErrorMessage("The recording file was closed while "
+				"requested data was being sent.");
+		return;
+	}
+
+	auto sr = opened ? recording->sampleRate : file->sampleRate();
+	auto piece = client->takeStreamedPiece(static_cast<quint64>(streamFrameSize * sr));
+	piece.start = static_cast<float>(piece.startSample / sr);
+	piece.stop = static_cast<float>(piece.stopSample / sr);
+	streamReadsInFlight.insert(client);
+	recordingReader->read(client, piece);
+}
+
+void Server::handleClientCancelDataRequest(Client *client, quint32 id,
+		quint64 start, quint64 stop)
+{
+	if ((id == 0) && (stop <= start)) {
+		client->sendCancelDataResponse(false, 0, "Either a request identifier "
+				"or a non-empty range of samples is required to cancel requests.");
+		return;
 	}
+	auto count = client->cancelPendingRequests(id, start, stop);
+	client->sendCancelDataResponse(true, count);
 }
 
 void Server::handleClientAllDataRequest(Client *client, bool requested)
@@ -953,6 +1897,147 @@ void Server::handleClientAllDataRequest(Client *client, bool requested)
 	client->sendAllDataResponse(success, msg);
 }
 
+void Server::handleClientSetClientParamMessage(Client *client,
+		const QByteArray& param, const QVariant& data)
+{
+	bool success = false;
+	QByteArray msg;
+	if (param == "socket-profile") {
+		auto profile = data.toByteArray();
+		success = true;
+		if (profile == "default") {
+			client->setSocketProfile(Client::SocketProfile::Default);
+		} else if (profile == "latency") {
+			client->setSocketProfile(Client::SocketProfile::Latency);
+		} else if (profile == "throughput") {
+			client->setSocketProfile(Client::SocketProfile::Throughput);
+		} else {
+			success = false;
+			msg = "Unknown socket profile: " + profile + 
+				". Must be one of \"default\", \"latency\" or \"throughput\".";
+		}
+		if (success) {
+			qInfo().noquote() << "Client at" << client->address()
+				<< "set its socket profile to" << profile;
+		}
+	} else if (param == "encoding") {
+		auto name = data.toByteArray();
+		auto encoding = framecodec::fromName(name, &success);
+		if (success) {
+			client->setEncoding(encoding);
+			qInfo().noquote() << "Client at" << client->address()
+				<< "set its frame encoding to" << name;
+		} else {
+			msg = "Unknown encoding: " + name + 
+				". Must be one of \"raw\", \"deflate\" or \"delta-bitpack\".";
+		}
+	} else if (param == "sample-type") {
+		auto type = data.toByteArray();
+		success = true;
+		if (type == "int16") {
+			client->setSampleType(DataFrame::SampleType::Int16);
+		} else if (type == "float32") {
+			client->setSampleType(DataFrame::SampleType::Float32);
+		} else {
+			success = false;
+			msg = "Unknown sample type: " + type + 
+				". Must be one of \"int16\" or \"float32\".";
+		}
+		if (success) {
+			qInfo().noquote() << "Client at" << client->address()
+				<< "set its sample type to" << type;
+		}
+	} else if (param == "sample-layout") {
+		auto layout = data.toByteArray();
+		success = true;
+		if (layout == "channel-major") {
+			client->setSampleLayout(DataFrame::SampleLayout::ChannelMajor);
+		} else if (layout == "time-major") {
+			client->setSampleLayout(DataFrame::SampleLayout::TimeMajor);
+		} else {
+			success = false;
+			msg = "Unknown sample layout: " + layout + 
+				". Must be one of \"channel-major\" or \"time-major\".";
+		}
+		if (success) {
+			qInfo().noquote() << "Client at" << client->address()
+				<< "set its sample layout to" << layout;
+		}
+	} else if (param == "frame-sequence") {
+		auto enabled = data.toBool();
+		client->setFrameSequence(enabled);
+		qInfo().noquote() << "Client at" << client->address()
+			<< (enabled ? "enabled" : "disabled") << "frame sequence numbers";
+		success = true;
+	} else if (param == "max-latency") {
+		auto latency = data.value<quint32>();
+		if (latency > MaximumClientLatency) {
+			msg = QString("The maximum latency must be at most %1 ms.").arg(
+					MaximumClientLatency).toUtf8();
+		} else {
+			client->setMaxLatency(latency);
+			qInfo().noquote() << "Client at" << client->address()
+				<< "set its maximum latency to" << latency << "ms";
+			success = true;
+		}
+	} else {
+		msg = "Unknown client parameter: " + param;
+	}
+	client->sendClientSetResponse(param, success, msg);
+}
+
+void Server::handleClientOpenSessionMessage(Client *client)
+{
+	auto session = client->session();
+	if (!session) {
+		auto token = QUuid::createUuid().toRfc4122().toHex();
+		session = std::make_shared<Session>(token, client->framesSent(),
+				static_cast<qint64>(sessionHistorySize) << 20);
+		sessions.insert(token, session);
+		client->openSession(session);
+		qInfo().noquote() << "Client at" << client->address() 
+			<< "opened session" << token;
+	}
+	client->sendOpenSessionResponse(true, session->token());
+}
+
+void Server::handleClientResumeSessionMessage(Client *client,
+		const QByteArray& token, quint64 lastSequence)
+{
+	auto session = sessions.value(token);
+	if (!session) {
+		client->sendResumeSessionResponse(false, 
+				"Unknown or expired session: " + token);
+		return;
+	}
+	if (session->attached()) {
+		client->sendResumeSessionResponse(false, 
+				"Session is in use by another connection.");
+		return;
+	}
+	if (client->session()) {
+		client->sendResumeSessionResponse(false, 
+				"Client already has a session.");
+		return;
+	}
+
+	QByteArray msg;
+	auto first = session->firstAvailableSequence();
+	if (lastSequence + 1 < first) {
+		msg = QString("Frames %1 to %2 are no longer available.").arg(
+				lastSequence + 1).arg(first - 1).toUtf8();
+	}
+	client->sendResumeSessionResponse(true, msg);
+	client->resumeSession(session, lastSequence);
+	qInfo().noquote() << "Client at" << client->address() 
+		<< "resumed session" << token << "after frame" << lastSequence;
+
+	/* Send any of its requests which were filled while it was away. */
+	if (file) {
+		servicePendingDataRequests();
+	}
+}
+
 void Server::connectClientSignals(Client *client)
 {
 	QObject::connect(client, &Client::disconnected,
@@ -977,8 +2062,34 @@ void Server::connectClientSignals(Client *client)
 			this, &Server::handleClientStopRecordingMessage);
 	QObject::connect(client, &Client::dataRequest,
 			this, &Server::handleClientDataRequest);
+	QObject::connect(client, &Client::sampleDataRequest,
+			this, &Server::handleClientSampleDataRequest);
+	QObject::connect(client, &Client::cancelDataRequest,
+			this, &Server::handleClientCancelDataRequest);
+	QObject::connect(client, &Client::streamReady,
+			this, &Server::handleClientStreamReady);
+	QObject::connect(client, &Client::openRecordingMessage,
+			this, &Server::handleClientOpenRecordingMessage);
+	QObject::connect(client, &Client::closeRecordingMessage,
+			this, &Server::handleClientCloseRecordingMessage);
+	QObject::connect(client, &Client::getRecordingsMessage,
+			this, &Server::handleClientGetRecordingsMessage);
+	QObject::connect(client, &Client::timeToSampleMessage,
+			this, &Server::handleClientTimeToSampleMessage);
+	QObject::connect(client, &Client::getEnvelopeMessage,
+			this, &Server::handleClientGetEnvelopeMessage);
+	QObject::connect(client, &Client::exportMessage,
+			this, &Server::handleClientExportMessage);
+	QObject::connect(client, &Client::exportRawMessage,
+			this, &Server::handleClientExportRawMessage);
 	QObject::connect(client, &Client::allDataRequest,
 			this, &Server::handleClientAllDataRequest);
+	QObject::connect(client, &Client::setClientParamMessage,
+			this, &Server::handleClientSetClientParamMessage);
+	QObject::connect(client, &Client::openSessionMessage,
+			this, &Server::handleClientOpenSessionMessage);
+	QObject::connect(client, &Client::resumeSessionMessage,
+			this, &Server::handleClientResumeSessionMessage);
 }
 
 void Server::checkRecordingFinished()
@@ -994,15 +2105,63 @@ void Server::handleRecordingFinished(double length)
 	QObject::disconnect(source, &datasource::BaseSource::dataAvailable,
 			this, &Server::handleNewDataAvailable);
 	emit requestSourceStopStream();
+	stopStreamMonitor();
+	flushLiveData();
 	qInfo().noquote() << length << "seconds of data finished streaming to data file.";
-	file.reset(nullptr);
+	closeFile();
 	saveFile.clear();
 }
 
-bool Server::verifyChunkRequest(double start, double stop)
+void Server::closeFile()
+{
+	envelope.reset();
+	envelopePath.clear();
+	/* The last pair was added at nextTimeIndexEntry less the interval, so
+	 * add any samples which arrived since.
+	 */
+	if (timeIndex && (lastArrival.sample > 0) && (lastArrival.time >
+				nextTimeIndexEntry - static_cast<qint64>(timeIndexInterval) * 1000000)) {
+		try {
+			timeIndex->append(lastArrival.time, lastArrival.sample);
+		} catch (std::exception& e) {
+			qWarning().noquote() << "Could not update time index of the recording:"
+				<< e.what();
+		}
+	}
+	timeIndex.reset();
+	recordingReader->setLiveFile(nullptr);
+	{
+		QMutexLocker lock(&hdf5Mutex());
+		file.reset();
+	}
+	recordingCatalog->setActiveFile(QString());
+}
+
+bool Server::verifyChunkRequest(double start, double stop, double sampleRate)
 {
 	return ( (start >= 0) && 
-			(stop > (start + (1 / sourceStatus["sample-rate"].toDouble()))) && 
-			((stop - start) <= maxRequestChunkSize));
+			(stop > (start + (1 / sampleRate))) && 
+			((maxRequestChunkSize <= 0) || ((stop - start) <= maxRequestChunkSize)));
+}
+
+bool Server::verifySampleChunkRequest(quint64 start, quint64 stop, double sampleRate)
+{
+	return ( (stop > start) && ((maxRequestChunkSize <= 0) ||
+			((stop - start) <= static_cast<quint64>(maxRequestChunkSize * sampleRate))) );
+}
+
+void Server::stopStreamMonitor()
+{
+	streamMonitor.stop();
+	if (streamMonitor.gaps() > 0) {
+		qWarning().noquote() << streamMonitor.gaps() 
+			<< "gaps were detected in the data stream.";
+	}
 }
 
+void Server::flushLiveData()
+{
+	for (auto client : clients) {
+		client->flushLiveData();
+	}
+}
@@ -0,0 +1,88 @@
+/*! \file session.cc
+ *
+ * Implementation of the sessions with which clients resume their
+ * subscriptions after reconnecting.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "session.h"
+
+Session::Session(const QByteArray& token, quint64 sequence, qint64 maxHistoryBytes) :
+	m_token(token),
+	m_sequence(sequence),
+	m_maxHistoryBytes(maxHistoryBytes),
+	m_historyBytes(0),
+	m_attached(true),
+	m_subscription { false, {}, DataFrame::SampleType::Int16,
+		DataFrame::SampleLayout::ChannelMajor, framecodec::Encoding::Raw, 0 }
+{
+}
+
+QByteArray Session::token() const
+{
+	return m_token;
+}
+
+quint64 Session::lastSequence() const
+{
+	return m_sequence;
+}
+
+quint64 Session::firstAvailableSequence() const
+{
+	return m_history.isEmpty() ? m_sequence + 1 : m_history.head().sequence;
+}
+
+quint64 Session::record(const DataFrame& frame, bool sampleIndexed)
+{
+	m_sequence++;
+	m_history.enqueue({ m_sequence, frame, sampleIndexed });
+	m_historyBytes += frame.payloadBytesize();
+
+	/* Drop the oldest frames, but always keep the newest. */
+	while ((m_historyBytes > m_maxHistoryBytes) && (m_history.size() > 1)) {
+		m_historyBytes -= m_history.dequeue().frame.payloadBytesize();
+	}
+	return m_sequence;
+}
+
+QList<Session::Frame> Session::framesAfter(quint64 sequence) const
+{
+	QList<Frame> frames;
+	for (const auto& frame : m_history) {
+		if (frame.sequence > sequence) {
+			frames.append(frame);
+		}
+	}
+	return frames;
+}
+
+bool Session::attached() const
+{
+	return m_attached;
+}
+
+void Session::attach()
+{
+	m_attached = true;
+	m_detached.invalidate();
+}
+
+void Session::detach(const Subscription& subscription)
+{
+	m_attached = false;
+	m_subscription = subscription;
+	m_detached.start();
+}
+
+qint64 Session::detachedFor() const
+{
+	return m_detached.isValid() ? m_detached.elapsed() : 0;
+}
+
+const Session::Subscription& Session::subscription() const
+{
+	return m_subscription;
+}
+
@@ -0,0 +1,297 @@
+/*! \file shared-memory-ring.cc
+ *
+ * Implementation of the shared-memory ring buffer used to publish
+ * data frames to local clients.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "shared-memory-ring.h"
+
+#include <sys/file.h> // flock
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring> // std::memcpy, std::strerror
+#include <new> // placement new
+#include <stdexcept>
+
+static_assert(sizeof(SharedMemoryRing::Header) == 64,
+		"Shared-memory ring header must be 64 bytes");
+static_assert(sizeof(SharedMemoryRing::RecordHeader) == 16,
+		"Shared-memory ring record header must be 16 bytes");
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2,
+		"Shared-memory ring requires lock-free 64-bit atomics");
+
+/* Records are aligned to the size of their header. */
+static quint64 alignRecord(quint64 size)
+{
+	const quint64 align = sizeof(SharedMemoryRing::RecordHeader);
+	return (size + align - 1) & ~(align - 1);
+}
+
+static std::runtime_error systemError(const QString& what)
+{
+	return std::runtime_error(QString("%1: %2").arg(what).arg(
+				std::strerror(errno)).toStdString());
+}
+
+/* Remove an existing object if no running instance owns it. Owners hold
+ * an exclusive lock on their object for as long as they run, which the
+ * system releases however they exit. Returns false if the object is in
+ * use, or its owner cannot be determined.
+ */
+static bool removeStaleObject(const char *name)
+{
+	auto fd = ::shm_open(name, O_RDWR, 0);
+	if (fd == -1) {
+		return (errno == ENOENT);
+	}
+	bool stale = (::flock(fd, LOCK_EX | LOCK_NB) == 0);
+	if (stale) {
+		::shm_unlink(name);
+	}
+	::close(fd);
+	return stale;
+}
+
+SharedMemoryRing::SharedMemoryRing(const QString& name, quint64 capacity) :
+	m_name(name.toLocal8Bit()),
+	m_fd(-1),
+	m_mappedSize(0),
+	m_header(nullptr),
+	m_data(nullptr)
+{
+	capacity = alignRecord(capacity);
+	if (capacity < 2 * sizeof(RecordHeader)) {
+		throw std::runtime_error("Shared-memory ring capacity is too small");
+	}
+
+	/* The ring of another running instance is never replaced, but one left
+	 * behind by an instance which has exited is. Samples are only readable
+	 * by the same user.
+	 */
+	m_fd = ::shm_open(m_name.constData(), O_CREAT | O_EXCL | O_RDWR, 0600);
+	if ((m_fd == -1) && (errno == EEXIST) && removeStaleObject(m_name.constData())) {
+		m_fd = ::shm_open(m_name.constData(), O_CREAT | O_EXCL | O_RDWR, 0600);
+	}
+	if (m_fd == -1) {
+		if (errno == EEXIST) {
+			throw std::runtime_error(QString("Shared-memory object %1 is used by "
+					"another instance. Choose another shared-memory-name in "
+					"blds.conf.").arg(name).toStdString());
+		}
+		throw systemError("Could not create shared-memory object " + name);
+	}
+	if (::flock(m_fd, LOCK_EX | LOCK_NB) == -1) {
+		auto err = systemError("Could not lock shared-memory object " + name);
+		::close(m_fd);
+		::shm_unlink(m_name.constData());
+		throw err;
+	}
+
+	m_mappedSize = sizeof(Header) + capacity;
+	if (::ftruncate(m_fd, m_mappedSize) == -1) {
+		auto err = systemError("Could not size shared-memory object " + name);
+		::close(m_fd);
+		::shm_unlink(m_name.constData());
+		throw err;
+	}
+
+	auto *addr = ::mmap(nullptr, m_mappedSize, PROT_READ | PROT_WRITE,
+			MAP_SHARED, m_fd, 0);
+	if (addr == MAP_FAILED) {
+		auto err = systemError("Could not map shared-memory object " + name);
+		::close(m_fd);
+		::shm_unlink(m_name.constData());
+		throw err;
+	}
+
+	m_header = new (addr) Header;
+	m_header->version = Version;
+	m_header->capacity = capacity;
+	m_header->sampleRate = 0.;
+	m_header->head.store(0, std::memory_order_relaxed);
+	m_header->tail.store(0, std::memory_order_relaxed);
+	m_header->sequence.store(0, std::memory_order_relaxed);
+	std::memset(m_header->reserved, 0, sizeof(m_header->reserved));
+	m_data = static_cast<char*>(addr) + sizeof(Header);
+
+	/* Readers check the magic number last, so publish it last. */
+	std::atomic_thread_fence(std::memory_order_release);
+	m_header->magic = Magic;
+}
+
+SharedMemoryRing::~SharedMemoryRing()
+{
+	::munmap(m_header, m_mappedSize);
+	::close(m_fd);
+	::shm_unlink(m_name.constData());
+}
+
+QString SharedMemoryRing::name() const
+{
+	return QString::fromLocal8Bit(m_name);
+}
+
+quint64 SharedMemoryRing::capacity() const
+{
+	return m_header->capacity;
+}
+
+void SharedMemoryRing::setSampleRate(double sampleRate)
+{
+	m_header->sampleRate = sampleRate;
+}
+
+void SharedMemoryRing::reserve(quint64 head, quint64 n)
+{
+	auto capacity = m_header->capacity;
+	if (head + n > capacity) {
+		m_header->tail.store(head + n - capacity, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+}
+
+bool SharedMemoryRing::publish(const DataFrame& frame)
+{
+	auto capacity = m_header->capacity;
+	quint32 size = frame.sampleIndexedBytesize();
+	auto recordSize = alignRecord(sizeof(RecordHeader) + size);
+	if (recordSize > capacity) {
+		return false;
+	}
+
+	auto head = m_header->head.load(std::memory_order_relaxed);
+	auto sequence = m_header->sequence.load(std::memory_order_relaxed) + 1;
+
+	/* Pad to the end of the ring if the record does not fit contiguously. */
+	auto position = head % capacity;
+	if (capacity - position < recordSize) {
+		auto remaining = capacity - position;
+		reserve(head, remaining);
+		RecordHeader padding { sequence, PaddingRecord,
+				static_cast<quint32>(remaining - sizeof(RecordHeader)) };
+		std::memcpy(m_data + position, &padding, sizeof(padding));
+		head += remaining;
+		m_header->head.store(head, std::memory_order_release);
+		position = 0;
+	}
+
+	/* Write the record, then make it visible to readers. */
+	reserve(head, recordSize);
+	RecordHeader record { sequence, FrameRecord, size };
+	std::memcpy(m_data + position, &record, sizeof(record));
+	frame.serializeSampleIndexedInto(m_data + position + sizeof(record));
+	m_header->sequence.store(sequence, std::memory_order_relaxed);
+	m_header->head.store(head + recordSize, std::memory_order_release);
+	return true;
+}
+
+SharedMemoryRingReader::SharedMemoryRingReader(const QString& name) :
+	m_fd(-1),
+	m_mappedSize(0),
+	m_header(nullptr),
+	m_data(nullptr),
+	m_position(0),
+	m_current(0),
+	m_overruns(0)
+{
+	auto path = name.toLocal8Bit();
+	m_fd = ::shm_open(path.constData(), O_RDONLY, 0);
+	if (m_fd == -1) {
+		throw systemError("Could not open shared-memory object " + name);
+	}
+
+	struct stat info;
+	if ((::fstat(m_fd, &info) == -1) ||
+			(static_cast<size_t>(info.st_size) < sizeof(SharedMemoryRing::Header))) {
+		::close(m_fd);
+		throw std::runtime_error("Shared-memory object is not a BLDS ring");
+	}
+	m_mappedSize = info.st_size;
+
+	auto *addr = ::mmap(nullptr, m_mappedSize, PROT_READ, MAP_SHARED, m_fd, 0);
+	if (addr == MAP_FAILED) {
+		auto err = systemError("Could not map shared-memory object " + name);
+		::close(m_fd);
+		throw err;
+	}
+	m_header = static_cast<const SharedMemoryRing::Header*>(addr);
+	m_data = static_cast<const char*>(addr) + sizeof(SharedMemoryRing::Header);
+
+	if ((m_header->magic != SharedMemoryRing::Magic) ||
+			(m_header->version != SharedMemoryRing::Version) ||
+			(sizeof(SharedMemoryRing::Header) + m_header->capacity > m_mappedSize)) {
+		::munmap(addr, m_mappedSize);
+		::close(m_fd);
+		throw std::runtime_error("Shared-memory object is not a compatible BLDS ring");
+	}
+	std::atomic_thread_fence(std::memory_order_acquire);
+
+	/* Start at the newest data. */
+	m_position = m_header->head.load(std::memory_order_acquire);
+	m_current = m_position;
+}
+
+SharedMemoryRingReader::~SharedMemoryRingReader()
+{
+	::munmap(const_cast<SharedMemoryRing::Header*>(m_header), m_mappedSize);
+	::close(m_fd);
+}
+
+const char *SharedMemoryRingReader::next(quint32 *size, quint64 *sequence)
+{
+	auto capacity = m_header->capacity;
+	while (true) {
+		auto head = m_header->head.load(std::memory_order_acquire);
+		if (m_position >= head) {
+			return nullptr;
+		}
+
+		/* Skip to the newest data if the writer has lapped this reader. */
+		if (m_header->tail.load(std::memory_order_acquire) > m_position) {
+			m_overruns++;
+			m_position = head;
+			continue;
+		}
+
+		auto *record = m_data + (m_position % capacity);
+		SharedMemoryRing::RecordHeader header;
+		std::memcpy(&header, record, sizeof(header));
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (m_header->tail.load(std::memory_order_relaxed) > m_position) {
+			continue; // header was overwritten while reading it
+		}
+
+		m_current = m_position;
+		m_position += alignRecord(sizeof(header) + header.size);
+		if (header.type == SharedMemoryRing::FrameRecord) {
+			*size = header.size;
+			if (sequence) {
+				*sequence = header.sequence;
+			}
+			return record + sizeof(header);
+		}
+	}
+}
+
+bool SharedMemoryRingReader::valid() const
+{
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return m_header->tail.load(std::memory_order_relaxed) <= m_current;
+}
+
+double SharedMemoryRingReader::sampleRate() const
+{
+	return m_header->sampleRate;
+}
+
+quint64 SharedMemoryRingReader::overruns() const
+{
+	return m_overruns;
+}
+
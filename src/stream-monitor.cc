@@ -0,0 +1,124 @@
+/*! \file stream-monitor.cc
+ *
+ * Implementation of the class numbering chunks of data from the source
+ * and detecting gaps in the stream.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "stream-monitor.h"
+
+#include <cmath> // std::llround
+
+StreamMonitor::StreamMonitor() :
+	m_sampleRate(0.),
+	m_readInterval(0),
+	m_expectedChunkSize(0),
+	m_lastChunkTime(0),
+	m_sequence(0),
+	m_samples(0),
+	m_irregularChunks(0),
+	m_lateChunks(0),
+	m_gaps(0),
+	m_droppedSamples(0),
+	m_anchorTime(0),
+	m_anchorSamples(0),
+	m_inGap(false),
+	m_gapTime(0),
+	m_lag(0),
+	m_maxLag(0)
+{
+}
+
+void StreamMonitor::start(double sampleRate, quint32 readInterval)
+{
+	m_sampleRate = sampleRate;
+	m_readInterval = readInterval;
+	m_expectedChunkSize = std::llround(sampleRate * readInterval / 1000.);
+	m_lastChunkTime = 0;
+	m_sequence = 0;
+	m_samples = 0;
+	m_irregularChunks = 0;
+	m_lateChunks = 0;
+	m_gaps = 0;
+	m_droppedSamples = 0;
+	m_anchorTime = 0;
+	m_anchorSamples = 0;
+	m_inGap = false;
+	m_gapTime = 0;
+	m_lag = 0;
+	m_maxLag = 0;
+	m_elapsed.start();
+}
+
+void StreamMonitor::stop()
+{
+	m_elapsed.invalidate();
+}
+
+quint64 StreamMonitor::addChunk(quint64 nsamples)
+{
+	m_sequence++;
+	m_samples += nsamples;
+	if (!m_elapsed.isValid()) {
+		return m_sequence;
+	}
+
+	if (nsamples != m_expectedChunkSize) {
+		m_irregularChunks++;
+	}
+	auto now = m_elapsed.elapsed();
+	if ((m_sequence > 1) && 
+			(now - m_lastChunkTime > 2 * static_cast<qint64>(m_readInterval))) {
+		m_lateChunks++;
+	}
+	m_lastChunkTime = now;
+
+	/* Samples still owed by the source, given the time since the anchor. */
+	auto expected = static_cast<qint64>((now - m_anchorTime) * m_sampleRate / 1000.);
+	m_lag = expected - static_cast<qint64>(m_samples - m_anchorSamples);
+	m_maxLag = qMax(m_maxLag, m_lag);
+	auto chunk = static_cast<qint64>(m_expectedChunkSize);
+	if (m_lag <= GapThreshold * chunk) {
+		m_inGap = false;
+		if (m_lag <= chunk) {
+			m_anchorTime = now;
+			m_anchorSamples = m_samples;
+		}
+	} else if (!m_inGap) {
+		m_inGap = true;
+		m_gapTime = now;
+	} else if (now - m_gapTime >= static_cast<qint64>(m_readInterval)) {
+		m_inGap = false;
+		m_gaps++;
+		m_droppedSamples += m_lag;
+		qWarning().noquote() << "Gap in the data stream at chunk" << m_sequence
+			<< ": the source dropped about" << m_lag << "samples.";
+		m_anchorTime = now;
+		m_anchorSamples = m_samples;
+	}
+	return m_sequence;
+}
+
+quint64 StreamMonitor::gaps() const
+{
+	return m_gaps;
+}
+
+QVariantMap StreamMonitor::status() const
+{
+	return QVariantMap {
+		{ "running", m_elapsed.isValid() },
+		{ "chunks", m_sequence },
+		{ "samples", m_samples },
+		{ "expected-chunk-size", m_expectedChunkSize },
+		{ "irregular-chunks", m_irregularChunks },
+		{ "late-chunks", m_lateChunks },
+		{ "gaps", m_gaps },
+		{ "dropped-samples", m_droppedSamples },
+		{ "in-gap", m_inGap },
+		{ "sample-lag", m_lag },
+		{ "max-sample-lag", m_maxLag }
+	};
+}
+
@@ -0,0 +1,184 @@
+/*! \file time-index.cc
+ *
+ * Implementation of the index from the time of the host to samples.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "time-index.h"
+
+#include <algorithm> // std::lower_bound
+#include <cstring> // std::memcpy, std::memcmp
+#include <stdexcept>
+
+#ifdef Q_OS_UNIX
+#include <time.h> // clock_gettime
+#endif
+
+/* Identifies a sidecar, and the version of its layout. */
+static const char Magic[8] = { 'B', 'L', 'D', 'S', 'T', 'I', 'M', 'E' };
+static const quint32 Version = 1;
+
+/* Size of the header: the magic, version, a reserved field and the start
+ * time. Pairs following it are aligned to 8 bytes, that of their fields.
+ */
+static const qint64 HeaderSize = sizeof(Magic) + 2 * sizeof(quint32) + sizeof(qint64);
+
+/* Return the time on the wall clock, in microseconds since the epoch. */
+static qint64 wallClockMicroseconds()
+{
+#ifdef Q_OS_UNIX
+	struct timespec now;
+	if (::clock_gettime(CLOCK_REALTIME, &now) == 0) {
+		return static_cast<qint64>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+	}
+#endif
+	return QDateTime::currentMSecsSinceEpoch() * 1000;
+}
+
+QString TimeIndex::sidecarPath(const QString& recording)
+{
+	return recording + ".timeindex";
+}
+
+TimeIndex::TimeIndex(const QString& path, bool writable) :
+	m_file(path),
+	m_writable(writable),
+	m_startTime(0),
+	m_mapped(nullptr),
+	m_mappedSize(0)
+{
+}
+
+std::unique_ptr<TimeIndex> TimeIndex::create(const QString& path)
+{
+	std::unique_ptr<TimeIndex> index { new TimeIndex(path, true) };
+	if (!index->m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		throw std::runtime_error(QString("Could not create time index %1: %2").arg(
+					path, index->m_file.errorString()).toStdString());
+	}
+	index->m_startTime = wallClockMicroseconds();
+	index->m_clock.start();
+
+	QByteArray header(Magic, sizeof(Magic));
+	quint32 fields[2] = { Version, 0 };
+	header.append(reinterpret_cast<const char*>(fields), sizeof(fields));
+	header.append(reinterpret_cast<const char*>(&index->m_startTime),
+			sizeof(index->m_startTime));
+	if ((index->m_file.write(header) != HeaderSize) || !index->m_file.flush()) {
+		throw std::runtime_error(QString("Could not write time index %1: %2").arg(
+					path, index->m_file.errorString()).toStdString());
+	}
+	return index;
+}
+
+std::unique_ptr<TimeIndex> TimeIndex::open(const QString& path)
+{
+	std::unique_ptr<TimeIndex> index { new TimeIndex(path, false) };
+	if (!index->m_file.open(QIODevice::ReadOnly)) {
+		throw std::runtime_error(QString("Could not open time index %1: %2").arg(
+					path, index->m_file.errorString()).toStdString());
+	}
+	auto header = index->m_file.read(HeaderSize);
+	quint32 version = 0;
+	if (header.size() == HeaderSize) {
+		std::memcpy(&version, header.constData() + sizeof(Magic), sizeof(version));
+	}
+	if ((header.size() != HeaderSize) ||
+			std::memcmp(header.constData(), Magic, sizeof(Magic)) ||
+			(version != Version)) {
+		throw std::runtime_error("The time index is invalid or of an unknown version.");
+	}
+	std::memcpy(&index->m_startTime,
+			header.constData() + sizeof(Magic) + 2 * sizeof(quint32),
+			sizeof(index->m_startTime));
+
+	/* A pair being written when the recording stopped is ignored. */
+	index->m_mappedSize = (index->m_file.size() - HeaderSize) / sizeof(Entry);
+	if (index->m_mappedSize) {
+		auto *mapped = index->m_file.map(HeaderSize, index->m_mappedSize * sizeof(Entry));
+		if (!mapped) {
+			throw std::runtime_error(QString("Could not map time index %1: %2").arg(
+						path, index->m_file.errorString()).toStdString());
+		}
+		index->m_mapped = reinterpret_cast<const Entry*>(mapped);
+	}
+	return index;
+}
+
+TimeIndex::~TimeIndex()
+{
+	if (m_mapped) {
+		m_file.unmap(reinterpret_cast<uchar*>(const_cast<Entry*>(m_mapped)));
+	}
+}
+
+qint64 TimeIndex::startTime() const
+{
+	return m_startTime;
+}
+
+quint64 TimeIndex::size() const
+{
+	return m_writable ? m_appended.size() : m_mappedSize;
+}
+
+qint64 TimeIndex::elapsed() const
+{
+	return m_clock.isValid() ? m_clock.nsecsElapsed() : 0;
+}
+
+const TimeIndex::Entry *TimeIndex::entries() const
+{
+	return m_writable ? m_appended.constData() : m_mapped;
+}
+
+void TimeIndex::append(qint64 time, quint64 sample)
+{
+	if (!m_writable) {
+		throw std::logic_error("The time index is read-only.");
+	}
+	if (!m_appended.isEmpty() && ((time < m_appended.last().time) ||
+				(sample < m_appended.last().sample))) {
+		throw std::logic_error("Pairs must be appended in order.");
+	}
+
+	/* Flushed, so that the pair can be read as soon as it is appended. */
+	Entry entry { time, sample };
+	if ((m_file.write(reinterpret_cast<const char*>(&entry), sizeof(entry)) !=
+				static_cast<qint64>(sizeof(entry))) || !m_file.flush()) {
+		throw std::runtime_error(QString("Could not write time index %1: %2").arg(
+					m_file.fileName(), m_file.errorString()).toStdString());
+	}
+	m_appended.append(entry);
+}
+
+TimeIndex::Samples TimeIndex::lookup(qint64 time) const
+{
+	auto count = size();
+	if (count == 0) {
+		throw std::out_of_range("The recording has no indexed times.");
+	}
+	const auto *begin = entries();
+	const auto *end = begin + count;
+	auto relative = (time - m_startTime) * 1000;
+	if ((time < m_startTime) || (relative > end[-1].time)) {
+		throw std::out_of_range("The time is outside of the indexed times of the recording.");
+	}
+
+	/* The first pair at or after the time, and the one before it, which is
+	 * the creation of the index, with no samples, before the first pair.
+	 */
+	auto after = std::lower_bound(begin, end, relative,
+			[](const Entry& entry, qint64 t) -> bool { return entry.time < t; });
+	if (after->time == relative) {
+		return { after->sample, after->sample, after->sample };
+	}
+	auto before = (after == begin) ? Entry { 0, 0 } : after[-1];
+	auto fraction = static_cast<double>(relative - before.time) /
+		static_cast<double>(after->time - before.time);
+	auto sample = before.sample + static_cast<quint64>(
+			fraction * static_cast<double>(after->sample - before.sample));
+	return { before.sample, after->sample, sample };
+}
+